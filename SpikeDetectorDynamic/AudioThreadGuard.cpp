@@ -0,0 +1,77 @@
+
+#include "AudioThreadGuard.h"
+
+#if SPIKEDETECTOR_AUDIO_THREAD_GUARD
+
+#include <atomic>
+#include <iostream>
+
+namespace
+{
+#if defined (__GLIBC__)
+    // initial-exec keeps the first access from allocating inside malloc()
+    __thread int scopeDepth __attribute__((tls_model("initial-exec"))) = 0;
+#else
+    thread_local int scopeDepth = 0;
+#endif
+
+    std::atomic<int64_t> numAllocations(0);
+    std::atomic<int64_t> numBlockingCalls(0);
+    std::atomic<bool> allocationsHooked(false);
+}
+
+AudioThreadGuard::Scope::Scope()
+{
+    scopeDepth++;
+}
+
+AudioThreadGuard::Scope::~Scope()
+{
+    scopeDepth--;
+}
+
+bool AudioThreadGuard::isInsideScope()
+{
+    return scopeDepth > 0;
+}
+
+void AudioThreadGuard::reportAllocation()
+{
+    if (scopeDepth > 0)
+        numAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AudioThreadGuard::reportBlockingCall(const char* /*description*/)
+{
+    if (scopeDepth > 0)
+        numBlockingCalls.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AudioThreadGuard::setAllocationsHooked()
+{
+    allocationsHooked = true;
+}
+
+int64_t AudioThreadGuard::getNumAllocations()
+{
+    return numAllocations.load();
+}
+
+int64_t AudioThreadGuard::getNumBlockingCalls()
+{
+    return numBlockingCalls.load();
+}
+
+void AudioThreadGuard::printReport()
+{
+    std::cout << "Audio thread guard: ";
+
+    if (allocationsHooked)
+        std::cout << numAllocations.exchange(0) << " allocations, ";
+    else
+        std::cout << "allocations not checked (no allocator hooks in this process), ";
+
+    std::cout << numBlockingCalls.exchange(0) << " blocking calls on the real-time path." << std::endl;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef __AUDIOTHREADGUARD_H_9D4B7C21__
+#define __AUDIOTHREADGUARD_H_9D4B7C21__
+
+/**
+  Debug/test build mode that checks the real-time path of the detector.
+
+  When compiled with SPIKEDETECTOR_AUDIO_THREAD_GUARD=1, process() and the
+  detection pass of the pipelined thread open a real-time scope, and heap
+  allocations and blocking calls made inside one are counted. Reporting only
+  increments atomic counters: nothing is logged or asserted inside the
+  scope, since that would itself allocate and block.
+
+  The guard does not replace the allocator. A plugin is loaded with
+  RTLD_LOCAL, so an allocator defined in it would only see its own
+  allocations and miss those made inside JUCE and the C++ runtime. Instead
+  the process that runs the detection installs the hooks: tests/realtime_test
+  interposes malloc, operator new and the usual blocking calls for the whole
+  executable and calls reportAllocation() and reportBlockingCall(). Code that
+  knows it may block can also report itself through AUDIO_THREAD_BLOCKING_CALL.
+
+  In normal builds the macros are empty.
+*/
+
+#ifndef SPIKEDETECTOR_AUDIO_THREAD_GUARD
+#define SPIKEDETECTOR_AUDIO_THREAD_GUARD 0
+#endif
+
+#if SPIKEDETECTOR_AUDIO_THREAD_GUARD
+
+#include <cstdint>
+
+class AudioThreadGuard
+{
+public:
+    /** Marks the calling thread as real-time for the lifetime of the object. */
+    class Scope
+    {
+    public:
+        Scope();
+        ~Scope();
+    };
+
+    /** True if the calling thread is inside a real-time scope. */
+    static bool isInsideScope();
+
+    /** Called by the allocator hooks; counts the call inside a scope. */
+    static void reportAllocation();
+
+    /** Called before an operation that may block; counts it inside a scope. */
+    static void reportBlockingCall(const char* description);
+
+    /** Called once by the process when it installs its allocator hooks, so
+        that the report can tell a clean run from an unchecked one. */
+    static void setAllocationsHooked();
+
+    static int64_t getNumAllocations();
+    static int64_t getNumBlockingCalls();
+
+    /** Prints the number of violations seen so far and clears the counters.
+        Not to be called inside a scope. */
+    static void printReport();
+};
+
+#define AUDIO_THREAD_SCOPE AudioThreadGuard::Scope audioThreadScope;
+#define AUDIO_THREAD_BLOCKING_CALL(description) AudioThreadGuard::reportBlockingCall(description);
+
+#else
+
+#define AUDIO_THREAD_SCOPE
+#define AUDIO_THREAD_BLOCKING_CALL(description)
+
+#endif
+
+#endif  // __AUDIOTHREADGUARD_H_9D4B7C21__
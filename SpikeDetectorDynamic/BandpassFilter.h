@@ -0,0 +1,101 @@
+
+#ifndef __BANDPASSFILTER_H_2F7D90C6__
+#define __BANDPASSFILTER_H_2F7D90C6__
+
+#include <algorithm>
+#include <cmath>
+
+/** State of one second-order section (transposed direct form II). */
+struct BiquadState
+{
+    double z1;
+    double z2;
+};
+
+/** Coefficients of one second-order section, normalised so that a0 = 1. */
+struct BiquadCoefficients
+{
+    double b0, b1, b2;
+    double a1, a2;
+};
+
+/**
+  Band-pass filter made of a 2nd-order Butterworth high-pass followed by a
+  2nd-order Butterworth low-pass.
+
+  The filter itself is stateless; each channel keeps two BiquadStates, so the
+  same coefficients can be applied to every channel and the state carried
+  across callbacks.
+*/
+
+class BandpassFilter
+{
+public:
+    BandpassFilter()
+    {
+        setCutoffs(30000.0, 300.0, 6000.0);
+    }
+
+    /** Computes the coefficients (bilinear transform, Q = 1/sqrt(2)). Cutoffs
+        are clamped to maxCutoffRatio times the sample rate, as the sections
+        turn unstable towards Nyquist; returns false if one was. */
+    bool setCutoffs(double sampleRate, double lowCut, double highCut)
+    {
+        const double pi = 3.14159265358979323846;
+        const double q = 1.0 / std::sqrt(2.0);
+
+        double maxCut = maxCutoffRatio * sampleRate;
+        bool isValid = lowCut < maxCut && highCut < maxCut;
+
+        lowCut = std::min(lowCut, maxCut);
+        highCut = std::min(highCut, maxCut);
+
+        double w0 = 2.0 * pi * lowCut / sampleRate;
+        double alpha = std::sin(w0) / (2.0 * q);
+        double cosw0 = std::cos(w0);
+        double a0 = 1.0 + alpha;
+
+        highPass.b0 = (1.0 + cosw0) / 2.0 / a0;
+        highPass.b1 = -(1.0 + cosw0) / a0;
+        highPass.b2 = (1.0 + cosw0) / 2.0 / a0;
+        highPass.a1 = -2.0 * cosw0 / a0;
+        highPass.a2 = (1.0 - alpha) / a0;
+
+        w0 = 2.0 * pi * highCut / sampleRate;
+        alpha = std::sin(w0) / (2.0 * q);
+        cosw0 = std::cos(w0);
+        a0 = 1.0 + alpha;
+
+        lowPass.b0 = (1.0 - cosw0) / 2.0 / a0;
+        lowPass.b1 = (1.0 - cosw0) / a0;
+        lowPass.b2 = (1.0 - cosw0) / 2.0 / a0;
+        lowPass.a1 = -2.0 * cosw0 / a0;
+        lowPass.a2 = (1.0 - alpha) / a0;
+
+        return isValid;
+    }
+
+    /** Highest cutoff, as a fraction of the sample rate. */
+    static constexpr double maxCutoffRatio = 0.45;
+
+    /** Filters one sample; state points to the two sections of the channel. */
+    inline float processSample(float x, BiquadState* state) const
+    {
+        double y = processSection(highPass, state[0], x);
+        return float(processSection(lowPass, state[1], y));
+    }
+
+private:
+    static inline double processSection(const BiquadCoefficients& c, BiquadState& s, double x)
+    {
+        double y = c.b0 * x + s.z1;
+        s.z1 = c.b1 * x - c.a1 * y + s.z2;
+        s.z2 = c.b2 * x - c.a2 * y;
+        return y;
+    }
+
+    BiquadCoefficients highPass;
+    BiquadCoefficients lowPass;
+};
+
+#endif  // __BANDPASSFILTER_H_2F7D90C6__
@@ -0,0 +1,199 @@
+
+#include "BlockRecorder.h"
+
+// about one second of 384 channels at 30 kHz
+#define CAPTURE_RING_SIZE (1 << 26)
+
+BlockRecorder::BlockRecorder()
+    : Thread("Block Recorder"), fifo(1), start1(0), size1(0), start2(0), size2(0),
+      recordSize(0), recordOffset(0), blockIndex(0), numRecordedBlocks(0), numDroppedBlocks(0)
+{
+}
+
+BlockRecorder::~BlockRecorder()
+{
+    stop();
+}
+
+bool BlockRecorder::start(const File& file, double sampleRate, int numChannels, const float* bitVolts,
+                          const CaptureSettings& settings, const float* warmLevels,
+                          const CaptureElectrode* electrodes, int numElectrodes)
+{
+    stop();
+
+    // FileOutputStream appends to existing files
+    file.deleteFile();
+    ScopedPointer<FileOutputStream> output = new FileOutputStream(file, 1 << 20);
+
+    if (! output->openedOk())
+        return false;
+
+    CaptureFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    header.version = CAPTURE_VERSION;
+    header.numChannels = uint32(numChannels);
+    header.sampleRate = sampleRate;
+
+    output->write(&header, sizeof(header));
+    output->write(bitVolts, sizeof(float) * numChannels);
+
+    // settings only change between acquisitions, so they are written here directly
+    int numWarmLevels = int(settings.numNoiseEstimators) * numChannels;
+
+    CaptureRecordHeader settingsHeader;
+    settingsHeader.type = CaptureSettingsRecord;
+    settingsHeader.size = uint32(sizeof(CaptureSettings) + numWarmLevels * sizeof(float));
+
+    output->write(&settingsHeader, sizeof(settingsHeader));
+    output->write(&settings, sizeof(settings));
+    output->write(warmLevels, sizeof(float) * numWarmLevels);
+
+    if (ring == nullptr)
+        ring.malloc(CAPTURE_RING_SIZE);
+
+    fifo.setTotalSize(CAPTURE_RING_SIZE);
+    fifo.reset();
+
+    captureFile = file;
+    stream = output.release();
+    blockIndex = 0;
+    numRecordedBlocks = 0;
+    numDroppedBlocks = 0;
+
+    // goes through the ring like later layout changes, so records stay in order
+    recordLayout(electrodes, numElectrodes);
+
+    startThread(3);
+    return true;
+}
+
+void BlockRecorder::stop()
+{
+    if (stream == nullptr)
+        return;
+
+    stopThread(2000);
+    writeReadyBytes();
+    stream->flush();
+    stream = nullptr;
+}
+
+void BlockRecorder::recordLayout(const CaptureElectrode* electrodes, int numElectrodes)
+{
+    CaptureRecordHeader header;
+    header.type = CaptureLayoutRecord;
+    header.size = uint32(2 * sizeof(uint32) + numElectrodes * sizeof(CaptureElectrode));
+
+    uint32 counts[2] = { uint32(numElectrodes), 0 };
+
+    if (! beginRecord(int(sizeof(header) + header.size)))
+        return; // the next block is still interpreted with the previous layout
+
+    writeBytes(&header, sizeof(header));
+    writeBytes(counts, sizeof(counts));
+    writeBytes(electrodes, numElectrodes * int(sizeof(CaptureElectrode)));
+    endRecord();
+}
+
+void BlockRecorder::recordBlock(const AudioSampleBuffer& buffer, int numChannels,
+                                const int64* timestamps, const int* numSamples)
+{
+    int bufferLength = buffer.getNumSamples();
+    numChannels = jmin(numChannels, buffer.getNumChannels());
+
+    CaptureRecordHeader header;
+    header.type = CaptureBlockRecord;
+    header.size = uint32(sizeof(CaptureBlockHeader)
+                         + numChannels * (sizeof(int64) + sizeof(int32) + sizeof(float) * bufferLength));
+
+    CaptureBlockHeader block;
+    block.blockIndex = blockIndex++;
+    block.numChannels = uint32(numChannels);
+    block.numSamples = uint32(bufferLength);
+
+    if (! beginRecord(int(sizeof(header) + header.size)))
+    {
+        numDroppedBlocks++;
+        return;
+    }
+
+    writeBytes(&header, sizeof(header));
+    writeBytes(&block, sizeof(block));
+    writeBytes(timestamps, numChannels * int(sizeof(int64)));
+    writeBytes(numSamples, numChannels * int(sizeof(int32)));
+
+    for (int chan = 0; chan < numChannels; chan++)
+        writeBytes(buffer.getReadPointer(chan), bufferLength * int(sizeof(float)));
+
+    endRecord();
+    numRecordedBlocks++;
+
+    // no notify(): it takes a lock, and the writer polls the ring every 50 ms
+}
+
+bool BlockRecorder::beginRecord(int numBytes)
+{
+    if (numBytes > fifo.getFreeSpace())
+        return false;
+
+    fifo.prepareToWrite(numBytes, start1, size1, start2, size2);
+    recordSize = numBytes;
+    recordOffset = 0;
+    return true;
+}
+
+void BlockRecorder::writeBytes(const void* data, int numBytes)
+{
+    const uint8* source = static_cast<const uint8*>(data);
+
+    // the reserved region may wrap around the end of the ring
+    if (recordOffset < size1)
+    {
+        int n = jmin(numBytes, size1 - recordOffset);
+        memcpy(ring + start1 + recordOffset, source, n);
+        source += n;
+        numBytes -= n;
+        recordOffset += n;
+    }
+
+    if (numBytes > 0)
+    {
+        memcpy(ring + start2 + recordOffset - size1, source, numBytes);
+        recordOffset += numBytes;
+    }
+}
+
+void BlockRecorder::endRecord()
+{
+    jassert(recordOffset == recordSize);
+    fifo.finishedWrite(recordSize);
+}
+
+void BlockRecorder::run()
+{
+    while (! threadShouldExit())
+    {
+        writeReadyBytes();
+        wait(50);
+    }
+}
+
+void BlockRecorder::writeReadyBytes()
+{
+    int numReady = fifo.getNumReady();
+
+    if (numReady == 0)
+        return;
+
+    int readStart1, readSize1, readStart2, readSize2;
+    fifo.prepareToRead(numReady, readStart1, readSize1, readStart2, readSize2);
+
+    if (readSize1 > 0)
+        stream->write(ring + readStart1, size_t(readSize1));
+
+    if (readSize2 > 0)
+        stream->write(ring + readStart2, size_t(readSize2));
+
+    fifo.finishedRead(readSize1 + readSize2);
+}
@@ -0,0 +1,77 @@
+
+#ifndef __BLOCKRECORDER_H_5B7C09E3__
+#define __BLOCKRECORDER_H_5B7C09E3__
+
+#include <ProcessorHeaders.h>
+#include "CaptureFormat.h"
+
+/**
+  Captures the input of process() to a file, so that a session can be fed
+  through the detector again offline (see tools/replay).
+
+  The audio thread copies each block, with its timestamps and valid sample
+  counts, into a preallocated byte ring and never waits: a block that does
+  not fit is dropped and counted. A background thread writes the ring to
+  the file. The format is described in CaptureFormat.h.
+*/
+
+class BlockRecorder : private Thread
+{
+public:
+    BlockRecorder();
+    ~BlockRecorder();
+
+    /** Creates (or replaces) the file, writes its header, the settings with
+        the warm-start levels (numNoiseEstimators x numChannels) and the
+        electrode layout, and starts the writer thread. Called from enable(). */
+    bool start(const File& file, double sampleRate, int numChannels, const float* bitVolts,
+               const CaptureSettings& settings, const float* warmLevels,
+               const CaptureElectrode* electrodes, int numElectrodes);
+
+    /** Writes what is left in the ring and closes the file. */
+    void stop();
+
+    bool isRecording() const { return stream != nullptr; }
+
+    const File& getFile() const { return captureFile; }
+
+    /** Called from process() when the electrode settings have changed. */
+    void recordLayout(const CaptureElectrode* electrodes, int numElectrodes);
+
+    /** Called from process() with the first numChannels channels of the buffer. */
+    void recordBlock(const AudioSampleBuffer& buffer, int numChannels,
+                     const int64* timestamps, const int* numSamples);
+
+    int64 getNumRecordedBlocks() const { return numRecordedBlocks; }
+    int64 getNumDroppedBlocks() const { return numDroppedBlocks; }
+
+private:
+    void run();
+
+    /** Writes everything that is ready in the ring to the file. */
+    void writeReadyBytes();
+
+    /** Reserves numBytes in the ring; returns false if they do not fit. */
+    bool beginRecord(int numBytes);
+    void writeBytes(const void* data, int numBytes);
+    void endRecord();
+
+    File captureFile;
+    ScopedPointer<FileOutputStream> stream;
+
+    HeapBlock<uint8> ring;
+    AbstractFifo fifo;
+
+    // the region reserved by beginRecord() and the bytes written into it
+    int start1, size1, start2, size2;
+    int recordSize;
+    int recordOffset;
+
+    int64 blockIndex;
+    int64 numRecordedBlocks;
+    int64 numDroppedBlocks;
+
+    JUCE_DECLARE_NON_COPYABLE(BlockRecorder);
+};
+
+#endif  // __BLOCKRECORDER_H_5B7C09E3__
@@ -0,0 +1,99 @@
+
+#ifndef __CAPTUREFORMAT_H_8E51D2A7__
+#define __CAPTUREFORMAT_H_8E51D2A7__
+
+#include <cstdint>
+
+/**
+  Layout of the capture files written by BlockRecorder (captureFile option)
+  and read by tools/replay.
+
+  A capture starts with a CaptureFileHeader followed by the bitVolts of each
+  input channel (float32), then holds a sequence of records, each made of a
+  CaptureRecordHeader and size bytes of payload:
+
+  - CaptureSettingsRecord: a CaptureSettings, then numNoiseEstimators x
+    numChannels float32 (estimator by estimator): the level each estimator
+    was warm-started from, 0 where it started from the first window. Written
+    once, first; the settings only change when acquisition starts again.
+
+  - CaptureLayoutRecord: a uint32 number of electrodes, a uint32 set to 0,
+    then one CaptureElectrode per electrode. Written before the first block
+    and again whenever thresholds, active channels or noise estimators change
+    during acquisition; it applies to the blocks that follow.
+
+  - CaptureBlockRecord: a CaptureBlockHeader, then the timestamp (int64) of
+    each channel, the number of valid samples (int32) of each channel as
+    returned by getNumSamples(), and the whole buffer, channel by channel
+    (numChannels x numSamples float32), as process() received it.
+
+  Blocks that did not fit into the recorder's ring are left out; their
+  blockIndex is skipped. Readers should skip records of unknown types.
+
+  All values are little-endian. This header only depends on the standard
+  library, so that tools can include it on its own.
+*/
+
+#define CAPTURE_MAGIC "SDCAPT"
+#define CAPTURE_VERSION 1
+#define CAPTURE_MAX_CHANNELS 4
+
+struct CaptureFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numChannels;
+    double sampleRate;
+};
+
+enum CaptureRecordType
+{
+    CaptureLayoutRecord = 1,
+    CaptureBlockRecord = 2,
+    CaptureSettingsRecord = 3
+};
+
+struct CaptureRecordHeader
+{
+    uint32_t type;
+    uint32_t size;      // bytes of payload that follow
+};
+
+/** The processor settings that change what is detected. */
+struct CaptureSettings
+{
+    int32_t simdLevel;              // SimdLevel of the kernels in use
+    uint8_t filterEnabled;
+    uint8_t pipelinedMode;
+    uint8_t healthCheckEnabled;
+    uint8_t warmStartEnabled;
+    double filterLowCut;            // Hz, as set; the filter lowers them below Nyquist
+    double filterHighCut;
+    double maxSpikeRate;            // spikes per second and electrode, 0 = no limit
+    double spikeBurst;
+    int32_t coincidenceElectrodes;  // 0 = off
+    uint32_t numNoiseEstimators;    // rows of warm-start levels that follow
+    double coincidenceWindowMs;
+    double timeBudgetMs;            // 0 = no budget
+};
+
+struct CaptureElectrode
+{
+    int32_t electrodeID;
+    int32_t numChannels;
+    int32_t prePeakSamples;
+    int32_t postPeakSamples;
+    int32_t noiseEstimator;     // NoiseEstimatorType
+    int32_t channels[CAPTURE_MAX_CHANNELS];
+    float thresholds[CAPTURE_MAX_CHANNELS];
+    uint8_t isActive[CAPTURE_MAX_CHANNELS];
+};
+
+struct CaptureBlockHeader
+{
+    int64_t blockIndex;         // callbacks since acquisition started
+    uint32_t numChannels;
+    uint32_t numSamples;        // length of the buffer
+};
+
+#endif  // __CAPTUREFORMAT_H_8E51D2A7__
@@ -0,0 +1,186 @@
+
+#include "DetectionThread.h"
+#include "SpikeDetectorDynamic.h"
+#include "AudioThreadGuard.h"
+
+// one slot is being detected while the next block is queued behind it, and
+// one more lets a late block finish without the audio thread waiting for it
+#define NUM_BLOCK_SLOTS 3
+
+// how often the idle thread looks for a new block
+#define POLL_INTERVAL_MS 1
+
+DetectionThread::DetectionThread(SpikeDetectorDynamic* p)
+    : Thread("Dynamic Detector"), processor(p), numInputs(0), maxBlockSize(0), nextSlot(0),
+      numInFlight(0), pendingBlocks(NUM_BLOCK_SLOTS + 1), finishedBlocks(NUM_BLOCK_SLOTS + 1),
+      numLateBlocks(0), numWaitingBlocks(0), numInlineBlocks(0)
+{
+    pendingIndices.malloc(NUM_BLOCK_SLOTS + 1);
+    finishedIndices.malloc(NUM_BLOCK_SLOTS + 1);
+}
+
+DetectionThread::~DetectionThread()
+{
+    stopDetection();
+}
+
+void DetectionThread::startDetection(int numChannels, int maxBlockSize_)
+{
+    stopDetection();
+
+    numInputs = numChannels;
+    maxBlockSize = maxBlockSize_;
+    slots.clear();
+
+    for (int i = 0; i < NUM_BLOCK_SLOTS; i++)
+    {
+        BlockSlot* slot = new BlockSlot();
+        slot->data.setSize(jmax(numChannels, 1), maxBlockSize);
+        slot->events.ensureSize(MAX_SPIKE_BUFFER_LEN * 32);
+        slot->timestamps.calloc(jmax(numChannels, 1));
+        slot->numSamples.calloc(jmax(numChannels, 1));
+        slots.add(slot);
+    }
+
+    nextSlot = 0;
+    numInFlight = 0;
+    numLateBlocks = 0;
+    numWaitingBlocks = 0;
+    numInlineBlocks = 0;
+    pendingBlocks.reset();
+    finishedBlocks.reset();
+
+    startThread(9);
+}
+
+void DetectionThread::stopDetection()
+{
+    stopThread(2000);
+    numInFlight = 0;
+}
+
+void DetectionThread::pushBlock(AudioSampleBuffer& buffer, MidiBuffer& eventBuffer,
+                                const int64* timestamps, const int* numSamples)
+{
+    int nSamples = buffer.getNumSamples();
+
+    // normally the previous block finished while the rest of the chain was
+    // running; if not, its events go out with a later block
+    if (numInFlight > 0 && collectBlocks(eventBuffer, nSamples) == 0)
+        numLateBlocks++;
+
+    // no slot holds this block without allocating; it is detected here once
+    // the blocks before it are done, so that the tails follow each other
+    if (nSamples > maxBlockSize)
+    {
+        waitForBlocks(eventBuffer, nSamples, 0);
+        processor->detectSpikes(buffer, eventBuffer, timestamps, numSamples);
+        numInlineBlocks++;
+        return;
+    }
+
+    if (numInFlight == NUM_BLOCK_SLOTS)
+    {
+        waitForBlocks(eventBuffer, nSamples, NUM_BLOCK_SLOTS - 1);
+        numWaitingBlocks++;
+    }
+
+    BlockSlot* slot = slots[nextSlot];
+
+    // the detector reads up to the end of the buffer, so the copy must have
+    // exactly this block's length; the slot was allocated for the longest
+    // block, so this only moves the channel pointers
+    slot->data.setSize(jmax(numInputs, 1), nSamples, false, false, true);
+
+    for (int chan = 0; chan < numInputs && chan < buffer.getNumChannels(); chan++)
+    {
+        slot->data.copyFrom(chan, 0, buffer, chan, 0, nSamples);
+        slot->timestamps[chan] = timestamps[chan];
+        slot->numSamples[chan] = numSamples[chan];
+    }
+
+    int start1, size1, start2, size2;
+    pendingBlocks.prepareToWrite(1, start1, size1, start2, size2);
+
+    if (size1 + size2 == 0)
+        return; // cannot happen, the queue holds every slot
+
+    pendingIndices[size1 > 0 ? start1 : start2] = nextSlot;
+    pendingBlocks.finishedWrite(1);
+
+    // no notify(): it would lock on the audio thread, the thread polls instead
+    nextSlot = (nextSlot + 1) % NUM_BLOCK_SLOTS;
+    numInFlight++;
+}
+
+void DetectionThread::waitForBlocks(MidiBuffer& eventBuffer, int numSamples, int maxInFlight)
+{
+    AUDIO_THREAD_BLOCKING_CALL("waiting for the detection thread")
+
+    // spins without a lock; the thread is only stopped after acquisition
+    while (numInFlight > maxInFlight && isThreadRunning())
+    {
+        if (collectBlocks(eventBuffer, numSamples) == 0)
+            Thread::yield();
+    }
+}
+
+int DetectionThread::collectBlocks(MidiBuffer& eventBuffer, int numSamples)
+{
+    int numCollected = 0;
+    int lastSample = jmax(numSamples - 1, 0);
+
+    while (finishedBlocks.getNumReady() > 0)
+    {
+        int start1, size1, start2, size2;
+        finishedBlocks.prepareToRead(1, start1, size1, start2, size2);
+        BlockSlot* slot = slots[finishedIndices[size1 > 0 ? start1 : start2]];
+
+        MidiBuffer::Iterator i(slot->events);
+        const uint8* data;
+        int numBytes;
+        int samplePosition;
+
+        // spike timestamps refer to the block they were detected in; only the
+        // position inside this buffer has to be clamped
+        while (i.getNextEvent(data, numBytes, samplePosition))
+            eventBuffer.addEvent(data, numBytes, jlimit(0, lastSample, samplePosition));
+
+        // the slot may only be reused once its events have been read
+        finishedBlocks.finishedRead(1);
+        numInFlight--;
+        numCollected++;
+    }
+
+    return numCollected;
+}
+
+void DetectionThread::run()
+{
+    while (! threadShouldExit())
+    {
+        // nothing signals the thread but stopThread(), which ends the wait early
+        if (pendingBlocks.getNumReady() == 0)
+        {
+            wait(POLL_INTERVAL_MS);
+            continue;
+        }
+
+        int start1, size1, start2, size2;
+        pendingBlocks.prepareToRead(1, start1, size1, start2, size2);
+        int index = pendingIndices[size1 > 0 ? start1 : start2];
+        pendingBlocks.finishedRead(1);
+
+        BlockSlot* slot = slots[index];
+
+        {
+            AUDIO_THREAD_SCOPE
+            slot->events.clear();
+            processor->detectSpikes(slot->data, slot->events, slot->timestamps, slot->numSamples);
+        }
+
+        finishedBlocks.prepareToWrite(1, start1, size1, start2, size2);
+        finishedIndices[size1 > 0 ? start1 : start2] = index;
+        finishedBlocks.finishedWrite(1);
+    }
+}
@@ -0,0 +1,97 @@
+
+#ifndef __DETECTIONTHREAD_H_6A1C2E4B__
+#define __DETECTIONTHREAD_H_6A1C2E4B__
+
+#include <ProcessorHeaders.h>
+
+#include <atomic>
+
+class SpikeDetectorDynamic;
+
+/**
+  Runs spike detection for the SpikeDetectorDynamic on a dedicated thread.
+
+  In pipelined mode, process() copies each incoming block into a preallocated
+  slot and hands it to this thread through a lock-free queue, then collects the
+  events that were detected in the previous block. Detection therefore runs in
+  parallel with the rest of the signal chain, at the cost of one block of added
+  latency. Timestamps are captured together with each block, so spike
+  timestamps are unaffected; only the position of the events inside the
+  MidiBuffer is shifted.
+
+  The audio thread takes no lock: the thread polls the queue instead of being
+  notified. A block that is not finished when the next one arrives is counted
+  as late and its events are emitted with a later block. Every block is
+  detected, in order, since the overflow tails and noise estimates carry over
+  from one block to the next: if every slot is still busy, the audio thread
+  waits for the oldest one, and a block longer than the slots allocated in
+  startDetection() is detected on the audio thread once the blocks before it
+  are done. All three cases are counted and shown in the editor.
+*/
+
+class DetectionThread : public Thread
+{
+public:
+    DetectionThread(SpikeDetectorDynamic* processor);
+    ~DetectionThread();
+
+    /** Allocates the block slots for blocks of up to maxBlockSize samples and
+        starts the thread. Called from enable(). */
+    void startDetection(int numChannels, int maxBlockSize);
+
+    /** Stops the thread. Events of the block still in flight are discarded. */
+    void stopDetection();
+
+    /** Called from process(): moves the events of the blocks finished so far
+        into eventBuffer and queues the current block for detection. */
+    void pushBlock(AudioSampleBuffer& buffer, MidiBuffer& eventBuffer,
+                   const int64* timestamps, const int* numSamples);
+
+    /** Blocks whose detection had not finished when the next one arrived. */
+    int getNumLateBlocks() const { return numLateBlocks; }
+
+    /** Blocks for which the audio thread waited for a free slot. */
+    int getNumWaitingBlocks() const { return numWaitingBlocks; }
+
+    /** Blocks longer than the slots, detected on the audio thread. */
+    int getNumInlineBlocks() const { return numInlineBlocks; }
+
+    void run();
+
+private:
+    struct BlockSlot
+    {
+        AudioSampleBuffer data;
+        MidiBuffer events;
+        HeapBlock<int64> timestamps;
+        HeapBlock<int> numSamples;
+    };
+
+    /** Emits the events of every finished block; returns how many there were. */
+    int collectBlocks(MidiBuffer& eventBuffer, int numSamples);
+
+    /** Collects finished blocks until at most maxInFlight are left. */
+    void waitForBlocks(MidiBuffer& eventBuffer, int numSamples, int maxInFlight);
+
+    SpikeDetectorDynamic* processor;
+
+    OwnedArray<BlockSlot> slots;
+    int numInputs;
+    int maxBlockSize;
+    int nextSlot;
+    int numInFlight;        // queued or being detected; only used by the audio thread
+
+    AbstractFifo pendingBlocks;
+    AbstractFifo finishedBlocks;
+    HeapBlock<int> pendingIndices;
+    HeapBlock<int> finishedIndices;
+
+    // written by the audio thread, read by the editor
+    std::atomic<int> numLateBlocks;
+    std::atomic<int> numWaitingBlocks;
+    std::atomic<int> numInlineBlocks;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DetectionThread);
+};
+
+#endif  // __DETECTIONTHREAD_H_6A1C2E4B__
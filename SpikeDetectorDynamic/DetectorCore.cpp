@@ -0,0 +1,499 @@
+
+#include "DetectorCore.h"
+
+#include <limits>
+
+DetectorCore::DetectorCore()
+    : numChannels(0), maxBlockSize(0), tailSize(100), windowSize(200),
+      tilesPerWindow((200 + SCAN_TILE_SIZE - 1) / SCAN_TILE_SIZE), blockData(nullptr),
+      blockNumSamples(nullptr), blockChannels(0), bufferLength(0), blockCounter(0),
+      noiseLevelsStride(0), noiseHoldBlocks(1), kernels(&getSimdKernels(SimdAuto)),
+      filter(nullptr)
+{
+    windowValues.assign(windowSize, 0.0f);
+}
+
+void DetectorCore::prepare(int numChannels_, int maxBlockSize_)
+{
+    int numWindows = getNumNoiseWindows(maxBlockSize_);
+
+    // only grows during acquisition if a block is longer than anticipated
+    if (numChannels_ <= numChannels && numWindows <= noiseLevelsStride)
+        return;
+
+    numChannels = std::max(numChannels_, numChannels);
+    maxBlockSize = std::max(maxBlockSize_, maxBlockSize);
+    noiseLevelsStride = std::max(numWindows, noiseLevelsStride);
+
+    int numSlots = NumNoiseEstimators * numChannels;
+
+    noiseLevels.assign(numSlots * noiseLevelsStride, 0.0f);
+    tileMaxima.assign(numSlots * noiseLevelsStride * tilesPerWindow, 0.0f);
+    noiseState.assign(numSlots, NoiseEstimatorState());
+    noiseLevelsBlock.assign(numSlots, -1);
+    noiseRefreshBlock.assign(numSlots, -1);
+    lastNoiseLevels.assign(numSlots, 0.0f);
+    filteredBlock.assign(numChannels, -1);
+
+    tails.assign(numChannels * tailSize, 0.0f);
+    filterState.assign(2 * numChannels, BiquadState());
+
+    resetNoiseLevels();
+    resetSignal();
+}
+
+void DetectorCore::setSampleRate(double sampleRate)
+{
+    madEstimator.setTimeConstant(sampleRate, 0.5);
+    rmsEstimator.setTimeConstant(sampleRate, 0.5);
+}
+
+void DetectorCore::setKernels(const SimdKernels& kernels_)
+{
+    kernels = &kernels_;
+}
+
+void DetectorCore::setFilter(const BandpassFilter* filter_)
+{
+    filter = filter_;
+}
+
+void DetectorCore::setNoiseHoldBlocks(int numBlocks)
+{
+    noiseHoldBlocks = std::max(numBlocks, 1);
+}
+
+void DetectorCore::resetNoiseLevels()
+{
+    for (size_t i = 0; i < noiseState.size(); i++)
+    {
+        noiseState[i].value = 0.0f;
+        noiseState[i].isWarm = false;
+        noiseRefreshBlock[i] = -1;
+        lastNoiseLevels[i] = 0.0f;
+    }
+}
+
+void DetectorCore::resetSignal()
+{
+    std::fill(tails.begin(), tails.end(), 0.0f);
+
+    for (size_t i = 0; i < filterState.size(); i++)
+    {
+        filterState[i].z1 = 0.0;
+        filterState[i].z2 = 0.0;
+    }
+}
+
+int DetectorCore::getNumNoiseWindows(int numSamples) const
+{
+    // the scan reads up to sample numSamples - tailSize / 2 + 1
+    int numValues = numSamples - tailSize / 2 + 1 - getNoiseWindowStart() + 1;
+    return std::max((numValues + windowSize - 1) / windowSize, 1);
+}
+
+int DetectorCore::getLastFullWindow(int chan) const
+{
+    int numValues = blockNumSamples[chan] - tailSize / 2 + 1 - getNoiseWindowStart() + 1;
+    return numValues / windowSize - 1;
+}
+
+void DetectorCore::beginBlock(float* const* data, const int* numSamples, int numChannels_, int bufferLength_)
+{
+    blockData = data;
+    blockNumSamples = numSamples;
+    blockChannels = std::min(numChannels_, numChannels);
+    bufferLength = bufferLength_;
+    blockCounter++;
+}
+
+const float* DetectorCore::getNoiseLevels(int chan, int estimatorType, bool reuseLevels)
+{
+    int slot = estimatorType * numChannels + chan;
+    float* levels = &noiseLevels[slot * noiseLevelsStride];
+    float* maxima = &tileMaxima[slot * noiseLevelsStride * tilesPerWindow];
+
+    if (noiseLevelsBlock[slot] == blockCounter)
+        return levels;
+
+    noiseLevelsBlock[slot] = blockCounter;
+
+    // the estimator keeps its state and the pass only filters the block and
+    // finds the tile maxima
+    if (reuseLevels && noiseRefreshBlock[slot] >= 0
+        && blockCounter - noiseRefreshBlock[slot] <= noiseHoldBlocks)
+    {
+        computeNoiseLevels(HeldNoiseEstimator(lastNoiseLevels[slot]), noiseState[slot], chan, levels, maxima);
+        return levels;
+    }
+
+    // dispatched once per channel and block; the per-sample loop is inlined
+    // for each estimator
+    switch (estimatorType)
+    {
+        case RunningMadNoise:
+            computeNoiseLevels(madEstimator, noiseState[slot], chan, levels, maxima);
+            break;
+        case RmsNoise:
+            computeNoiseLevels(rmsEstimator, noiseState[slot], chan, levels, maxima);
+            break;
+        default:
+            computeNoiseLevels(medianEstimator, noiseState[slot], chan, levels, maxima);
+            break;
+    }
+
+    // a block too short for a full window only sets the level if there is none yet
+    int lastFullWindow = getLastFullWindow(chan);
+
+    if (lastFullWindow >= 0 || noiseRefreshBlock[slot] < 0)
+        lastNoiseLevels[slot] = levels[std::max(lastFullWindow, 0)];
+
+    noiseRefreshBlock[slot] = blockCounter;
+    return levels;
+}
+
+const float* DetectorCore::getTileMaxima(int chan, int estimatorType) const
+{
+    return &tileMaxima[(estimatorType * numChannels + chan) * noiseLevelsStride * tilesPerWindow];
+}
+
+float DetectorCore::getLastNoiseLevel(int chan, int estimatorType) const
+{
+    int slot = estimatorType * numChannels + chan;
+
+    if (chan < 0 || chan >= numChannels || noiseRefreshBlock[slot] < 0)
+        return 0.0f;
+
+    return lastNoiseLevels[slot];
+}
+
+bool DetectorCore::warmStart(int chan, int estimatorType, float noiseLevel)
+{
+    if (chan < 0 || chan >= numChannels || ! (noiseLevel > 0))
+        return false;
+
+    NoiseEstimatorState& state = noiseState[estimatorType * numChannels + chan];
+
+    switch (estimatorType)
+    {
+        case RunningMadNoise:
+            madEstimator.warmStart(state, noiseLevel);
+            break;
+        case RmsNoise:
+            rmsEstimator.warmStart(state, noiseLevel);
+            break;
+        default:
+            medianEstimator.warmStart(state, noiseLevel);
+            break;
+    }
+
+    return state.isWarm;
+}
+
+template <class Estimator>
+void DetectorCore::computeNoiseLevels(const Estimator& estimator,
+                                      NoiseEstimatorState& state,
+                                      int chan,
+                                      float* levels,
+                                      float* maxima)
+{
+    const float* overflow = &tails[chan * tailSize];
+    float* data = blockData[chan];
+    int dataLength = std::min(bufferLength, blockNumSamples[chan]);
+
+    int firstSample = getNoiseWindowStart();
+    int lastSample = blockNumSamples[chan] - tailSize / 2 + 1;
+
+    // with the filter, the block is band-passed in place in the same pass, so
+    // each sample is only loaded once; the tail already holds the filtered
+    // end of the previous block
+    bool filterData = filter != nullptr && filteredBlock[chan] != blockCounter;
+    int lastIndex = filterData ? std::max(lastSample, dataLength - 1) : lastSample;
+    BiquadState* channelFilter = &filterState[2 * chan];
+
+    float* temp_values = &windowValues[0];
+    int window_number = 0;
+    int sample_counter = 0;
+    float tile_max = 0;
+
+    // without the filter, |x| of a whole window is computed with the vector
+    // kernel and handed to the estimator at once
+    if (! filterData)
+    {
+        for (int windowStart = firstSample; windowStart <= lastSample; windowStart += windowSize)
+        {
+            int count = std::min(windowSize, lastSample - windowStart + 1);
+            int index = windowStart;
+            int end = windowStart + count;
+
+            for (; index < std::min(end, 0); index++)
+                temp_values[index - windowStart] = std::abs(overflow[tailSize + index]);
+
+            int numInBlock = std::min(end, dataLength) - index;
+
+            if (numInBlock > 0)
+            {
+                kernels->absCopy(temp_values + index - windowStart, data + index, numInBlock);
+                index += numInBlock;
+            }
+
+            // past the valid samples the scan reads the buffer, not these
+            // zeros, so tiles holding them must not be skipped on their maximum
+            int numValid = index - windowStart;
+
+            for (; index < end; index++)
+                temp_values[index - windowStart] = 0;
+
+            // before endWindow(), which may reorder the values
+            float* windowMaxima = maxima + window_number * tilesPerWindow;
+
+            for (int tileStart = 0; tileStart < count; tileStart += SCAN_TILE_SIZE)
+            {
+                int tileLength = std::min(SCAN_TILE_SIZE, count - tileStart);
+
+                windowMaxima[tileStart / SCAN_TILE_SIZE] = tileStart + tileLength <= numValid
+                    ? kernels->maxValue(temp_values + tileStart, tileLength)
+                    : std::numeric_limits<float>::infinity();
+            }
+
+            estimator.addWindow(state, temp_values, count);
+            levels[window_number++] = estimator.endWindow(state, temp_values, count);
+        }
+
+        return;
+    }
+
+    for (int index = firstSample; index <= lastIndex; index++)
+    {
+        float sample;
+
+        if (index < 0)
+        {
+            sample = overflow[tailSize + index];
+        }
+        else if (index < dataLength)
+        {
+            sample = filter->processSample(data[index], channelFilter);
+            data[index] = sample;
+        }
+        else
+        {
+            sample = 0;
+            tile_max = std::numeric_limits<float>::infinity();
+        }
+
+        if (index > lastSample)
+            continue; // only filtered
+
+        float absValue = std::abs(sample);
+        estimator.addSample(state, temp_values, sample_counter++, absValue);
+        tile_max = std::max(tile_max, absValue);
+
+        bool isWindowEnd = sample_counter == windowSize || index == lastSample;
+
+        if (sample_counter % SCAN_TILE_SIZE == 0 || isWindowEnd)
+        {
+            maxima[window_number * tilesPerWindow + (sample_counter - 1) / SCAN_TILE_SIZE] = tile_max;
+            tile_max = 0;
+        }
+
+        if (isWindowEnd)
+        {
+            levels[window_number++] = estimator.endWindow(state, temp_values, sample_counter);
+            sample_counter = 0;
+        }
+    }
+
+    filteredBlock[chan] = blockCounter;
+}
+
+void DetectorCore::filterChannel(int chan)
+{
+    if (filter == nullptr || filteredBlock[chan] == blockCounter)
+        return;
+
+    // the samples the noise pass would have filtered
+    float* data = blockData[chan];
+    int dataLength = std::min(bufferLength, blockNumSamples[chan]);
+    BiquadState* state = &filterState[2 * chan];
+
+    for (int n = 0; n < dataLength; n++)
+        data[n] = filter->processSample(data[n], state);
+
+    filteredBlock[chan] = blockCounter;
+}
+
+int DetectorCore::scanElectrode(const ElectrodeScan& electrode, int lastBufferIndex, Listener& listener)
+{
+    int nSamples = blockNumSamples[electrode.channels[0]];
+    int scanEnd = nSamples - tailSize / 2;   // last sample a crossing may be found after
+    int noiseWindowStart = getNoiseWindowStart();
+    int numScanned = 0;
+
+    // tiles up to here only hold valid samples
+    int covered_end[DETECTOR_CORE_MAX_CHANNELS];
+
+    for (int chan = 0; chan < electrode.numChannels; chan++)
+    {
+        covered_end[chan] = blockNumSamples[electrode.channels[chan]] - tailSize / 2 + 2;
+
+        if (electrode.noiseLevels[chan] != nullptr)
+            numScanned++;
+    }
+
+    int sampleIndex = lastBufferIndex - 1; // incremented before each sample is read
+
+    // nothing to scan: resume where the scan would have stopped
+    if (numScanned == 0)
+        sampleIndex = std::max(sampleIndex, scanEnd + 1);
+
+    while (sampleIndex <= scanEnd)
+    {
+        // within the block, jump to the first sample of the current noise
+        // window that crosses a threshold on any channel; the loop below then
+        // handles it exactly as if every sample had been tested
+        if (sampleIndex >= -1)
+        {
+            int firstIndex = sampleIndex + 1;
+            int window = (firstIndex - noiseWindowStart) / windowSize;
+            int windowStart = noiseWindowStart + window * windowSize;
+            int windowEnd = windowStart + windowSize;
+            int endIndex = std::min(std::min(windowEnd, scanEnd + 1), bufferLength);
+            int crossing = endIndex;
+
+            for (int chan = 0; chan < electrode.numChannels && crossing > firstIndex; chan++)
+            {
+                if (electrode.noiseLevels[chan] == nullptr)
+                    continue;
+
+                int channelWindow = std::min(std::max(window, 0), electrode.lastWindow[chan]);
+                float dyn_threshold = electrode.thresholds[chan] * electrode.noiseLevels[chan][channelWindow];
+                const float* data = blockData[electrode.channels[chan]];
+
+                if (! (dyn_threshold >= 0))
+                {
+                    crossing = firstIndex; // not comparable, test each sample
+                }
+                else if (electrode.tileMaxima[chan] == nullptr || window > electrode.lastWindow[chan])
+                {
+                    crossing = firstIndex + kernels->findFirstAbove(data + firstIndex, crossing - firstIndex, dyn_threshold);
+                }
+                else
+                {
+                    // coarse pass: only the tiles whose largest |x| (from the
+                    // noise pass) exceeds the threshold are read
+                    const float* maxima = electrode.tileMaxima[chan] + window * tilesPerWindow;
+
+                    for (int tile = (firstIndex - windowStart) / SCAN_TILE_SIZE; ; tile++)
+                    {
+                        int tileStart = std::max(firstIndex, windowStart + tile * SCAN_TILE_SIZE);
+                        int tileEnd = std::min(windowStart + (tile + 1) * SCAN_TILE_SIZE, crossing);
+
+                        if (tileStart >= tileEnd)
+                            break;
+
+                        if (tileEnd <= covered_end[chan] && maxima[tile] <= dyn_threshold)
+                            continue;
+
+                        int index = tileStart + kernels->findFirstAbove(data + tileStart, tileEnd - tileStart, dyn_threshold);
+
+                        if (index < tileEnd)
+                        {
+                            crossing = index;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if (crossing == endIndex && endIndex > firstIndex)
+            {
+                sampleIndex = endIndex - 1; // nothing in this window
+                continue;
+            }
+
+            sampleIndex = std::max(sampleIndex, crossing - 1);
+        }
+
+        sampleIndex++;
+        int window_number = (sampleIndex - noiseWindowStart) / windowSize;
+
+        for (int chan = 0; chan < electrode.numChannels; chan++)
+        {
+            if (electrode.noiseLevels[chan] == nullptr)
+                continue;
+
+            int currentChannel = electrode.channels[chan];
+
+            float dyn_threshold = electrode.thresholds[chan] *
+                electrode.noiseLevels[chan][std::min(std::max(window_number, 0), electrode.lastWindow[chan])];
+
+            float sample_amp = std::abs(getSample(currentChannel, sampleIndex));
+
+            if (! (sample_amp > dyn_threshold))
+                continue;
+
+            int crossingIndex = sampleIndex;
+
+            // find the peak; |x| of each sample is computed once, previous_amp
+            // is the one before sampleIndex
+            float previous_amp = sample_amp;
+            float next_amp;
+            sampleIndex++;
+
+            while (previous_amp < (next_amp = std::abs(getSample(currentChannel, sampleIndex))))
+            {
+                previous_amp = next_amp;
+                sampleIndex++;
+            }
+
+            int peakIndex = sampleIndex - 1;
+            float peak_amp = previous_amp;
+
+            // the dead time restarts whenever a larger sample follows within
+            // one waveform length
+            int num_samples = electrode.prePeakSamples + electrode.postPeakSamples;
+            int current_test_sample = 1;
+
+            while (current_test_sample < num_samples)
+            {
+                next_amp = std::abs(getSample(currentChannel, sampleIndex));
+
+                if (peak_amp > next_amp)
+                {
+                    current_test_sample++;
+                    sampleIndex++;
+                }
+                else
+                {
+                    peakIndex = sampleIndex;
+                    peak_amp = previous_amp;
+                    sampleIndex++;
+                    current_test_sample = 1;
+                }
+
+                previous_amp = next_amp;
+            }
+
+            listener.peakFound(chan, crossingIndex, peakIndex, dyn_threshold);
+
+            sampleIndex = peakIndex + electrode.postPeakSamples;
+            break;
+        }
+    }
+
+    return sampleIndex - nSamples;
+}
+
+void DetectorCore::endBlock()
+{
+    // every electrode has now read the previous tails, so they can be
+    // refreshed once per input channel
+    for (int chan = 0; chan < blockChannels; chan++)
+    {
+        int nSamples = blockNumSamples[chan];
+
+        if (nSamples > tailSize && nSamples <= bufferLength)
+            std::copy(blockData[chan] + nSamples - tailSize, blockData[chan] + nSamples, &tails[chan * tailSize]);
+    }
+}
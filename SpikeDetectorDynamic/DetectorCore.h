@@ -0,0 +1,217 @@
+#ifndef __DETECTORCORE_H_4C8A1E7B__
+#define __DETECTORCORE_H_4C8A1E7B__
+
+#include "NoiseEstimators.h"
+#include "BandpassFilter.h"
+#include "SimdKernels.h"
+
+#include <cstdint>
+#include <vector>
+
+#define DETECTOR_CORE_MAX_CHANNELS 4
+#define DETECTOR_CORE_MAX_SAMPLES 80
+
+// samples per tile of the coarse pass of the scan: each noise window is split
+// into tiles of this length (the last one shorter), whose largest |x| is
+// compared with the threshold before any sample is tested
+#define SCAN_TILE_SIZE 32
+
+/** What the scan needs to know about one electrode in the current block. */
+struct ElectrodeScan
+{
+    int numChannels;
+    int channels[DETECTOR_CORE_MAX_CHANNELS];       // input channels
+    float thresholds[DETECTOR_CORE_MAX_CHANNELS];   // in multiples of the noise level
+
+    /** Noise level of each window (see DetectorCore::getNoiseLevels()), or
+        nullptr for channels that are not scanned in this block. */
+    const float* noiseLevels[DETECTOR_CORE_MAX_CHANNELS];
+
+    /** Tile maxima matching noiseLevels, or nullptr to test every sample. */
+    const float* tileMaxima[DETECTOR_CORE_MAX_CHANNELS];
+
+    /** Last window of noiseLevels; later samples use its level. */
+    int lastWindow[DETECTOR_CORE_MAX_CHANNELS];
+
+    int prePeakSamples;
+    int postPeakSamples;
+};
+
+/**
+  The detection of SpikeDetectorDynamic without the Open Ephys host: noise
+  levels per window of 200 samples with the estimators of NoiseEstimators.h,
+  the optional fused band-pass, the threshold-crossing scan with its tile
+  skipping, the peak search with its dead time, and the 100-sample overflow
+  tail that lets peaks straddle block boundaries.
+
+  The plugin and the C API (capi/spikedetector.h) both run their blocks
+  through this class; rate limiting, coincidence rejection, health checks,
+  waveform packing and sorting are left to the caller, which receives every
+  peak through a Listener.
+
+  A block is handed over as one float pointer per input channel, in
+  microvolts, and is filtered in place if a filter is set. prepare() does all
+  the allocation, so the per-block methods do not allocate or block.
+*/
+
+class DetectorCore
+{
+public:
+    /** Receives the peaks found by scanElectrode(). */
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+
+        /** chan is the index of the electrode channel that crossed threshold
+            (in microvolts) at crossingIndex; the peak of the waveform is at
+            peakIndex. Both are negative inside the overflow tail. */
+        virtual void peakFound(int chan, int crossingIndex, int peakIndex, float threshold) = 0;
+    };
+
+    DetectorCore();
+
+    /** Sizes the tables for numChannels inputs and blocks of up to
+        maxBlockSize samples. Nothing changes if they are large enough already;
+        otherwise the estimators, tails and filters start again. */
+    void prepare(int numChannels, int maxBlockSize);
+
+    /** Time constants of the running estimators. */
+    void setSampleRate(double sampleRate);
+
+    void setKernels(const SimdKernels& kernels);
+
+    /** Band-passes each block in place with this filter (nullptr for none),
+        in the same pass that computes the noise levels. The state of each
+        channel is kept by the core. */
+    void setFilter(const BandpassFilter* filter);
+
+    /** Number of blocks a noise level may be reused for (see getNoiseLevels()). */
+    void setNoiseHoldBlocks(int numBlocks);
+
+    /** The estimators start again from the first window they see. */
+    void resetNoiseLevels();
+
+    /** Clears the overflow tails and the filter states. */
+    void resetSignal();
+
+    /** Starts a block. data[chan] holds numSamples[chan] valid samples of the
+        numChannels inputs, out of bufferLength readable ones. The samples are
+        only written to by the filter, so without one the block may be the
+        caller's own buffer. */
+    void beginBlock(float* const* data, const int* numSamples, int numChannels, int bufferLength);
+
+    /** Returns the noise level of each window of an input channel for the
+        current block, computing it the first time an electrode using this
+        estimator asks for it. With reuseLevels, a level measured in the last
+        noise-hold blocks is reused for every window instead. */
+    const float* getNoiseLevels(int chan, int estimatorType, bool reuseLevels = false);
+
+    /** The largest |x| of each tile of an input channel, tilesPerWindow per
+        noise window, filled with the noise levels by getNoiseLevels(). Infinite
+        for tiles that run past the valid samples of the channel. */
+    const float* getTileMaxima(int chan, int estimatorType) const;
+
+    /** Index of the last noise window of an input channel in this block. */
+    int getLastWindow(int chan) const { return getNumNoiseWindows(blockNumSamples[chan]) - 1; }
+
+    /** Index of the last window of an input channel that holds a whole
+        windowSize of samples in this block, or -1 for blocks too short to
+        fill one. The last window usually ends mid-block and may hold only a
+        few samples, so levels that outlive the block are taken from here. */
+    int getLastFullWindow(int chan) const;
+
+    /** Band-passes the block of an input channel, unless the noise pass or an
+        earlier call already did in this block. */
+    void filterChannel(int chan);
+
+    /** Scans one electrode from the index where its previous scan stopped and
+        returns the index to resume from in the next block (negative). */
+    int scanElectrode(const ElectrodeScan& electrode, int lastBufferIndex, Listener& listener);
+
+    /** Sample of an input channel in the current block, reading the overflow
+        tail for negative indices; 0 outside of both. */
+    float getSample(int chan, int index) const
+    {
+        if (index < 0)
+        {
+            int ind = tailSize + index;
+            return ind >= 0 ? tails[chan * tailSize + ind] : 0.0f;
+        }
+
+        return index < bufferLength ? blockData[chan][index] : 0.0f;
+    }
+
+    /** Refreshes the overflow tails from the block; call once every peak of
+        the block has been read. */
+    void endBlock();
+
+    /** The level of the last full window measured by an estimator on an
+        input channel, or 0 if it has not run since resetNoiseLevels(). */
+    float getLastNoiseLevel(int chan, int estimatorType) const;
+
+    /** Seeds an estimator with a level of an earlier session; returns whether
+        it will continue from it. */
+    bool warmStart(int chan, int estimatorType, float noiseLevel);
+
+    int getNumChannels() const { return numChannels; }
+    int getTailSize() const { return tailSize; }
+    int getWindowSize() const { return windowSize; }
+
+    /** First sample of the first noise window (inside the overflow tail). */
+    int getNoiseWindowStart() const { return -(tailSize / 2); }
+
+    int getNumNoiseWindows(int numSamples) const;
+
+private:
+    template <class Estimator>
+    void computeNoiseLevels(const Estimator& estimator, NoiseEstimatorState& state,
+                            int chan, float* levels, float* maxima);
+
+    int numChannels;
+    int maxBlockSize;
+    int tailSize;
+    int windowSize;
+    int tilesPerWindow;
+
+    // the current block
+    float* const* blockData;
+    const int* blockNumSamples;
+    int blockChannels;
+    int bufferLength;
+    int64_t blockCounter;
+
+    std::vector<float> tails;
+
+    /** Noise level of each window, per estimator and input channel
+        (index estimatorType * numChannels + chan). */
+    std::vector<float> noiseLevels;
+    std::vector<float> tileMaxima;
+    std::vector<NoiseEstimatorState> noiseState;
+    int noiseLevelsStride;
+
+    /** Block in which the noise levels (per estimator and input channel) and
+        the filtered data (per input channel) were last updated. */
+    std::vector<int64_t> noiseLevelsBlock;
+    std::vector<int64_t> filteredBlock;
+
+    /** Time of the last estimator pass and its level, for the blocks that
+        reuse them. */
+    std::vector<int64_t> noiseRefreshBlock;
+    std::vector<float> lastNoiseLevels;
+    int noiseHoldBlocks;
+
+    /** Scratch space for |x| of one window. */
+    std::vector<float> windowValues;
+
+    MedianNoiseEstimator medianEstimator;
+    RunningMadNoiseEstimator madEstimator;
+    RmsNoiseEstimator rmsEstimator;
+
+    const SimdKernels* kernels;
+
+    const BandpassFilter* filter;
+    std::vector<BiquadState> filterState;
+};
+
+#endif  // __DETECTORCORE_H_4C8A1E7B__
@@ -0,0 +1,183 @@
+
+#include "FeatureExtractor.h"
+#include "SimdKernels.h"
+
+#define FEATURE_FILE_MAGIC "SDPC"
+#define FEATURE_FILE_VERSION 1
+
+FeatureExtractor::FeatureExtractor()
+{
+    spikeValues.calloc(paddedLength(MAX_NUMBER_OF_SPIKE_CHANNELS * MAX_NUMBER_OF_SPIKE_CHANNEL_SAMPLES));
+}
+
+void FeatureExtractor::clearBases()
+{
+    bases.clear();
+}
+
+bool FeatureExtractor::loadBases(const File& file)
+{
+    bases.clear();
+
+    FileInputStream stream(file);
+
+    if (! stream.openedOk())
+        return false;
+
+    char magic[4];
+
+    if (stream.read(magic, 4) != 4 || memcmp(magic, FEATURE_FILE_MAGIC, 4) != 0
+        || stream.readInt() != FEATURE_FILE_VERSION)
+        return false;
+
+    int numElectrodes = stream.readInt();
+
+    for (int e = 0; e < numElectrodes && ! stream.isExhausted(); e++)
+    {
+        ScopedPointer<FeatureBasis> basis = new FeatureBasis();
+        basis->electrodeID = stream.readInt();
+        basis->numComponents = stream.readInt();
+        basis->nChannels = stream.readInt();
+        basis->nSamples = stream.readInt();
+
+        if (basis->numComponents < 0 || basis->numComponents > SPIKE_FEATURE_COMPONENTS
+            || basis->nChannels < 1 || basis->nChannels > MAX_NUMBER_OF_SPIKE_CHANNELS
+            || basis->nSamples < 1 || basis->nSamples > MAX_NUMBER_OF_SPIKE_CHANNEL_SAMPLES)
+        {
+            bases.clear();
+            return false;
+        }
+
+        int numValues = basis->nChannels * basis->nSamples;
+        basis->length = paddedLength(numValues);
+        basis->mean.calloc(basis->length);
+        basis->components.calloc(jmax(basis->numComponents, 1) * basis->length);
+
+        for (int i = 0; i < numValues; i++)
+            basis->mean[i] = stream.readFloat();
+
+        for (int n = 0; n < basis->numComponents; n++)
+        {
+            for (int i = 0; i < numValues; i++)
+                basis->components[n * basis->length + i] = stream.readFloat();
+        }
+
+        // (x - mean).c = x.c - mean.c, so mean.c is computed once here
+        for (int n = 0; n < SPIKE_FEATURE_COMPONENTS; n++)
+        {
+            basis->meanProjections[n] = n < basis->numComponents
+                ? dotProduct(basis->mean, basis->components + n * basis->length, basis->length)
+                : 0.0f;
+        }
+
+        int index = 0;
+
+        while (index < bases.size() && bases[index]->electrodeID < basis->electrodeID)
+            index++;
+
+        bases.insert(index, basis.release());
+    }
+
+    return bases.size() > 0;
+}
+
+const FeatureBasis* FeatureExtractor::getBasis(int electrodeID) const
+{
+    int first = 0;
+    int last = bases.size();
+
+    while (first < last)
+    {
+        int middle = (first + last) / 2;
+
+        if (bases[middle]->electrodeID < electrodeID)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+
+    if (first < bases.size() && bases[first]->electrodeID == electrodeID)
+        return bases[first];
+
+    return nullptr;
+}
+
+void FeatureExtractor::computeFeatures(SpikeObject* s, int peakSample, float* features)
+{
+    int nChannels = s->nChannels;
+    int nSamples = s->nSamples;
+    int numValues = nChannels * nSamples;
+    float* x = spikeValues;
+
+    for (int i = 0; i < numValues; i++)
+        x[i] = float(int(s->data[i]) - 32768);
+
+    for (int i = 0; i < SPIKE_FEATURE_COUNT; i++)
+        features[i] = 0;
+
+    const FeatureBasis* basis = getBasis(s->electrodeID);
+
+    if (basis != nullptr && basis->nChannels == nChannels && basis->nSamples == nSamples)
+    {
+        for (int i = numValues; i < basis->length; i++)
+            x[i] = 0;
+
+        for (int n = 0; n < basis->numComponents; n++)
+        {
+            const float* component = basis->components + n * basis->length;
+            features[n] = dotProduct(x, component, basis->length) - basis->meanProjections[n];
+        }
+    }
+
+    // the detector triggers on |x|, so the peak may have either sign
+    int peak = jlimit(0, jmax(nSamples - 1, 0), peakSample);
+
+    for (int chan = 0; chan < nChannels; chan++)
+    {
+        const float* waveform = x + chan * nSamples;
+        float direction = waveform[peak] < 0 ? 1.0f : -1.0f;   // the trough goes the other way
+        int trough = peak;
+
+        for (int i = peak + 1; i < nSamples; i++)
+        {
+            if (direction * waveform[i] > direction * waveform[trough])
+                trough = i;
+        }
+
+        features[SPIKE_FEATURE_COMPONENTS + chan] = waveform[peak];
+        features[SPIKE_FEATURE_COMPONENTS + MAX_NUMBER_OF_SPIKE_CHANNELS + chan] = waveform[trough];
+        features[SPIKE_FEATURE_COMPONENTS + 2 * MAX_NUMBER_OF_SPIKE_CHANNELS + chan] = float(trough - peak);
+    }
+
+    s->pcProj[0] = features[0];
+    s->pcProj[1] = features[1];
+}
+
+int FeatureExtractor::appendFeatures(const float* features, uint8* event, int numBytes, int bufferSize)
+{
+    if (numBytes + SPIKE_FEATURE_TRAILER_SIZE > bufferSize)
+        return numBytes;
+
+    uint8* p = event + numBytes;
+    memcpy(p, features, SPIKE_FEATURE_COUNT * sizeof(float));
+    p += SPIKE_FEATURE_COUNT * sizeof(float);
+    *p++ = uint8(SPIKE_FEATURE_COUNT);
+    *p++ = 'F';
+    *p++ = 'T';
+
+    return numBytes + SPIKE_FEATURE_TRAILER_SIZE;
+}
+
+bool FeatureExtractor::getSpikeFeatures(const uint8* event, int numBytes, float* features)
+{
+    if (numBytes < SPIKE_FEATURE_TRAILER_SIZE)
+        return false;
+
+    const uint8* end = event + numBytes;
+
+    if (end[-2] != 'F' || end[-1] != 'T' || end[-3] != SPIKE_FEATURE_COUNT)
+        return false;
+
+    memcpy(features, end - SPIKE_FEATURE_TRAILER_SIZE, SPIKE_FEATURE_COUNT * sizeof(float));
+    return true;
+}
@@ -0,0 +1,85 @@
+
+#ifndef __FEATUREEXTRACTOR_H_0B7C5E19__
+#define __FEATUREEXTRACTOR_H_0B7C5E19__
+
+#include <ProcessorHeaders.h>
+#include <SpikeLib.h>
+
+#define SPIKE_FEATURE_COMPONENTS 8
+
+/** Projections, then per channel: peak (the sample at the detected peak,
+    with its sign), trough (the extreme of opposite sign after the peak) and
+    width (samples from peak to trough). */
+#define SPIKE_FEATURE_COUNT (SPIKE_FEATURE_COMPONENTS + 3 * MAX_NUMBER_OF_SPIKE_CHANNELS)
+
+/** Features floats, the number of features (uint8) and "FT". */
+#define SPIKE_FEATURE_TRAILER_SIZE (SPIKE_FEATURE_COUNT * 4 + 3)
+
+/** PCA basis of one electrode. */
+struct FeatureBasis
+{
+    int electrodeID;
+    int nChannels;
+    int nSamples;
+    int length;         // nChannels * nSamples, rounded up to a multiple of 4
+    int numComponents;
+
+    HeapBlock<float> mean;
+    HeapBlock<float> components;    // numComponents rows of length floats
+
+    /** mean.component of each component, subtracted from the projections. */
+    float meanProjections[SPIKE_FEATURE_COMPONENTS];
+};
+
+/**
+  Computes a fixed-size feature vector per spike, so that clustering tools
+  downstream do not need to project every waveform themselves.
+
+  The features are the projections of the mean-subtracted waveform onto the
+  PCA basis of its electrode (zero if no basis was loaded) followed by the peak
+  and trough amplitudes and the peak-to-trough width of each channel. The peak
+  is taken at the sample the detector found, which may be negative or
+  positive, and the trough is the largest excursion the other way after it.
+  All amplitudes are in the units of SpikeObject::data minus 32768.
+
+  The first two projections also go into SpikeObject::pcProj; the whole vector
+  is appended to the spike event as a trailer that can be found from the end
+  of the event (see getSpikeFeatures), so consumers can skip the waveform.
+*/
+
+class FeatureExtractor
+{
+public:
+    FeatureExtractor();
+
+    /** Reads a basis file: "SDPC", version (int32), number of electrodes (int32),
+        then per electrode: electrode ID, number of components (up to
+        SPIKE_FEATURE_COMPONENTS), number of channels, samples per channel
+        (int32 each), the mean waveform and the components (nChannels x nSamples
+        float32 each). All little-endian. Not real-time safe. */
+    bool loadBases(const File& file);
+
+    void clearBases();
+
+    /** Fills features (SPIKE_FEATURE_COUNT floats) and the spike's pcProj.
+        peakSample is the position of the detected peak in each channel's
+        waveform. */
+    void computeFeatures(SpikeObject* s, int peakSample, float* features);
+
+    /** Appends the feature trailer to an event of numBytes; returns the new
+        size, or numBytes if it does not fit. */
+    static int appendFeatures(const float* features, uint8* event, int numBytes, int bufferSize);
+
+    /** Reads the feature trailer of a spike event; returns false if there is none. */
+    static bool getSpikeFeatures(const uint8* event, int numBytes, float* features);
+
+private:
+    const FeatureBasis* getBasis(int electrodeID) const;
+
+    OwnedArray<FeatureBasis> bases;     // sorted by electrode ID
+    HeapBlock<float> spikeValues;
+
+    JUCE_DECLARE_NON_COPYABLE(FeatureExtractor);
+};
+
+#endif  // __FEATUREEXTRACTOR_H_0B7C5E19__
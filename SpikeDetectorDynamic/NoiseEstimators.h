@@ -0,0 +1,256 @@
+
+#ifndef __NOISEESTIMATORS_H_6B1C4E2A__
+#define __NOISEESTIMATORS_H_6B1C4E2A__
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+/**
+  Noise estimators used for the dynamic thresholds.
+
+  Each estimator is a policy class with the same four inline methods, so the
+  loop over the samples is instantiated once per estimator and there is no
+  virtual call per sample:
+
+      void addSample(NoiseEstimatorState& state, float* windowValues, int count, float absValue) const;
+      void addWindow(NoiseEstimatorState& state, float* windowValues, int count) const;
+      float endWindow(NoiseEstimatorState& state, float* windowValues, int count) const;
+      void warmStart(NoiseEstimatorState& state, float noiseLevel) const;
+
+  addSample() receives |x| and its position in the current window, and
+  endWindow() returns the noise level (standard deviation) of the window.
+  windowValues is scratch space of one window. addWindow() is the same as
+  calling addSample() for each of the first count values of windowValues,
+  for callers that fill a whole window at once. warmStart() seeds the state
+  with a noise level saved by an earlier session, before the first window.
+*/
+
+enum NoiseEstimatorType
+{
+    MedianNoise = 0,
+    RunningMadNoise,
+    RmsNoise,
+    NumNoiseEstimators
+};
+
+/** Running state of an estimator, kept per input channel across blocks. */
+struct NoiseEstimatorState
+{
+    float value;
+    bool isWarm;
+};
+
+/** Ratio of the median of |x| to the standard deviation of Gaussian noise. */
+const float madScale = 0.6745f;
+
+inline float getMedian(float* values, int numValues)
+{
+    std::nth_element(values, values + numValues / 2, values + numValues);
+    return values[numValues / 2];
+}
+
+inline const char* getNoiseEstimatorName(int type)
+{
+    switch (type)
+    {
+        case RunningMadNoise: return "runningMad";
+        case RmsNoise:        return "rms";
+        default:              return "median";
+    }
+}
+
+/** Returns the estimator with the given name, or the exact median if unknown. */
+inline int getNoiseEstimatorType(const char* name)
+{
+    for (int type = 0; type < NumNoiseEstimators; type++)
+    {
+        if (strcmp(name, getNoiseEstimatorName(type)) == 0)
+            return type;
+    }
+
+    return MedianNoise;
+}
+
+/**
+  Exact median of |x| / 0.6745 over each window (Quiroga et al., 2004).
+*/
+class MedianNoiseEstimator
+{
+public:
+    inline void addSample(NoiseEstimatorState&, float* windowValues, int count, float absValue) const
+    {
+        windowValues[count] = absValue;
+    }
+
+    inline void addWindow(NoiseEstimatorState&, float*, int) const {}
+
+    inline float endWindow(NoiseEstimatorState&, float* windowValues, int count) const
+    {
+        return getMedian(windowValues, count) / madScale;
+    }
+
+    /** Nothing is carried from one window to the next. */
+    inline void warmStart(NoiseEstimatorState&, float) const {}
+};
+
+/**
+  Running estimate of the median of |x|, updated with a multiplicative step per
+  sample: the estimate settles where half of the samples lie above it. Costs a
+  compare and a multiply per sample instead of a selection per window, but
+  follows changes of the noise level more slowly than the exact median.
+
+  The first window of each channel is bootstrapped with its exact median.
+*/
+class RunningMadNoiseEstimator
+{
+public:
+    RunningMadNoiseEstimator() : step(0.0001f) {}
+
+    /** The estimate moves by a factor e in about timeConstant seconds. */
+    void setTimeConstant(double sampleRate, double timeConstant)
+    {
+        step = float(1.0 / std::max(1.0, sampleRate * timeConstant));
+    }
+
+    inline void addSample(NoiseEstimatorState& state, float* windowValues, int count, float absValue) const
+    {
+        if (! state.isWarm)
+            windowValues[count] = absValue;
+        else
+            state.value *= absValue > state.value ? 1.0f + step : 1.0f - step;
+    }
+
+    inline void addWindow(NoiseEstimatorState& state, float* windowValues, int count) const
+    {
+        if (! state.isWarm)
+            return; // the values are already in place for the median
+
+        for (int i = 0; i < count; i++)
+            state.value *= windowValues[i] > state.value ? 1.0f + step : 1.0f - step;
+    }
+
+    inline float endWindow(NoiseEstimatorState& state, float* windowValues, int count) const
+    {
+        if (! state.isWarm)
+        {
+            state.value = getMedian(windowValues, count);
+            state.isWarm = state.value > 0.0f; // a silent window cannot seed a multiplicative update
+        }
+
+        return state.value / madScale;
+    }
+
+    /** Starts from a noise level of an earlier session instead of the median
+        of the first window. */
+    inline void warmStart(NoiseEstimatorState& state, float noiseLevel) const
+    {
+        state.value = noiseLevel * madScale;
+        state.isWarm = state.value > 0.0f;
+    }
+
+private:
+    float step;
+};
+
+/**
+  Exponentially weighted RMS. Samples beyond clipLevel times the current RMS are
+  left out, so spikes do not raise the estimate. Clipping them to that level
+  instead would add up to clipLevel^2 times the mean square per spike sample,
+  a bias that grows with the firing rate. Gaussian noise only loses its
+  samples beyond 4 sigma, which lowers the level by less than 0.1%, and a
+  real increase of the noise is still followed, more slowly, through the
+  samples that stay below the limit.
+
+  The first window of each channel is bootstrapped from its exact median.
+*/
+class RmsNoiseEstimator
+{
+public:
+    RmsNoiseEstimator() : alpha(0.0001f), clipLevel(4.0f) {}
+
+    void setTimeConstant(double sampleRate, double timeConstant)
+    {
+        alpha = float(1.0 / std::max(1.0, sampleRate * timeConstant));
+    }
+
+    inline void addSample(NoiseEstimatorState& state, float* windowValues, int count, float absValue) const
+    {
+        if (! state.isWarm)
+        {
+            windowValues[count] = absValue;
+            return;
+        }
+
+        // state.value holds the mean square
+        float square = absValue * absValue;
+
+        if (square < clipLevel * clipLevel * state.value)
+            state.value += alpha * (square - state.value);
+    }
+
+    inline void addWindow(NoiseEstimatorState& state, float* windowValues, int count) const
+    {
+        if (! state.isWarm)
+            return;
+
+        for (int i = 0; i < count; i++)
+        {
+            float square = windowValues[i] * windowValues[i];
+
+            if (square < clipLevel * clipLevel * state.value)
+                state.value += alpha * (square - state.value);
+        }
+    }
+
+    inline float endWindow(NoiseEstimatorState& state, float* windowValues, int count) const
+    {
+        if (! state.isWarm)
+        {
+            float sigma = getMedian(windowValues, count) / madScale;
+            state.value = sigma * sigma;
+            state.isWarm = state.value > 0.0f;
+        }
+
+        return std::sqrt(state.value);
+    }
+
+    /** Starts from a noise level of an earlier session instead of the median
+        of the first window. */
+    inline void warmStart(NoiseEstimatorState& state, float noiseLevel) const
+    {
+        state.value = noiseLevel * noiseLevel;
+        state.isWarm = state.value > 0.0f;
+    }
+
+private:
+    float alpha;
+    float clipLevel;
+};
+
+/**
+  Returns the same level for every window without looking at the samples or
+  the state, to reuse an earlier estimate when the detector is over its time
+  budget.
+*/
+class HeldNoiseEstimator
+{
+public:
+    explicit HeldNoiseEstimator(float heldLevel) : level(heldLevel) {}
+
+    inline void addSample(NoiseEstimatorState&, float*, int, float) const {}
+
+    inline void addWindow(NoiseEstimatorState&, float*, int) const {}
+
+    inline float endWindow(NoiseEstimatorState&, float*, int) const
+    {
+        return level;
+    }
+
+    inline void warmStart(NoiseEstimatorState&, float) const {}
+
+private:
+    float level;
+};
+
+#endif  // __NOISEESTIMATORS_H_6B1C4E2A__
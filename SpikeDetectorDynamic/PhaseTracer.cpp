@@ -0,0 +1,104 @@
+
+#include "PhaseTracer.h"
+
+namespace
+{
+    const char* phaseNames[PhaseTracer::NumPhases] =
+    {
+        "checkForEvents",
+        "threshold pass",
+        "detection scan",
+        "spike packing",
+        "overflow copy"
+    };
+
+    std::atomic<int> numThreads(0);
+
+    uint8 getThreadTag()
+    {
+        // small per-thread number, used as "tid" in the trace
+        static thread_local int tag = numThreads++;
+        return uint8(tag);
+    }
+}
+
+PhaseTracer::PhaseTracer(int capacity)
+    : mask(uint64(nextPowerOfTwo(jmax(capacity, 2))) - 1), writeIndex(0), enabled(false)
+{
+    records.calloc(size_t(mask + 1));
+}
+
+void PhaseTracer::setEnabled(bool shouldBeEnabled)
+{
+    enabled.store(shouldBeEnabled);
+}
+
+void PhaseTracer::record(Phase phase, int arg, bool isBegin)
+{
+    uint64 index = writeIndex.fetch_add(1, std::memory_order_relaxed);
+    Record& r = records[index & mask];
+
+    // the sequence number tells readers whether the record is complete
+    r.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    r.ticks = Time::getHighResolutionTicks();
+    r.arg = arg;
+    r.phase = uint16(phase);
+    r.isBegin = isBegin ? 1 : 0;
+    r.thread = getThreadTag();
+
+    r.sequence.store(index + 1, std::memory_order_release);
+}
+
+bool PhaseTracer::writeChromeTrace(const File& file)
+{
+    file.deleteFile();
+    FileOutputStream stream(file);
+
+    if (! stream.openedOk())
+        return false;
+
+    uint64 last = writeIndex.load(std::memory_order_acquire);
+    uint64 first = last > mask + 1 ? last - (mask + 1) : 0;
+    double ticksToMicroseconds = 1.0e6 / double(Time::getHighResolutionTicksPerSecond());
+    bool isFirstEvent = true;
+
+    stream << "{\"traceEvents\":[\n";
+
+    for (uint64 index = first; index < last; index++)
+    {
+        Record& r = records[index & mask];
+
+        uint64 sequence = r.sequence.load(std::memory_order_acquire);
+        int64 ticks = r.ticks;
+        int arg = r.arg;
+        int phase = r.phase;
+        bool isBegin = r.isBegin != 0;
+        int thread = r.thread;
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // skip records that are being written or were overwritten meanwhile
+        if (sequence != index + 1 || r.sequence.load(std::memory_order_relaxed) != sequence
+            || phase >= NumPhases)
+            continue;
+
+        if (! isFirstEvent)
+            stream << ",\n";
+
+        isFirstEvent = false;
+
+        stream << "{\"name\":\"" << phaseNames[phase] << "\",\"ph\":\"" << (isBegin ? "B" : "E")
+               << "\",\"ts\":" << String(double(ticks) * ticksToMicroseconds, 3)
+               << ",\"pid\":1,\"tid\":" << thread;
+
+        if (arg >= 0)
+            stream << ",\"args\":{\"electrode\":" << arg << "}";
+
+        stream << "}";
+    }
+
+    stream << "\n]}\n";
+    stream.flush();
+    return true;
+}
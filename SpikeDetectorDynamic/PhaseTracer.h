@@ -0,0 +1,94 @@
+
+#ifndef __PHASETRACER_H_51E0A7D3__
+#define __PHASETRACER_H_51E0A7D3__
+
+#include <ProcessorHeaders.h>
+
+/**
+  Opt-in tracing of the phases of SpikeDetectorDynamic::process().
+
+  Begin/end marks are written into a preallocated ring with a single atomic
+  increment, so several threads (the audio thread and the pipelined detection
+  thread) can record at the same time without locking. When the ring is full
+  the oldest records are overwritten. The ring can be written out at any time
+  as Chrome trace JSON (chrome://tracing, Perfetto).
+
+  When tracing is disabled each mark costs a single flag check.
+*/
+
+class PhaseTracer
+{
+public:
+    enum Phase
+    {
+        CheckForEvents = 0,
+        ThresholdPass,
+        DetectionScan,
+        SpikePacking,
+        OverflowCopy,
+        NumPhases
+    };
+
+    /** capacity is rounded up to a power of two. */
+    PhaseTracer(int capacity = 1 << 16);
+
+    void setEnabled(bool shouldBeEnabled);
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    void begin(Phase phase, int arg = -1)
+    {
+        if (isEnabled())
+            record(phase, arg, true);
+    }
+
+    void end(Phase phase, int arg = -1)
+    {
+        if (isEnabled())
+            record(phase, arg, false);
+    }
+
+    /** Writes the records currently held in the ring as Chrome trace JSON. */
+    bool writeChromeTrace(const File& file);
+
+    /** Records a begin mark on construction and the matching end mark on destruction. */
+    class Scope
+    {
+    public:
+        Scope(PhaseTracer& t, Phase p, int a = -1) : tracer(t), phase(p), arg(a)
+        {
+            tracer.begin(phase, arg);
+        }
+
+        ~Scope()
+        {
+            tracer.end(phase, arg);
+        }
+
+    private:
+        PhaseTracer& tracer;
+        Phase phase;
+        int arg;
+    };
+
+private:
+    struct Record
+    {
+        std::atomic<uint64> sequence;
+        int64 ticks;
+        int32 arg;
+        uint16 phase;
+        uint8 isBegin;
+        uint8 thread;
+    };
+
+    void record(Phase phase, int arg, bool isBegin);
+
+    HeapBlock<Record> records;
+    uint64 mask;
+    std::atomic<uint64> writeIndex;
+    std::atomic<bool> enabled;
+
+    JUCE_DECLARE_NON_COPYABLE(PhaseTracer);
+};
+
+#endif  // __PHASETRACER_H_51E0A7D3__
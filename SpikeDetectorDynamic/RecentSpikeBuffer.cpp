@@ -0,0 +1,88 @@
+
+#include "RecentSpikeBuffer.h"
+
+static_assert((RECENT_SPIKES_PER_ELECTRODE & (RECENT_SPIKES_PER_ELECTRODE - 1)) == 0,
+              "the ring size must be a power of two");
+
+RecentSpikeBuffer::RecentSpikeBuffer()
+    : numRings(0)
+{
+}
+
+void RecentSpikeBuffer::prepare(int numElectrodes)
+{
+    // zeroed memory leaves every sequence number and write index at 0, and
+    // touching it here keeps page faults out of add()
+    rings.calloc(jmax(numElectrodes, 1));
+    numRings = numElectrodes;
+}
+
+void RecentSpikeBuffer::add(int electrode, const SpikeObject* s, const float* bitVolts)
+{
+    if (electrode < 0 || electrode >= numRings)
+        return;
+
+    Ring& ring = rings[electrode];
+
+    // single writer: nobody else changes writeIndex
+    uint64 index = ring.writeIndex.load(std::memory_order_relaxed);
+    Slot& slot = ring.slots[index & (RECENT_SPIKES_PER_ELECTRODE - 1)];
+
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    RecentSpike& r = slot.spike;
+    r.nChannels = uint16(jmin(int(s->nChannels), MAX_NUMBER_OF_SPIKE_CHANNELS));
+    r.nSamples = uint16(jmin(int(s->nSamples), MAX_NUMBER_OF_SPIKE_CHANNEL_SAMPLES));
+    r.sortedId = s->sortedId;
+
+    for (int chan = 0; chan < r.nChannels; chan++)
+    {
+        r.threshold[chan] = s->threshold[chan];
+        r.bitVolts[chan] = bitVolts[chan];
+    }
+
+    memcpy(r.data, s->data, sizeof(uint16) * r.nChannels * r.nSamples);
+
+    slot.sequence.store(index + 1, std::memory_order_release);
+    ring.writeIndex.store(index + 1, std::memory_order_release);
+}
+
+int RecentSpikeBuffer::getRecentSpikes(int electrode, RecentSpike* spikes, int maxSpikes) const
+{
+    if (electrode < 0 || electrode >= numRings || maxSpikes <= 0)
+        return 0;
+
+    const Ring& ring = rings[electrode];
+    uint64 end = ring.writeIndex.load(std::memory_order_acquire);
+    uint64 count = jmin(end, uint64(jmin(maxSpikes, RECENT_SPIKES_PER_ELECTRODE)));
+    int numCopied = 0;
+
+    for (uint64 index = end - count; index < end; index++)
+    {
+        const Slot& slot = ring.slots[index & (RECENT_SPIKES_PER_ELECTRODE - 1)];
+
+        if (slot.sequence.load(std::memory_order_acquire) != index + 1)
+            continue; // being written, or already replaced by a newer spike
+
+        RecentSpike& r = spikes[numCopied];
+        r = slot.spike;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (slot.sequence.load(std::memory_order_relaxed) != index + 1)
+            continue; // overwritten during the copy
+
+        numCopied++;
+    }
+
+    return numCopied;
+}
+
+uint64 RecentSpikeBuffer::getNumSpikes(int electrode) const
+{
+    if (electrode < 0 || electrode >= numRings)
+        return 0;
+
+    return rings[electrode].writeIndex.load(std::memory_order_acquire);
+}
@@ -0,0 +1,75 @@
+
+#ifndef __RECENTSPIKEBUFFER_H_6A1F3C92__
+#define __RECENTSPIKEBUFFER_H_6A1F3C92__
+
+#include <ProcessorHeaders.h>
+#include <SpikeLib.h>
+
+#include <atomic>
+
+// a power of two
+#define RECENT_SPIKES_PER_ELECTRODE 32
+
+/** A packed waveform kept for display, as add() received it. */
+struct RecentSpike
+{
+    uint16 nChannels;
+    uint16 nSamples;
+    uint16 sortedId;
+    uint16 threshold[MAX_NUMBER_OF_SPIKE_CHANNELS];     // microvolts
+    float bitVolts[MAX_NUMBER_OF_SPIKE_CHANNELS];
+    uint16 data[MAX_NUMBER_OF_SPIKE_CHANNELS * MAX_NUMBER_OF_SPIKE_CHANNEL_SAMPLES];
+};
+
+/**
+  Keeps the last RECENT_SPIKES_PER_ELECTRODE waveforms of each electrode, so
+  that the editor can draw them without a SpikeViewer decoding the events.
+
+  There is one writer, the thread that packs the spikes: add() copies the
+  waveform into the next slot of the electrode's ring and never blocks. The
+  editor copies the slots out on the message thread; each slot carries a
+  sequence number, set to 0 while it is written, so that a slot overwritten
+  during the copy is skipped instead of drawn torn (as in SpikeStreamWriter).
+*/
+
+class RecentSpikeBuffer
+{
+public:
+    RecentSpikeBuffer();
+
+    /** Allocates empty rings for the electrodes. Called from enable(), on the
+        message thread, while nothing is written. */
+    void prepare(int numElectrodes);
+
+    /** Copies a packed spike of an electrode; bitVolts holds the scale of
+        each of its channels. */
+    void add(int electrode, const SpikeObject* s, const float* bitVolts);
+
+    /** Copies up to maxSpikes of the most recent spikes of an electrode into
+        spikes, oldest first, and returns their number. */
+    int getRecentSpikes(int electrode, RecentSpike* spikes, int maxSpikes) const;
+
+    /** The number of spikes added to an electrode since prepare(), so that
+        readers can tell when nothing changed. */
+    uint64 getNumSpikes(int electrode) const;
+
+private:
+    struct Slot
+    {
+        std::atomic<uint64> sequence;   // index + 1 of the spike it holds, 0 while written
+        RecentSpike spike;
+    };
+
+    struct Ring
+    {
+        std::atomic<uint64> writeIndex;
+        Slot slots[RECENT_SPIKES_PER_ELECTRODE];
+    };
+
+    HeapBlock<Ring> rings;
+    int numRings;
+
+    JUCE_DECLARE_NON_COPYABLE(RecentSpikeBuffer);
+};
+
+#endif  // __RECENTSPIKEBUFFER_H_6A1F3C92__
@@ -0,0 +1,385 @@
+
+#include "SimdKernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined (__x86_64__) || defined (__i386__) || defined (_M_X64) || defined (_M_IX86)
+ #define SPIKEDETECTOR_X86 1
+ #include <immintrin.h>
+ #if defined (_MSC_VER)
+  #include <intrin.h>
+ #endif
+#else
+ #define SPIKEDETECTOR_X86 0
+#endif
+
+// each variant is compiled for its own instruction set, whatever the flags of
+// the rest of the plugin; MSVC accepts the intrinsics without this
+#if SPIKEDETECTOR_X86 && (defined (__GNUC__) || defined (__clang__))
+ #define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+ #define SIMD_TARGET(isa)
+#endif
+
+static inline int countTrailingZeros(unsigned int mask)
+{
+   #if defined (_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return int(index);
+   #else
+    return __builtin_ctz(mask);
+   #endif
+}
+
+//==============================================================================
+static void absCopyScalar(float* dest, const float* source, int n)
+{
+    for (int i = 0; i < n; i++)
+        dest[i] = std::abs(source[i]);
+}
+
+static float maxValueScalar(const float* x, int n)
+{
+    float maximum = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (x[i] > maximum)
+            maximum = x[i];
+    }
+
+    return maximum;
+}
+
+static int findFirstAboveScalar(const float* x, int n, float threshold)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (std::abs(x[i]) > threshold)
+            return i;
+    }
+
+    return n;
+}
+
+static void packWaveformScalar(uint16_t* dest, const float* source, int n, float bitVolts)
+{
+    for (int i = 0; i < n; i++)
+        dest[i] = uint16_t(source[i] / bitVolts + 32768);
+}
+
+#if SPIKEDETECTOR_X86
+
+//==============================================================================
+SIMD_TARGET("sse4.1")
+static void absCopySse41(float* dest, const float* source, int n)
+{
+    const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dest + i, _mm_and_ps(_mm_loadu_ps(source + i), mask));
+
+    absCopyScalar(dest + i, source + i, n - i);
+}
+
+// _mm_max_ps(x, m) returns m when x is NaN, like the scalar comparison
+SIMD_TARGET("sse4.1")
+static float maxValueSse41(const float* x, int n)
+{
+    __m128 maximum0 = _mm_setzero_ps();
+    __m128 maximum1 = _mm_setzero_ps();
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        maximum0 = _mm_max_ps(_mm_loadu_ps(x + i), maximum0);
+        maximum1 = _mm_max_ps(_mm_loadu_ps(x + i + 4), maximum1);
+    }
+
+    float partial[4];
+    _mm_storeu_ps(partial, _mm_max_ps(maximum0, maximum1));
+
+    return std::max(maxValueScalar(partial, 4), maxValueScalar(x + i, n - i));
+}
+
+SIMD_TARGET("sse4.1")
+static int findFirstAboveSse41(const float* x, int n, float threshold)
+{
+    const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 limit = _mm_set1_ps(threshold);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        int bits = _mm_movemask_ps(_mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(x + i), mask), limit))
+                   | (_mm_movemask_ps(_mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(x + i + 4), mask), limit)) << 4);
+
+        if (bits != 0)
+            return i + countTrailingZeros(unsigned(bits));
+    }
+
+    return i + findFirstAboveScalar(x + i, n - i, threshold);
+}
+
+SIMD_TARGET("sse4.1")
+static void packWaveformSse41(uint16_t* dest, const float* source, int n, float bitVolts)
+{
+    // the same division and truncation as the scalar cast, so the results are
+    // identical, also for values outside the uint16 range (they wrap)
+    const __m128 scale = _mm_set1_ps(bitVolts);
+    const __m128 offset = _mm_set1_ps(32768.0f);
+    const __m128i lowBits = _mm_set1_epi32(0xffff);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i low = _mm_cvttps_epi32(_mm_add_ps(_mm_div_ps(_mm_loadu_ps(source + i), scale), offset));
+        __m128i high = _mm_cvttps_epi32(_mm_add_ps(_mm_div_ps(_mm_loadu_ps(source + i + 4), scale), offset));
+        _mm_storeu_si128((__m128i*) (dest + i), _mm_packus_epi32(_mm_and_si128(low, lowBits),
+                                                                 _mm_and_si128(high, lowBits)));
+    }
+
+    packWaveformScalar(dest + i, source + i, n - i, bitVolts);
+}
+
+//==============================================================================
+SIMD_TARGET("avx2")
+static void absCopyAvx2(float* dest, const float* source, int n)
+{
+    const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dest + i, _mm256_and_ps(_mm256_loadu_ps(source + i), mask));
+
+    absCopyScalar(dest + i, source + i, n - i);
+}
+
+SIMD_TARGET("avx2")
+static float maxValueAvx2(const float* x, int n)
+{
+    __m256 maximum0 = _mm256_setzero_ps();
+    __m256 maximum1 = _mm256_setzero_ps();
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        maximum0 = _mm256_max_ps(_mm256_loadu_ps(x + i), maximum0);
+        maximum1 = _mm256_max_ps(_mm256_loadu_ps(x + i + 8), maximum1);
+    }
+
+    float partial[8];
+    _mm256_storeu_ps(partial, _mm256_max_ps(maximum0, maximum1));
+
+    return std::max(maxValueScalar(partial, 8), maxValueScalar(x + i, n - i));
+}
+
+SIMD_TARGET("avx2")
+static int findFirstAboveAvx2(const float* x, int n, float threshold)
+{
+    const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 limit = _mm256_set1_ps(threshold);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        int bits = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_and_ps(_mm256_loadu_ps(x + i), mask), limit, _CMP_GT_OQ))
+                   | (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_and_ps(_mm256_loadu_ps(x + i + 8), mask), limit, _CMP_GT_OQ)) << 8);
+
+        if (bits != 0)
+            return i + countTrailingZeros(unsigned(bits));
+    }
+
+    return i + findFirstAboveScalar(x + i, n - i, threshold);
+}
+
+SIMD_TARGET("avx2")
+static void packWaveformAvx2(uint16_t* dest, const float* source, int n, float bitVolts)
+{
+    const __m256 scale = _mm256_set1_ps(bitVolts);
+    const __m256 offset = _mm256_set1_ps(32768.0f);
+    const __m256i lowBits = _mm256_set1_epi32(0xffff);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i low = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_div_ps(_mm256_loadu_ps(source + i), scale), offset));
+        __m256i high = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_div_ps(_mm256_loadu_ps(source + i + 8), scale), offset));
+        low = _mm256_and_si256(low, lowBits);
+        high = _mm256_and_si256(high, lowBits);
+
+        // the pack works per 128-bit lane, the permute restores the order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high), 0xd8);
+        _mm256_storeu_si256((__m256i*) (dest + i), packed);
+    }
+
+    packWaveformScalar(dest + i, source + i, n - i, bitVolts);
+}
+
+//==============================================================================
+SIMD_TARGET("avx512f")
+static void absCopyAvx512(float* dest, const float* source, int n)
+{
+    const __m512i mask = _mm512_set1_epi32(0x7fffffff);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16)
+        _mm512_storeu_si512(dest + i, _mm512_and_epi32(_mm512_loadu_si512(source + i), mask));
+
+    absCopyScalar(dest + i, source + i, n - i);
+}
+
+SIMD_TARGET("avx512f")
+static float maxValueAvx512(const float* x, int n)
+{
+    __m512 maximum = _mm512_setzero_ps();
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16)
+        maximum = _mm512_max_ps(_mm512_loadu_ps(x + i), maximum);
+
+    return std::max(_mm512_reduce_max_ps(maximum), maxValueScalar(x + i, n - i));
+}
+
+SIMD_TARGET("avx512f")
+static int findFirstAboveAvx512(const float* x, int n, float threshold)
+{
+    const __m512i mask = _mm512_set1_epi32(0x7fffffff);
+    const __m512 limit = _mm512_set1_ps(threshold);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512 values = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_loadu_si512(x + i), mask));
+        __mmask16 bits = _mm512_cmp_ps_mask(values, limit, _CMP_GT_OQ);
+
+        if (bits != 0)
+            return i + countTrailingZeros(unsigned(bits));
+    }
+
+    return i + findFirstAboveScalar(x + i, n - i, threshold);
+}
+
+SIMD_TARGET("avx512f")
+static void packWaveformAvx512(uint16_t* dest, const float* source, int n, float bitVolts)
+{
+    const __m512 scale = _mm512_set1_ps(bitVolts);
+    const __m512 offset = _mm512_set1_ps(32768.0f);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512i values = _mm512_cvttps_epi32(_mm512_add_ps(_mm512_div_ps(_mm512_loadu_ps(source + i), scale), offset));
+
+        // keeps the low 16 bits, like the scalar cast
+        _mm256_storeu_si256((__m256i*) (dest + i), _mm512_cvtepi32_epi16(values));
+    }
+
+    packWaveformScalar(dest + i, source + i, n - i, bitVolts);
+}
+
+#endif  // SPIKEDETECTOR_X86
+
+//==============================================================================
+static int detectSimdLevel()
+{
+   #if SPIKEDETECTOR_X86
+    #if defined (_MSC_VER)
+     int info[4];
+     __cpuid(info, 0);
+     int maxLeaf = info[0];
+
+     __cpuid(info, 1);
+     bool hasSse41 = (info[2] & (1 << 19)) != 0;
+     bool hasOsXsave = (info[2] & (1 << 27)) != 0;
+
+     if (! hasSse41)
+         return SimdScalar;
+
+     if (! hasOsXsave || maxLeaf < 7)
+         return SimdSse41;
+
+     // the OS must save the AVX (and AVX-512) registers on context switches
+     unsigned long long xcr0 = _xgetbv(0);
+
+     __cpuidex(info, 7, 0);
+     bool hasAvx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+     bool hasAvx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+    #else
+     __builtin_cpu_init();
+
+     if (! __builtin_cpu_supports("sse4.1"))
+         return SimdScalar;
+
+     bool hasAvx2 = __builtin_cpu_supports("avx2");
+     bool hasAvx512 = __builtin_cpu_supports("avx512f");
+    #endif
+
+    if (hasAvx512)
+        return SimdAvx512;
+
+    if (hasAvx2)
+        return SimdAvx2;
+
+    return SimdSse41;
+   #else
+    return SimdScalar;
+   #endif
+}
+
+int getSupportedSimdLevel()
+{
+    static const int supportedLevel = detectSimdLevel();
+    return supportedLevel;
+}
+
+const SimdKernels& getSimdKernels(int level)
+{
+    static const SimdKernels kernels[NumSimdLevels] =
+    {
+        { SimdScalar, absCopyScalar, maxValueScalar, findFirstAboveScalar, packWaveformScalar },
+       #if SPIKEDETECTOR_X86
+        { SimdSse41,  absCopySse41,  maxValueSse41,  findFirstAboveSse41,  packWaveformSse41 },
+        { SimdAvx2,   absCopyAvx2,   maxValueAvx2,   findFirstAboveAvx2,   packWaveformAvx2 },
+        { SimdAvx512, absCopyAvx512, maxValueAvx512, findFirstAboveAvx512, packWaveformAvx512 }
+       #else
+        { SimdScalar, absCopyScalar, maxValueScalar, findFirstAboveScalar, packWaveformScalar },
+        { SimdScalar, absCopyScalar, maxValueScalar, findFirstAboveScalar, packWaveformScalar },
+        { SimdScalar, absCopyScalar, maxValueScalar, findFirstAboveScalar, packWaveformScalar }
+       #endif
+    };
+
+    int supportedLevel = getSupportedSimdLevel();
+
+    if (level < 0 || level > supportedLevel)
+        level = supportedLevel;
+
+    return kernels[level];
+}
+
+const char* getSimdLevelName(int level)
+{
+    switch (level)
+    {
+        case SimdScalar: return "scalar";
+        case SimdSse41:  return "sse4.1";
+        case SimdAvx2:   return "avx2";
+        case SimdAvx512: return "avx512";
+        default:         return "auto";
+    }
+}
+
+int getSimdLevelType(const char* name)
+{
+    for (int level = 0; level < NumSimdLevels; level++)
+    {
+        if (strcmp(name, getSimdLevelName(level)) == 0)
+            return level;
+    }
+
+    return SimdAuto;
+}
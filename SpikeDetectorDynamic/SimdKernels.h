@@ -0,0 +1,101 @@
+
+#ifndef __SIMDKERNELS_H_E5A03B96__
+#define __SIMDKERNELS_H_E5A03B96__
+
+#include <cstdint>
+
+/**
+  Small vector kernels shared by the detection and classification stages.
+
+  dotProduct() is compiled for the baseline instruction set. The kernels of
+  the detection path are compiled for several instruction sets and picked at
+  run time (see getSimdKernels()), so one build runs at full speed on older
+  and newer CPUs alike.
+*/
+
+#if defined (__SSE__) || defined (_M_X64) || defined (_M_IX86)
+ #include <xmmintrin.h>
+ #define SPIKEDETECTOR_USE_SSE 1
+#else
+ #define SPIKEDETECTOR_USE_SSE 0
+#endif
+
+/** Dot product of two float arrays; n must be a multiple of 4. */
+inline float dotProduct(const float* a, const float* b, int n)
+{
+   #if SPIKEDETECTOR_USE_SSE
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+
+    if (i < n)
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+
+    float partial[4];
+    _mm_storeu_ps(partial, _mm_add_ps(sum0, sum1));
+    return (partial[0] + partial[1]) + (partial[2] + partial[3]);
+   #else
+    float sum = 0;
+
+    for (int i = 0; i < n; i++)
+        sum += a[i] * b[i];
+
+    return sum;
+   #endif
+}
+
+/** Rounds a number of floats up to a multiple of 4, the granularity of dotProduct(). */
+inline int paddedLength(int n)
+{
+    return (n + 3) & ~3;
+}
+
+enum SimdLevel
+{
+    SimdAuto = -1,      // the best level the CPU supports
+    SimdScalar = 0,
+    SimdSse41,
+    SimdAvx2,
+    SimdAvx512,
+    NumSimdLevels
+};
+
+/** One variant of the detection kernels. All of them give the same results. */
+struct SimdKernels
+{
+    int level;
+
+    /** dest[i] = |source[i]|, the values fed to the noise estimators. */
+    void (*absCopy) (float* dest, const float* source, int n);
+
+    /** The largest of n values that are not negative (such as absCopy() output),
+        or 0 if n is 0. NaNs are ignored, as they never cross a threshold. */
+    float (*maxValue) (const float* x, int n);
+
+    /** Index of the first sample with |x| > threshold, or n if there is none. */
+    int (*findFirstAbove) (const float* x, int n, float threshold);
+
+    /** dest[i] = uint16 (source[i] / bitVolts + 32768), the SpikeObject waveform encoding. */
+    void (*packWaveform) (uint16_t* dest, const float* source, int n, float bitVolts);
+};
+
+/** The highest level supported by this CPU (checked once with cpuid). */
+int getSupportedSimdLevel();
+
+/** Kernels of the given level, or of the highest supported level below it;
+    SimdAuto selects the highest supported level. */
+const SimdKernels& getSimdKernels(int level);
+
+const char* getSimdLevelName(int level);
+
+/** Returns the level with the given name ("auto", "scalar", "sse4.1", "avx2",
+    "avx512"), or SimdAuto if unknown. */
+int getSimdLevelType(const char* name);
+
+#endif  // __SIMDKERNELS_H_E5A03B96__
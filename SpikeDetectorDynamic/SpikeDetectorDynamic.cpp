@@ -1,12 +1,34 @@
 
 #include <stdio.h>
+#include <limits>
+#include <cmath>
 #include "SpikeDetectorDynamic.h"
+#include "AudioThreadGuard.h"
+
+// header of the binary electrode map sidecar
+#define ELECTRODE_MAP_MAGIC "SDEM"
+#define ELECTRODE_MAP_VERSION 3
 
 SpikeDetectorDynamic::SpikeDetectorDynamic()
     : GenericProcessor("Dynamic Detector"),
-      overflowBuffer(2,100), dataBuffer(nullptr),
-      overflowBufferSize(100), currentElectrode(-1),
-	  uniqueID(0), window_size(200)
+      dataBuffer(nullptr), blockTimestamps(nullptr),
+      blockNumSamples(nullptr), pipelinedMode(false), pipelineActive(false),
+      scanIndex(0), scanEvents(nullptr), numDropped(0),
+      numLimitedElectrodes(0), lastLimitedElectrode(-1), firstDroppedIndex(0),
+      firstDroppedTimestamp(0), lastDroppedTimestamp(0), currentElectrode(-1),
+	  uniqueID(0), numCandidates(0), candidateCapacity(0), numPeakCounts(0), numElectrodeCounts(0),
+      coincidenceElectrodes(0), coincidenceWindowMs(0.2), coincidenceWindow(1),
+      rejectedSpikeCount(0), blockCounter(0),
+      filterEnabled(false), filterActive(false), filterLowCut(300.0), filterHighCut(6000.0),
+      healthCheckEnabled(false), healthChangeCount(0), healthCheckInterval(1), nextHealthCheck(0),
+      warmStartEnabled(true), warmNoiseChannels(0), warmNoiseFiltered(false),
+      sortingActive(false), sortedSpikeCount(0), classifiedSpikeCount(0), featuresEnabled(false),
+      compressedWaveforms(false), compressedSpikeCount(0), compressedBytes(0),
+      fullWidthBytes(0), compressionTicks(0),
+      window_size(200), triggerEventsEnabled(false), triggerChannelIndex(-1),
+      triggerLeadSum(0), triggerLeadCount(0), triggerLeadMax(0),
+      maxSpikeRate(0), spikeBurst(10), spikeTokensPerSample(0), overflowChannelIndex(-1),
+      droppedSpikeCount(0)
 {
     //// the standard form:
     electrodeTypes.add("single electrode");
@@ -19,10 +41,28 @@ SpikeDetectorDynamic::SpikeDetectorDynamic()
     }
 
 	spikeBuffer.malloc(MAX_SPIKE_BUFFER_LEN);
+    spikeFeatures.calloc(SPIKE_FEATURE_COUNT);
+    windowValues.malloc(window_size);
+
+    captureLayoutSize = 0;
+    captureLayoutChanged = false;
+
+    simdLevel = SimdAuto;
+    kernels = &getSimdKernels(simdLevel);
+
+    timeBudgetMs = 0;
+    timeBudgetTicks = 0;
+    detectionStartTicks = 0;
+    sheddingLevel = NoShedding;
+    noiseHoldBlocks = 1;
+
+    for (int step = 0; step < NumSheddingSteps; step++)
+        sheddingCounts[step] = 0;
 }
 
 SpikeDetectorDynamic::~SpikeDetectorDynamic()
 {
+    detectionThread = nullptr;
 }
 
 AudioProcessorEditor* SpikeDetectorDynamic::createEditor()
@@ -33,9 +73,6 @@ AudioProcessorEditor* SpikeDetectorDynamic::createEditor()
 
 void SpikeDetectorDynamic::updateSettings()
 {
-    if (getNumInputs() > 0)
-        overflowBuffer.setSize(getNumInputs(), overflowBufferSize);
-
     for (int i = 0; i < electrodes.size(); i++)
     {
         Channel* ch = new Channel(this,i,ELECTRODE_CHANNEL);
@@ -44,10 +81,31 @@ void SpikeDetectorDynamic::updateSettings()
 		ch->extraData = spk;
         eventChannels.add(ch);
     }
+
+    triggerChannelIndex = -1;
+
+    if (triggerEventsEnabled)
+    {
+        triggerChannelIndex = electrodes.size();
+        Channel* ch = new Channel(this, triggerChannelIndex, EVENT_CHANNEL);
+        ch->name = "Threshold crossings";
+        eventChannels.add(ch);
+    }
+
+    overflowChannelIndex = -1;
+
+    if (maxSpikeRate > 0)
+    {
+        overflowChannelIndex = electrodes.size() + (triggerChannelIndex >= 0 ? 1 : 0);
+        Channel* ch = new Channel(this, overflowChannelIndex, EVENT_CHANNEL);
+        ch->name = "Spike overflow";
+        eventChannels.add(ch);
+    }
 }
 
 bool SpikeDetectorDynamic::addElectrode(int nChans, int electrodeID)
 {
+    AUDIO_THREAD_BLOCKING_CALL("std::cout")
     std::cout << "Adding electrode with " << nChans << " channels." << std::endl;
     int firstChan;
     if (electrodes.size() == 0)
@@ -83,20 +141,38 @@ bool SpikeDetectorDynamic::addElectrode(int nChans, int electrodeID)
     newName += " ";
     newName += electrodeCounter[nChans];
 
-    SimpleElectrode* newElectrode = new SimpleElectrode();
+    SimpleElectrode* newElectrode = createElectrode(nChans, electrodeID);
 
     newElectrode->name = newName;
+
+    for (int i = 0; i < nChans; i++)
+    {
+        *(newElectrode->channels+i) = firstChan+i;
+    }
+
+    newElectrode->sourceNodeId = channels[*newElectrode->channels]->sourceNodeId;
+    electrodes.add(newElectrode);
+    currentElectrode = electrodes.size()-1;
+    return true;
+}
+
+SimpleElectrode* SpikeDetectorDynamic::createElectrode(int nChans, int electrodeID)
+{
+    SimpleElectrode* newElectrode = new SimpleElectrode();
+
     newElectrode->numChannels = nChans;
 	newElectrode->prePeakSamples = int(floor(0.4*getSampleRate() / 1000));			// ~1 ms around the spike as a function of sampling rate
 	newElectrode->postPeakSamples = int(floor(0.7*getSampleRate() / 1000));
     newElectrode->thresholds.malloc(nChans);
     newElectrode->isActive.malloc(nChans);
     newElectrode->channels.malloc(nChans);
+    newElectrode->heldNoiseLevels.malloc(nChans);
     newElectrode->isMonitored = false;
+    newElectrode->noiseEstimator = MedianNoise;
 
     for (int i = 0; i < nChans; i++)
     {
-        *(newElectrode->channels+i) = firstChan+i;
+        *(newElectrode->channels+i) = i;
         *(newElectrode->thresholds+i) = getDefaultThreshold();
         *(newElectrode->isActive+i) = true;
     }
@@ -107,11 +183,159 @@ bool SpikeDetectorDynamic::addElectrode(int nChans, int electrodeID)
     } else {
         newElectrode->electrodeID = ++uniqueID;
     }
-    
-    newElectrode->sourceNodeId = channels[*newElectrode->channels]->sourceNodeId;
+
     resetElectrode(newElectrode);
-    electrodes.add(newElectrode);
+    return newElectrode;
+}
+
+void SpikeDetectorDynamic::applyElectrodeMap(const Array<ElectrodeConfig>& configs)
+{
+    electrodes.clear();
+    electrodes.ensureStorageAllocated(configs.size());
+
+    for (int i = 0; i < electrodeCounter.size(); i++)
+        electrodeCounter.set(i, 0);
+
+    for (int i = 0; i < configs.size(); i++)
+    {
+        const ElectrodeConfig& config = configs.getReference(i);
+        int nChans = config.channels.size();
+
+        if (nChans < 1 || nChans > MAX_NUMBER_OF_SPIKE_CHANNELS)
+            continue;
+
+        SimpleElectrode* e = createElectrode(nChans, config.electrodeID);
+        e->name = config.name;
+        e->noiseEstimator = jlimit(0, NumNoiseEstimators - 1, config.noiseEstimator);
+
+        for (int j = 0; j < nChans; j++)
+        {
+            *(e->channels+j) = config.channels[j];
+            *(e->thresholds+j) = config.thresholds[j];
+            *(e->isActive+j) = config.isActive[j];
+        }
+
+        if (Channel* ch = channels[*e->channels])
+            e->sourceNodeId = ch->sourceNodeId;
+
+        // keep the default names of electrodes added later in sequence
+        electrodeCounter.set(nChans, electrodeCounter[nChans] + 1);
+        electrodes.add(e);
+    }
+
     currentElectrode = electrodes.size()-1;
+}
+
+void SpikeDetectorDynamic::setElectrodeMapFile(const File& file)
+{
+    electrodeMapFile = file;
+}
+
+bool SpikeDetectorDynamic::writeElectrodeMap(const File& file)
+{
+    file.deleteFile();
+    FileOutputStream stream(file);
+
+    if (! stream.openedOk())
+        return false;
+
+    stream.write(ELECTRODE_MAP_MAGIC, 4);
+    stream.writeInt(ELECTRODE_MAP_VERSION);
+    stream.writeInt(electrodes.size());
+
+    for (int i = 0; i < electrodes.size(); i++)
+    {
+        SimpleElectrode* e = electrodes[i];
+        stream.writeString(e->name);
+        stream.writeInt(e->electrodeID);
+        stream.writeByte((char) e->noiseEstimator);
+        stream.writeByte((char) e->numChannels);
+
+        for (int j = 0; j < e->numChannels; j++)
+        {
+            stream.writeInt(*(e->channels+j));
+            stream.writeDouble(*(e->thresholds+j));
+            stream.writeBool(*(e->isActive+j));
+        }
+    }
+
+    stream.flush();
+    return true;
+}
+
+bool SpikeDetectorDynamic::readElectrodeMap(const File& file, Array<ElectrodeConfig>& configs)
+{
+    FileInputStream stream(file);
+
+    if (! stream.openedOk())
+        return false;
+
+    char magic[4];
+
+    if (stream.read(magic, 4) != 4 || memcmp(magic, ELECTRODE_MAP_MAGIC, 4) != 0)
+        return false;
+
+    int version = stream.readInt();
+
+    if (version < 1 || version > ELECTRODE_MAP_VERSION)
+        return false;
+
+    // thresholds were stored as floats before version 3
+    const int thresholdSize = version >= 3 ? 8 : 4;
+    const int electrodeHeaderSize = 4 + (version >= 2 ? 1 : 0) + 1;
+    const int channelSize = 4 + thresholdSize + 1;
+
+    // the stream reads 0 past its end, so every part is checked against the
+    // bytes left before it is read; electrodes have at least a 1-byte name
+    int numElectrodes = stream.readInt();
+
+    if (numElectrodes < 0 || numElectrodes * int64(1 + electrodeHeaderSize + channelSize) > stream.getNumBytesRemaining())
+        return false;
+
+    // nothing is added unless the whole file is valid
+    Array<ElectrodeConfig> fileConfigs;
+    fileConfigs.ensureStorageAllocated(numElectrodes);
+
+    for (int i = 0; i < numElectrodes; i++)
+    {
+        ElectrodeConfig config;
+        config.name = stream.readString();
+
+        if (stream.getNumBytesRemaining() < electrodeHeaderSize)
+            return false;
+
+        config.electrodeID = stream.readInt();
+
+        if (version >= 2)
+            config.noiseEstimator = uint8(stream.readByte());
+
+        int nChans = uint8(stream.readByte());
+
+        if (config.noiseEstimator >= NumNoiseEstimators || nChans < 1 || nChans > MAX_NUMBER_OF_SPIKE_CHANNELS
+            || stream.getNumBytesRemaining() < nChans * int64(channelSize))
+            return false;
+
+        for (int j = 0; j < nChans; j++)
+        {
+            int channel = stream.readInt();
+            double threshold = version >= 3 ? stream.readDouble() : double(stream.readFloat());
+
+            if (channel < 0 || channel >= getNumInputs() || ! (threshold >= 0.0) || ! std::isfinite(threshold))
+                return false;
+
+            config.channels.add(channel);
+            config.thresholds.add(threshold);
+            config.isActive.add(stream.readBool());
+        }
+
+        fileConfigs.add(config);
+    }
+
+    // a longer file was not written by writeElectrodeMap()
+    if (stream.getNumBytesRemaining() != 0)
+        return false;
+
+    configs.addArray(fileConfigs);
     return true;
 }
 
@@ -132,9 +356,27 @@ StringArray SpikeDetectorDynamic::getElectrodeNames()
     return names;
 }
 
+int SpikeDetectorDynamic::getNumElectrodes()
+{
+    return electrodes.size();
+}
+
+String SpikeDetectorDynamic::getElectrodeName(int index)
+{
+    if (SimpleElectrode* e = electrodes[index])
+        return e->name;
+
+    return String();
+}
+
 void SpikeDetectorDynamic::resetElectrode(SimpleElectrode* e)
 {
     e->lastBufferIndex = 0;
+    e->spikeTokens = spikeBurst;
+    e->heldNoiseBlock = -1;
+
+    for (int i = 0; i < e->numChannels; i++)
+        e->heldNoiseLevels[i] = -1.0f;
 }
 
 bool SpikeDetectorDynamic::removeElectrode(int index)
@@ -153,6 +395,7 @@ void SpikeDetectorDynamic::setElectrodeName(int index, String newName)
 
 void SpikeDetectorDynamic::setChannel(int electrodeIndex, int channelNum, int newChannel)
 {
+    AUDIO_THREAD_BLOCKING_CALL("std::cout")
     std::cout << "Setting electrode " << electrodeIndex << " channel " << channelNum <<
               " to " << newChannel << std::endl;
 
@@ -198,6 +441,7 @@ void SpikeDetectorDynamic::setChannelActive(int electrodeIndex, int subChannel,
     currentElectrode = electrodeIndex;
     currentChannelIndex = subChannel;
 
+    AUDIO_THREAD_BLOCKING_CALL("std::cout")
     std::cout << "Setting channel active to " << active << std::endl;
 
     if (active)
@@ -216,6 +460,7 @@ void SpikeDetectorDynamic::setChannelThreshold(int electrodeNum, int channelNum,
 {
     currentElectrode = electrodeNum;
     currentChannelIndex = channelNum;
+    AUDIO_THREAD_BLOCKING_CALL("std::cout")
     std::cout << "Setting electrode " << electrodeNum << " channel threshold " << channelNum << " to " << thresh << std::endl;
     setParameter(99, thresh);
 }
@@ -225,330 +470,1269 @@ double SpikeDetectorDynamic::getChannelThreshold(int electrodeNum, int channelNu
     return *(electrodes[electrodeNum]->thresholds+channelNum);
 }
 
-void SpikeDetectorDynamic::setParameter(int parameterIndex, float newValue)
+void SpikeDetectorDynamic::setNoiseEstimator(int electrodeNum, int type)
 {
-    if (parameterIndex == 99 && currentElectrode > -1)
-    {
-        *(electrodes[currentElectrode]->thresholds+currentChannelIndex) = newValue;
-    }
-    else if (parameterIndex == 98 && currentElectrode > -1)
-    {
-        if (newValue == 0.0f)
-            *(electrodes[currentElectrode]->isActive+currentChannelIndex) = false;
-        else
-            *(electrodes[currentElectrode]->isActive+currentChannelIndex) = true;
-    }
+    electrodes[electrodeNum]->noiseEstimator = jlimit(0, NumNoiseEstimators - 1, type);
+    captureLayoutChanged = true;
 }
 
-bool SpikeDetectorDynamic::enable()
+int SpikeDetectorDynamic::getNoiseEstimator(int electrodeNum)
 {
-    sampleRateForElectrode = (uint16_t) getSampleRate();
-    useOverflowBuffer.clear();
-
-    for (int i = 0; i < electrodes.size(); i++)
-        useOverflowBuffer.add(false);
-
-    return true;
+    return electrodes[electrodeNum]->noiseEstimator;
 }
 
-bool SpikeDetectorDynamic::disable()
+void SpikeDetectorDynamic::setTriggerEventsEnabled(bool enabled)
 {
-    for (int n = 0; n < electrodes.size(); n++)
-    {
-        resetElectrode(electrodes[n]);
-    }
+    triggerEventsEnabled = enabled;
+}
 
-    return true;
+bool SpikeDetectorDynamic::getTriggerEventsEnabled()
+{
+    return triggerEventsEnabled;
 }
 
-void SpikeDetectorDynamic::addSpikeEvent(SpikeObject* s, MidiBuffer& eventBuffer, int peakIndex)
+void SpikeDetectorDynamic::setPipelinedMode(bool enabled)
 {
-    s->eventType = SPIKE_EVENT_CODE;
+    pipelinedMode = enabled;
+}
 
-    int numBytes = packSpike(s,                        // SpikeObject
-                             spikeBuffer,              // uint8_t*
-                             MAX_SPIKE_BUFFER_LEN);    // int
+bool SpikeDetectorDynamic::getPipelinedMode()
+{
+    return pipelinedMode;
+}
 
-    if (numBytes > 0)
-        eventBuffer.addEvent(spikeBuffer, numBytes, peakIndex);
+void SpikeDetectorDynamic::setFilterEnabled(bool enabled)
+{
+    filterEnabled = enabled;
 }
 
-void SpikeDetectorDynamic::addWaveformToSpikeObject(SpikeObject* s,
-                                             int& peakIndex,
-                                             int& electrodeNumber,
-                                             int& currentChannel,
-											 int dyn_threshold)
+bool SpikeDetectorDynamic::getFilterEnabled()
 {
-    int spikeLength = electrodes[electrodeNumber]->prePeakSamples + electrodes[electrodeNumber]->postPeakSamples;
-    s->timestamp = getTimestamp(currentChannel) + peakIndex;
-    s->nSamples = spikeLength;
+    return filterEnabled;
+}
 
-    int chan = *(electrodes[electrodeNumber]->channels+currentChannel);
+void SpikeDetectorDynamic::setFilterCutoffs(double lowCut, double highCut)
+{
+    filterLowCut = lowCut;
+    filterHighCut = highCut;
+}
 
-    s->gain[currentChannel] = (int)(1.0f / channels[chan]->bitVolts)*1000;
-	s->threshold[currentChannel] = dyn_threshold;
+void SpikeDetectorDynamic::setHealthCheckEnabled(bool enabled)
+{
+    healthCheckEnabled = enabled;
+}
 
-    if (isChannelActive(electrodeNumber, currentChannel))
-    {
-        for (int sample = 0; sample < spikeLength; sample++)
-        {
-            // warning -- be careful of bitvolts conversion
-            s->data[currentIndex] = uint16(getNextSample(*(electrodes[electrodeNumber]->channels+currentChannel)) / channels[chan]->bitVolts + 32768);
+bool SpikeDetectorDynamic::getHealthCheckEnabled()
+{
+    return healthCheckEnabled;
+}
 
-            currentIndex++;
-            sampleIndex++;
-        }
-    }
-    else
-    {
-        for (int sample = 0; sample < spikeLength; sample++)
-        {
-            // insert a blank spike if the
-            s->data[currentIndex] = 0;
-            currentIndex++;
-            sampleIndex++;
-        }
-    }
-    sampleIndex -= spikeLength; // reset sample index
+void SpikeDetectorDynamic::setWarmStartEnabled(bool enabled)
+{
+    warmStartEnabled = enabled;
 }
 
-void SpikeDetectorDynamic::handleEvent(int eventType, MidiMessage& event, int sampleNum)
+bool SpikeDetectorDynamic::getWarmStartEnabled()
 {
-    if (eventType == TIMESTAMP)
-    {
-        const uint8* dataptr = event.getRawData();
-        memcpy(&timestamp, dataptr + 4, 8); // remember to skip first four bytes
-    }
+    return warmStartEnabled;
 }
 
-void SpikeDetectorDynamic::process(AudioSampleBuffer& buffer,MidiBuffer& events)
+int SpikeDetectorDynamic::getChannelHealth(int inputChannel)
 {
-    // cycle through electrodes
-    SimpleElectrode* electrode;
-    dataBuffer = &buffer;
-    checkForEvents(events); // need to find any timestamp events before extracting spikes
+    if (channelHealth == nullptr || inputChannel < 0 || inputChannel >= getNumInputs())
+        return ChannelHealthy;
 
-    for (int i = 0; i < electrodes.size(); i++)
-    {
-        electrode = electrodes[i];
+    return channelHealth[inputChannel];
+}
 
-        // refresh buffer index for this electrode
-        sampleIndex = electrode->lastBufferIndex - 1; // subtract 1 to account for
-        // increment at start of getNextSample()
+int SpikeDetectorDynamic::getHealthChangeCount()
+{
+    return healthChangeCount.load();
+}
 
-        int nSamples = getNumSamples(*electrode->channels);
+void SpikeDetectorDynamic::setCompressedWaveforms(bool enabled)
+{
+    compressedWaveforms = enabled;
+}
 
-		// Compute dynamic thresholds
-		const int number_of_windows = (int)ceil((float)((nSamples + (overflowBufferSize / 2))) / window_size);
-		std::vector<std::vector<float> > dyn_thresholds;
-		dyn_thresholds.resize(electrode->numChannels);
-		for (int i = 0; i < electrode->numChannels; ++i)
-			dyn_thresholds[i].resize(number_of_windows);
+bool SpikeDetectorDynamic::getCompressedWaveforms()
+{
+    return compressedWaveforms;
+}
 
-		int window_number = 0;
-		int sample_counter = 0;
-		for (int chan = 0; chan < electrode->numChannels; chan++)
-		{
-			int currentChannel = *(electrode->channels + chan);
-			std::vector<float> temp_values(window_size);
+void SpikeDetectorDynamic::setTemplateFile(const File& file)
+{
+    sorter.setTemplateFile(file);
+}
 
-			while (samplesAvailable(nSamples))
-			{
-				sampleIndex++;
-				temp_values[sample_counter] = abs(getNextSample(currentChannel)) / scalar;
-				if (sample_counter == window_size - 1)
-				{
-					// Compute Threshold using values in 'temp_values'
-					std::sort(temp_values.begin(), temp_values.end());
-					float Threshold = float(*(electrode->thresholds + chan));
-					dyn_thresholds[chan][window_number] = Threshold * temp_values[floor((float)temp_values.size() / 2)];
-					window_number++;
-					sample_counter = 0;
-				}
-				else
-				{
-					sample_counter++;
-				}
-			}
-			// Check last window
-			if (sample_counter != 0)
-			{
-				// Remove empty elements from 'temp_values'
-				temp_values.erase(temp_values.begin() + sample_counter, temp_values.end());
-				// Compute Threshold using values in 'temp_values'
-				std::sort(temp_values.begin(), temp_values.end());
-				float Threshold = float(*(electrode->thresholds + chan));
-				dyn_thresholds[chan][window_number] = Threshold * temp_values[floor((float)temp_values.size() / 2)];
-			}
+void SpikeDetectorDynamic::setFeaturesEnabled(bool enabled)
+{
+    featuresEnabled = enabled;
+}
 
-			// Restart indexes
-			sampleIndex = electrode->lastBufferIndex - 1;
-			window_number = 0;
-			sample_counter = 0;
-		}
+bool SpikeDetectorDynamic::getFeaturesEnabled()
+{
+    return featuresEnabled;
+}
 
-        // cycle through samples
-        while (samplesAvailable(nSamples))
-        {
-            sampleIndex++;
-			// Check in which window is the sample located
-			if (sample_counter == window_size - 1)
-			{
-				window_number++;
-				sample_counter = 0;
-			}
-			else
-			{
-				sample_counter++;
-			}
-            // cycle through channels
-            for (int chan = 0; chan < electrode->numChannels; chan++)
-            {
-                if (*(electrode->isActive+chan))
-                {
-                    int currentChannel = *(electrode->channels+chan);
+void SpikeDetectorDynamic::setFeatureBasisFile(const File& file)
+{
+    featureBasisFile = file;
+}
 
-					if (abs(getNextSample(currentChannel)) > dyn_thresholds[chan][window_number]) // trigger spike
-                    {
-                        // find the peak
-                        int peakIndex = sampleIndex;
-						sampleIndex++;
-						while (abs(getCurrentSample(currentChannel)) < abs(getNextSample(currentChannel)))
-						{
-							sampleIndex++;		// Keep going until finding the largest point or peak
-						}
-						peakIndex = sampleIndex - 1;
-						float peak_amp = abs(getCurrentSample(currentChannel));
-
-						// check that there are no other peaks happening within num_samples (prePeakSamples + postPeakSamples)
-						int num_samples = electrode->prePeakSamples + electrode->postPeakSamples;
-						int current_test_sample = 1;
-						while (current_test_sample < num_samples)
-						{
-							if (peak_amp > abs(getNextSample(currentChannel)))
-							{
-								current_test_sample++;
-								sampleIndex++;
-							}
-							else
-							{
-								peakIndex = sampleIndex;
-								peak_amp = abs(getCurrentSample(currentChannel));
-								sampleIndex++;
-								current_test_sample = 1;
-							}
-						}
-
-						sampleIndex = peakIndex - (electrode->prePeakSamples - 1);
-
-                        SpikeObject newSpike;
-                        newSpike.timestamp = 0; //getTimestamp(currentChannel) + peakIndex;
-                        newSpike.timestamp_software = -1;
-                        newSpike.source = i;
-                        newSpike.nChannels = electrode->numChannels;
-                        newSpike.sortedId = 0;
-                        newSpike.electrodeID = electrode->electrodeID;
-                        newSpike.channel = 0;
-                        newSpike.samplingFrequencyHz = sampleRateForElectrode;
-
-                        currentIndex = 0;
-
-                        // package spikes;
-                        for (int channel = 0; channel < electrode->numChannels; channel++)
-                        {
-							addWaveformToSpikeObject(&newSpike, peakIndex, i, channel, int(floor(dyn_thresholds[chan][window_number])));
-                        }
-                        addSpikeEvent(&newSpike, events, peakIndex);
-
-                        // advance the sample index
-                        sampleIndex = peakIndex + electrode->postPeakSamples;
-                        break; // quit spike "for" loop
-                    } // end spike trigger
-
-                } // end if channel is active
-            } // end cycle through channels on electrode
-
-        } // end cycle through samples
-
-        electrode->lastBufferIndex = sampleIndex - nSamples; // should be negative
-
-        if (nSamples > overflowBufferSize)
-        {
-            for (int j = 0; j < electrode->numChannels; j++)
-            {
-				overflowBuffer.copyFrom(*electrode->channels+j, 0,buffer, *electrode->channels+j,nSamples-overflowBufferSize,overflowBufferSize);
-            }
-            useOverflowBuffer.set(i, true);
-        }
-        else
-        {
-            useOverflowBuffer.set(i, false);
-        }
+void SpikeDetectorDynamic::setSpikeStreamName(const String& name)
+{
+    spikeStreamName = name;
+}
 
-    } // end cycle through electrodes
+String SpikeDetectorDynamic::getSpikeStreamName()
+{
+    return spikeStreamName;
 }
 
-float SpikeDetectorDynamic::getNextSample(int& chan)
+void SpikeDetectorDynamic::setTracingEnabled(bool enabled)
 {
-    if (sampleIndex < 0)
-    {
-        int ind = overflowBufferSize + sampleIndex;
+    tracer.setEnabled(enabled);
+}
 
-        if (ind < overflowBuffer.getNumSamples())
-            return *overflowBuffer.getWritePointer(chan, ind);
-        else
-            return 0;
-    }
-    else
-    {
-        if (sampleIndex < dataBuffer->getNumSamples())
-            return *dataBuffer->getWritePointer(chan, sampleIndex);
-        else
-            return 0;
-    }
+bool SpikeDetectorDynamic::getTracingEnabled()
+{
+    return tracer.isEnabled();
 }
 
-float SpikeDetectorDynamic::getCurrentSample(int& chan)
+void SpikeDetectorDynamic::setCaptureFile(const File& file)
 {
-    if (sampleIndex < 1)
-    {
-        return *overflowBuffer.getWritePointer(chan, overflowBufferSize + sampleIndex - 1);
-    }
-    else
-    {
-        return *dataBuffer->getWritePointer(chan, sampleIndex - 1);
-    }
+    captureFile = file;
 }
 
-bool SpikeDetectorDynamic::samplesAvailable(int nSamples)
+const File& SpikeDetectorDynamic::getCaptureFile()
 {
-    if (sampleIndex > nSamples - overflowBufferSize/2)
+    return captureFile;
+}
+
+int SpikeDetectorDynamic::fillCaptureLayout()
+{
+    int numElectrodes = jmin(electrodes.size(), captureLayoutSize);
+
+    for (int i = 0; i < numElectrodes; i++)
     {
-        return false;
+        SimpleElectrode* electrode = electrodes[i];
+        CaptureElectrode& layout = captureLayout[i];
+
+        memset(&layout, 0, sizeof(layout));
+        layout.electrodeID = electrode->electrodeID;
+        layout.numChannels = electrode->numChannels;
+        layout.prePeakSamples = electrode->prePeakSamples;
+        layout.postPeakSamples = electrode->postPeakSamples;
+        layout.noiseEstimator = electrode->noiseEstimator;
+
+        for (int chan = 0; chan < jmin(electrode->numChannels, (int) CAPTURE_MAX_CHANNELS); chan++)
+        {
+            layout.channels[chan] = *(electrode->channels + chan);
+            layout.thresholds[chan] = float(*(electrode->thresholds + chan));
+            layout.isActive[chan] = *(electrode->isActive + chan) ? 1 : 0;
+        }
+    }
+
+    return numElectrodes;
+}
+
+void SpikeDetectorDynamic::setSimdLevel(int level)
+{
+    simdLevel = jlimit((int) SimdAuto, NumSimdLevels - 1, level);
+}
+
+int SpikeDetectorDynamic::getSimdLevel()
+{
+    return simdLevel;
+}
+
+int SpikeDetectorDynamic::getActiveSimdLevel()
+{
+    return kernels->level;
+}
+
+bool SpikeDetectorDynamic::writeTrace(const File& file)
+{
+    return tracer.writeChromeTrace(file);
+}
+
+void SpikeDetectorDynamic::setSpikeRateLimit(double maxRate, double burst)
+{
+    maxSpikeRate = jmax(maxRate, 0.0);
+    spikeBurst = jmax(burst, 1.0);
+}
+
+double SpikeDetectorDynamic::getSpikeRateLimit()
+{
+    return maxSpikeRate;
+}
+
+void SpikeDetectorDynamic::setCoincidenceRejection(int maxElectrodes, double windowMs)
+{
+    coincidenceElectrodes = jmax(maxElectrodes, 0);
+    coincidenceWindowMs = jmax(windowMs, 0.0);
+}
+
+int SpikeDetectorDynamic::getCoincidenceElectrodes()
+{
+    return coincidenceElectrodes;
+}
+
+void SpikeDetectorDynamic::setTimeBudget(double milliseconds)
+{
+    timeBudgetMs = jmax(0.0, milliseconds);
+}
+
+double SpikeDetectorDynamic::getTimeBudget()
+{
+    return timeBudgetMs;
+}
+
+int SpikeDetectorDynamic::getSheddingCount(int step)
+{
+    return step >= 0 && step < NumSheddingSteps ? sheddingCounts[step].load() : 0;
+}
+
+int SpikeDetectorDynamic::getPipelineCount(int type)
+{
+    if (! pipelineActive || detectionThread == nullptr)
+        return 0;
+
+    switch (type)
+    {
+        case LateBlocks:
+            return detectionThread->getNumLateBlocks();
+        case WaitingBlocks:
+            return detectionThread->getNumWaitingBlocks();
+        case InlineBlocks:
+            return detectionThread->getNumInlineBlocks();
+        default:
+            return 0;
+    }
+}
+
+double SpikeDetectorDynamic::getMeanTriggerLead()
+{
+    if (triggerLeadCount == 0)
+        return 0.0;
+
+    return double(triggerLeadSum) / double(triggerLeadCount);
+}
+
+void SpikeDetectorDynamic::setParameter(int parameterIndex, float newValue)
+{
+    if (parameterIndex == 99 && currentElectrode > -1)
+    {
+        *(electrodes[currentElectrode]->thresholds+currentChannelIndex) = newValue;
+    }
+    else if (parameterIndex == 98 && currentElectrode > -1)
+    {
+        if (newValue == 0.0f)
+            *(electrodes[currentElectrode]->isActive+currentChannelIndex) = false;
+        else
+            *(electrodes[currentElectrode]->isActive+currentChannelIndex) = true;
+    }
+
+    captureLayoutChanged = true;
+}
+
+bool SpikeDetectorDynamic::enable()
+{
+    sampleRateForElectrode = (uint16_t) getSampleRate();
+    triggerLeadSum = 0;
+    triggerLeadCount = 0;
+    triggerLeadMax = 0;
+    spikeTokensPerSample = maxSpikeRate / getSampleRate();
+    droppedSpikeCount = 0;
+    rejectedSpikeCount = 0;
+    compressedSpikeCount = 0;
+    compressedBytes = 0;
+    fullWidthBytes = 0;
+    compressionTicks = 0;
+
+    // noise tables are sized up front so that process() does not allocate
+    core.prepare(getNumInputs(), jmax(getBlockSize(), 8192));
+    core.setSampleRate(getSampleRate());
+
+    // the online estimators start again from the first window they see,
+    // unless they can continue from the levels of the last session
+    core.resetNoiseLevels();
+
+    // a noise level is reused for about a second at most
+    timeBudgetTicks = Time::secondsToHighResolutionTicks(timeBudgetMs / 1000.0);
+    noiseHoldBlocks = jmax(1, int(getSampleRate() / jmax(getBlockSize(), 1)));
+    core.setNoiseHoldBlocks(noiseHoldBlocks);
+
+    for (int step = 0; step < NumSheddingSteps; step++)
+        sheddingCounts[step] = 0;
+
+    kernels = &getSimdKernels(simdLevel);
+    core.setKernels(*kernels);
+    std::cout << "Using " << getSimdLevelName(kernels->level) << " detection kernels." << std::endl;
+
+    coincidenceWindow = jmax(1, roundToInt(coincidenceWindowMs * getSampleRate() / 1000.0));
+    prepareCandidates(jmax(getBlockSize(), 1024));
+
+    inputTimestamps.calloc(jmax(getNumInputs(), 1));
+    inputNumSamples.calloc(jmax(getNumInputs(), 1));
+
+    // filter state is kept per input channel across callbacks; in pipelined
+    // mode the audio thread filters, otherwise the noise pass of the core
+    filterActive = filterEnabled;
+    filterState.calloc(2 * jmax(getNumInputs(), 1));
+
+    if (! bandpass.setCutoffs(getSampleRate(), filterLowCut, filterHighCut) && filterActive)
+        std::cout << "Filter cutoffs above " << BandpassFilter::maxCutoffRatio * getSampleRate()
+                  << " Hz are lowered to it." << std::endl;
+    core.setFilter(filterActive && ! pipelinedMode ? &bandpass : nullptr);
+    core.resetSignal();
+
+    // stored levels only apply to data filtered the same way
+    if (warmStartEnabled)
+    {
+        int numRestored = restoreWarmNoiseLevels();
+
+        if (numRestored > 0)
+            std::cout << "Noise estimators of " << numRestored << " channels continue from the last session." << std::endl;
+    }
+
+    // every channel starts healthy and is checked in the first block, then
+    // about once per second
+    channelHealth.calloc(jmax(getNumInputs(), 1));
+    healthCheckInterval = jmax(1, int(getSampleRate() / jmax(getBlockSize(), 1)));
+    nextHealthCheck = blockCounter + 1;
+    healthChangeCount++;
+
+    sortingActive = sorter.getTemplateFile().getFullPathName().isNotEmpty();
+    sortedSpikeCount = 0;
+    classifiedSpikeCount = 0;
+
+    if (sortingActive)
+        sorter.startWatching();
+
+    featureExtractor.clearBases();
+
+    if (featuresEnabled && featureBasisFile.getFullPathName().isNotEmpty()
+        && ! featureExtractor.loadBases(featureBasisFile))
+        std::cout << "Could not read PCA bases from " << featureBasisFile.getFileName() << std::endl;
+
+    // reallocating is safe here: the editor reads the rings on the message thread too
+    recentSpikes.prepare(electrodes.size());
+
+    // the segment is kept across acquisitions so that readers can stay attached
+    if (spikeStreamName.isEmpty())
+    {
+        spikeStream.close();
+    }
+    else if (! spikeStream.isOpen() || spikeStream.getName() != spikeStreamName)
+    {
+        if (spikeStream.open(spikeStreamName))
+            std::cout << "Publishing spikes to shared memory " << spikeStreamName << std::endl;
+        else
+            CoreServices::sendStatusMessage("Could not create spike stream " + spikeStreamName);
+    }
+
+    if (captureFile.getFullPathName().isNotEmpty())
+    {
+        int numInputs = getNumInputs();
+        HeapBlock<float> bitVolts;
+        bitVolts.calloc(jmax(numInputs, 1));
+
+        for (int chan = 0; chan < jmin(numInputs, channels.size()); chan++)
+            bitVolts[chan] = channels[chan]->bitVolts;
+
+        captureLayoutSize = electrodes.size();
+        captureLayout.calloc(jmax(captureLayoutSize, 1));
+        captureLayoutChanged = false;
+
+        CaptureSettings settings;
+        memset(&settings, 0, sizeof(settings));
+        settings.simdLevel = kernels->level;
+        settings.filterEnabled = filterActive ? 1 : 0;
+        settings.pipelinedMode = pipelinedMode ? 1 : 0;
+        settings.healthCheckEnabled = healthCheckEnabled ? 1 : 0;
+        settings.warmStartEnabled = warmStartEnabled ? 1 : 0;
+        settings.filterLowCut = filterLowCut;
+        settings.filterHighCut = filterHighCut;
+        settings.maxSpikeRate = maxSpikeRate;
+        settings.spikeBurst = spikeBurst;
+        settings.coincidenceElectrodes = coincidenceElectrodes;
+        settings.numNoiseEstimators = NumNoiseEstimators;
+        settings.coincidenceWindowMs = coincidenceWindowMs;
+        settings.timeBudgetMs = timeBudgetMs;
+
+        // the levels restoreWarmNoiseLevels() handed to the core
+        HeapBlock<float> warmLevels;
+        warmLevels.calloc(NumNoiseEstimators * jmax(numInputs, 1));
+
+        if (warmStartEnabled && warmNoiseFiltered == filterActive)
+        {
+            for (int type = 0; type < NumNoiseEstimators; type++)
+            {
+                for (int chan = 0; chan < jmin(warmNoiseChannels, numInputs); chan++)
+                    warmLevels[type * numInputs + chan] = warmNoiseLevels[type * warmNoiseChannels + chan];
+            }
+        }
+
+        if (recorder.start(captureFile, getSampleRate(), numInputs, bitVolts, settings, warmLevels,
+                           captureLayout, fillCaptureLayout()))
+            std::cout << "Capturing detector input to " << captureFile.getFullPathName() << std::endl;
+        else
+            CoreServices::sendStatusMessage("Could not create capture file " + captureFile.getFileName());
+    }
+
+    pipelineActive = pipelinedMode;
+
+    if (pipelineActive)
+    {
+        if (detectionThread == nullptr)
+            detectionThread = new DetectionThread(this);
+
+        detectionThread->startDetection(getNumInputs(), jmax(getBlockSize(), 8192));
+    }
+
+    return true;
+}
+
+bool SpikeDetectorDynamic::disable()
+{
+    if (pipelineActive)
+    {
+        detectionThread->stopDetection();
+        pipelineActive = false;
+
+        std::cout << "Pipelined detection: " << detectionThread->getNumLateBlocks() << " late blocks, "
+                  << detectionThread->getNumWaitingBlocks() << " blocks waited for a slot, "
+                  << detectionThread->getNumInlineBlocks() << " blocks detected on the audio thread."
+                  << std::endl;
+    }
+
+    sorter.stopWatching();
+
+#if SPIKEDETECTOR_AUDIO_THREAD_GUARD
+    AudioThreadGuard::printReport();
+#endif
+
+    if (recorder.isRecording())
+    {
+        recorder.stop();
+        std::cout << "Captured " << recorder.getNumRecordedBlocks() << " blocks to "
+                  << recorder.getFile().getFullPathName() << " (" << recorder.getNumDroppedBlocks()
+                  << " dropped)." << std::endl;
+    }
+
+    if (tracer.isEnabled())
+    {
+        File file = traceFile.getFullPathName().isNotEmpty()
+                    ? traceFile
+                    : File::getSpecialLocation(File::userDocumentsDirectory).getChildFile("DynamicDetectorTrace.json");
+
+        if (writeTrace(file))
+            std::cout << "Wrote detector trace to " << file.getFullPathName() << std::endl;
+    }
+
+    if (triggerEventsEnabled && triggerLeadCount > 0)
+    {
+        double samplesToMs = 1000.0 / getSampleRate();
+        std::cout << "Trigger lead before the detected peak: mean " << getMeanTriggerLead() * samplesToMs
+                  << " ms, max " << triggerLeadMax * samplesToMs << " ms over "
+                  << triggerLeadCount << " spikes." << std::endl;
+    }
+
+    if (droppedSpikeCount > 0)
+        std::cout << "Spike rate limit dropped " << droppedSpikeCount << " spikes." << std::endl;
+
+    if (sortingActive && classifiedSpikeCount > 0)
+        std::cout << "Template sorter: " << sortedSpikeCount << " of " << classifiedSpikeCount
+                  << " spikes matched a template." << std::endl;
+
+    if (rejectedSpikeCount > 0)
+        std::cout << "Coincidence rejection removed " << rejectedSpikeCount << " spikes." << std::endl;
+
+    storeWarmNoiseLevels();
+
+    if (sheddingCounts[ReuseNoiseLevels] > 0)
+        std::cout << "Time budget: noise levels reused in " << sheddingCounts[ReuseNoiseLevels]
+                  << " blocks, thresholds held in " << sheddingCounts[HoldThresholds]
+                  << ", electrodes deferred in " << sheddingCounts[DeferElectrodes] << "." << std::endl;
+
+    if (compressedWaveforms && compressedSpikeCount > 0)
+    {
+        double seconds = Time::highResolutionTicksToSeconds(compressionTicks);
+        std::cout << "Waveform compression: " << compressedSpikeCount << " spikes, ratio "
+                  << double(fullWidthBytes) / double(jmax(compressedBytes, (int64) 1)) << ", "
+                  << (seconds > 0 ? double(fullWidthBytes) / seconds / 1.0e6 : 0.0)
+                  << " MB/s encoded." << std::endl;
+    }
+
+    for (int n = 0; n < electrodes.size(); n++)
+    {
+        resetElectrode(electrodes[n]);
+    }
+
+    return true;
+}
+
+void SpikeDetectorDynamic::storeWarmNoiseLevels()
+{
+    int numChannels = jmax(core.getNumChannels(), warmNoiseChannels);
+    bool isFiltered = filterActive;
+
+    // channels no electrode read in this session keep their older level, as
+    // long as it was measured on the same kind of data
+    Array<float> levels;
+    levels.insertMultiple(0, 0.0f, NumNoiseEstimators * numChannels);
+
+    for (int type = 0; type < NumNoiseEstimators; type++)
+    {
+        for (int chan = 0; chan < numChannels; chan++)
+        {
+            float level = core.getLastNoiseLevel(chan, type);
+
+            if (level > 0)
+                levels.set(type * numChannels + chan, level);
+            else if (chan < warmNoiseChannels && warmNoiseFiltered == isFiltered)
+                levels.set(type * numChannels + chan, warmNoiseLevels[type * warmNoiseChannels + chan]);
+        }
+    }
+
+    warmNoiseLevels.swapWith(levels);
+    warmNoiseChannels = numChannels;
+    warmNoiseFiltered = isFiltered;
+}
+
+int SpikeDetectorDynamic::restoreWarmNoiseLevels()
+{
+    // levels of raw data say nothing about filtered data, and vice versa
+    if (warmNoiseFiltered != filterActive)
+        return 0;
+
+    int numRestored = 0;
+
+    for (int chan = 0; chan < jmin(warmNoiseChannels, core.getNumChannels()); chan++)
+    {
+        bool isRestored = false;
+
+        for (int type = 0; type < NumNoiseEstimators; type++)
+        {
+            if (core.warmStart(chan, type, warmNoiseLevels[type * warmNoiseChannels + chan]))
+                isRestored = true;
+        }
+
+        if (isRestored)
+            numRestored++;
+    }
+
+    return numRestored;
+}
+
+void SpikeDetectorDynamic::updateSheddingLevel()
+{
+    int64 elapsed = Time::getHighResolutionTicks() - detectionStartTicks;
+    int level = NoShedding;
+
+    if (elapsed * 10 >= timeBudgetTicks * 9)
+        level = DeferElectrodes;
+    else if (elapsed * 4 >= timeBudgetTicks * 3)
+        level = HoldThresholds;
+    else if (elapsed * 2 >= timeBudgetTicks)
+        level = ReuseNoiseLevels;
+
+    // each step is counted once per block
+    for (; sheddingLevel < level; sheddingLevel++)
+        sheddingCounts[sheddingLevel + 1]++;
+}
+
+void SpikeDetectorDynamic::filterInputs(AudioSampleBuffer& buffer)
+{
+    int numChannels = jmin(getNumInputs(), buffer.getNumChannels());
+
+    for (int chan = 0; chan < numChannels; chan++)
+    {
+        float* data = buffer.getWritePointer(chan);
+        int nSamples = jmin(getNumSamples(chan), buffer.getNumSamples());
+        BiquadState* state = filterState + 2 * chan;
+
+        for (int n = 0; n < nSamples; n++)
+            data[n] = bandpass.processSample(data[n], state);
+    }
+}
+
+void SpikeDetectorDynamic::checkChannelHealth(int chan)
+{
+    const float* data = dataBuffer->getReadPointer(chan);
+    int nSamples = jmin(dataBuffer->getNumSamples(), blockNumSamples[chan]);
+
+    if (nSamples < window_size)
+        return; // not enough data to tell, keep the previous status
+
+    // the ADC range follows from the resolution of the channel (16-bit samples)
+    float bitVolts = chan < channels.size() ? channels[chan]->bitVolts : 0.0f;
+    float fullScale = bitVolts * 32767.0f;
+    float railLevel = fullScale * 0.98f;
+
+    float minimum = data[0];
+    float maximum = data[0];
+    int numClipped = 0;
+
+    for (int i = 0; i < nSamples; i++)
+    {
+        float sample = data[i];
+        minimum = jmin(minimum, sample);
+        maximum = jmax(maximum, sample);
+
+        if (std::abs(sample) >= railLevel)
+            numClipped++;
+    }
+
+    // noise level of the first window, as used for the thresholds
+    kernels->absCopy(windowValues, data, window_size);
+
+    float noiseLevel = getMedian(windowValues, window_size) / madScale;
+    float flatLevel = jmax(bitVolts, 1.0e-6f);
+
+    uint8 health = ChannelHealthy;
+
+    if (bitVolts > 0 && numClipped > nSamples / 100)
+        health = ChannelSaturated;
+    else if (noiseLevel < 0.5f * flatLevel || maximum - minimum <= 2.0f * flatLevel)
+        health = ChannelFlat;
+    else if (bitVolts > 0 && noiseLevel > 0.1f * fullScale)
+        health = ChannelFloating;
+
+    if (health != channelHealth[chan])
+    {
+        channelHealth[chan] = health;
+        healthChangeCount++;
+    }
+}
+
+void SpikeDetectorDynamic::addSpikeEvent(SpikeObject* s, MidiBuffer& eventBuffer, int peakIndex,
+                                         const float* features)
+{
+    s->eventType = SPIKE_EVENT_CODE;
+
+    // external consumers get the spike straight away, before it is packed
+    spikeStream.publish(s);
+
+    int numBytes;
+
+    if (compressedWaveforms)
+    {
+        int64 startTicks = Time::getHighResolutionTicks();
+        numBytes = packCompressedSpike(s, spikeBuffer, MAX_SPIKE_BUFFER_LEN);
+        compressionTicks += Time::getHighResolutionTicks() - startTicks;
+
+        compressedSpikeCount++;
+        compressedBytes += numBytes;
+        fullWidthBytes += getFullWidthSpikeSize(s);
     }
     else
     {
+        numBytes = packSpike(s,                        // SpikeObject
+                             spikeBuffer,              // uint8_t*
+                             MAX_SPIKE_BUFFER_LEN);    // int
+    }
+
+    if (numBytes > 0)
+    {
+        if (features != nullptr)
+            numBytes = FeatureExtractor::appendFeatures(features, spikeBuffer, numBytes, MAX_SPIKE_BUFFER_LEN);
+
+        eventBuffer.addEvent(spikeBuffer, numBytes, peakIndex);
+    }
+}
+
+void SpikeDetectorDynamic::addTriggerEvent(MidiBuffer& eventBuffer,
+                                           SimpleElectrode* e,
+                                           int chan,
+                                           int crossingIndex,
+                                           int nSamples)
+{
+    // crossings found in the overflow region belong to the previous buffer,
+    // so they are reported at the start of this one
+    int sampleNum = jlimit(0, jmax(nSamples - 1, 0), crossingIndex);
+    int inputChannel = *(e->channels + chan);
+
+    // payload: int64 timestamp of the crossing, uint16 electrode ID, uint16 channel
+    uint8 data[12];
+    int64 crossingTimestamp = blockTimestamps[inputChannel] + crossingIndex;
+    uint16 electrodeID = uint16(e->electrodeID);
+    uint16 channel = uint16(chan);
+    memcpy(data, &crossingTimestamp, 8);
+    memcpy(data + 8, &electrodeID, 2);
+    memcpy(data + 10, &channel, 2);
+
+    addEvent(eventBuffer, TTL, sampleNum, 1, uint8(triggerChannelIndex), 12, data);
+    addEvent(eventBuffer, TTL, jmin(sampleNum + 1, jmax(nSamples - 1, 0)), 0, uint8(triggerChannelIndex), 12, data);
+}
+
+void SpikeDetectorDynamic::addOverflowEvent(MidiBuffer& eventBuffer,
+                                            int sampleNum,
+                                            int nSamples,
+                                            int64 firstTimestamp,
+                                            int64 lastTimestamp,
+                                            int numDropped,
+                                            int numElectrodes)
+{
+    sampleNum = jlimit(0, jmax(nSamples - 1, 0), sampleNum);
+
+    // payload: int64 timestamps of the first and last dropped spike,
+    // uint32 number of dropped spikes, uint16 number of electrodes over the cap
+    uint8 data[22];
+    uint32 dropped = uint32(numDropped);
+    uint16 electrodeCount = uint16(numElectrodes);
+    memcpy(data, &firstTimestamp, 8);
+    memcpy(data + 8, &lastTimestamp, 8);
+    memcpy(data + 16, &dropped, 4);
+    memcpy(data + 20, &electrodeCount, 2);
+
+    addEvent(eventBuffer, TTL, sampleNum, 1, uint8(overflowChannelIndex), 22, data);
+    addEvent(eventBuffer, TTL, jmin(sampleNum + 1, jmax(nSamples - 1, 0)), 0, uint8(overflowChannelIndex), 22, data);
+}
+
+void SpikeDetectorDynamic::addWaveformToSpikeObject(SpikeObject* s,
+                                             int& peakIndex,
+                                             int& electrodeNumber,
+                                             int& currentChannel,
+											 int dyn_threshold)
+{
+    int spikeLength = electrodes[electrodeNumber]->prePeakSamples + electrodes[electrodeNumber]->postPeakSamples;
+    s->timestamp = blockTimestamps[currentChannel] + peakIndex;
+    s->nSamples = spikeLength;
+
+    int chan = *(electrodes[electrodeNumber]->channels+currentChannel);
+
+    s->gain[currentChannel] = (int)(1.0f / channels[chan]->bitVolts)*1000;
+	s->threshold[currentChannel] = dyn_threshold;
+
+    if (isChannelActive(electrodeNumber, currentChannel)
+        && sampleIndex >= 0 && sampleIndex + spikeLength <= dataBuffer->getNumSamples())
+    {
+        // the whole waveform lies within the block
+        kernels->packWaveform(s->data + currentIndex, dataBuffer->getReadPointer(chan, sampleIndex),
+                              spikeLength, channels[chan]->bitVolts);
+        currentIndex += spikeLength;
+        sampleIndex += spikeLength;
+    }
+    else if (isChannelActive(electrodeNumber, currentChannel))
+    {
+        for (int sample = 0; sample < spikeLength; sample++)
+        {
+            // warning -- be careful of bitvolts conversion
+            s->data[currentIndex] = uint16(core.getSample(chan, sampleIndex) / channels[chan]->bitVolts + 32768);
+
+            currentIndex++;
+            sampleIndex++;
+        }
+    }
+    else
+    {
+        for (int sample = 0; sample < spikeLength; sample++)
+        {
+            // insert a blank spike if the
+            s->data[currentIndex] = 0;
+            currentIndex++;
+            sampleIndex++;
+        }
+    }
+    sampleIndex -= spikeLength; // reset sample index
+}
+
+void SpikeDetectorDynamic::handleEvent(int eventType, MidiMessage& event, int sampleNum)
+{
+    if (eventType == TIMESTAMP)
+    {
+        const uint8* dataptr = event.getRawData();
+        memcpy(&timestamp, dataptr + 4, 8); // remember to skip first four bytes
+    }
+}
+
+void SpikeDetectorDynamic::process(AudioSampleBuffer& buffer,MidiBuffer& events)
+{
+    AUDIO_THREAD_SCOPE
+
+    tracer.begin(PhaseTracer::CheckForEvents);
+    checkForEvents(events); // need to find any timestamp events before extracting spikes
+    tracer.end(PhaseTracer::CheckForEvents);
+
+    for (int i = 0; i < getNumInputs(); i++)
+    {
+        inputTimestamps[i] = getTimestamp(i);
+        inputNumSamples[i] = getNumSamples(i);
+    }
+
+    // captured before the filter changes the buffer in place
+    if (recorder.isRecording())
+    {
+        if (captureLayoutChanged.exchange(false))
+            recorder.recordLayout(captureLayout, fillCaptureLayout());
+
+        recorder.recordBlock(buffer, getNumInputs(), inputTimestamps, inputNumSamples);
+    }
+
+    if (pipelineActive)
+    {
+        // the filtered signal must reach the rest of the chain, so it cannot
+        // be left to the detection thread, which works on a copy
+        if (filterActive)
+            filterInputs(buffer);
+
+        // emits the spikes of the previous block and queues this one
+        detectionThread->pushBlock(buffer, events, inputTimestamps, inputNumSamples);
+        return;
+    }
+
+    detectSpikes(buffer, events, inputTimestamps, inputNumSamples);
+}
+
+void SpikeDetectorDynamic::detectSpikes(AudioSampleBuffer& buffer, MidiBuffer& events,
+                                        const int64* timestamps, const int* numSamples)
+{
+    // cycle through electrodes
+    SimpleElectrode* electrode;
+    dataBuffer = &buffer;
+    blockTimestamps = timestamps;
+    blockNumSamples = numSamples;
+    blockCounter++;
+
+    sheddingLevel = NoShedding;
+
+    if (timeBudgetTicks > 0)
+        detectionStartTicks = Time::getHighResolutionTicks();
+
+    core.prepare(getNumInputs(), buffer.getNumSamples());
+    core.beginBlock(buffer.getArrayOfWritePointers(), numSamples,
+                    jmin(getNumInputs(), buffer.getNumChannels()), buffer.getNumSamples());
+
+    // the health check looks at the raw samples, so it runs before the noise
+    // pass filters them
+    if (healthCheckEnabled && blockCounter >= nextHealthCheck)
+    {
+        int numChannels = jmin(core.getNumChannels(), buffer.getNumChannels(), getNumInputs());
+
+        for (int chan = 0; chan < numChannels; chan++)
+            checkChannelHealth(chan);
+
+        nextHealthCheck = blockCounter + healthCheckInterval;
+    }
+
+    prepareCandidates(buffer.getNumSamples());
+
+    // picks up templates reloaded in the background
+    if (sortingActive)
+        sorter.prepareBlock();
+    numCandidates = 0;
+
+    numDropped = 0;
+    numLimitedElectrodes = 0;
+    lastLimitedElectrode = -1;
+    scanEvents = &events;
+
+    for (int i = 0; i < electrodes.size(); i++)
+    {
+        electrode = electrodes[i];
+
+        int nSamples = blockNumSamples[*electrode->channels];
+
+        if (maxSpikeRate > 0)
+            electrode->spikeTokens = jmin(spikeBurst, electrode->spikeTokens + spikeTokensPerSample * nSamples);
+
+        if (timeBudgetTicks > 0)
+            updateSheddingLevel();
+
+        // electrodes nobody listens to resume with the next block; the others
+        // may keep the thresholds of their last scan for about a second
+        bool isDeferred = sheddingLevel >= DeferElectrodes && ! electrode->isMonitored;
+        bool holdThresholds = sheddingLevel >= HoldThresholds && electrode->heldNoiseBlock >= 0
+                              && blockCounter - electrode->heldNoiseBlock <= noiseHoldBlocks;
+
+		// Dynamic thresholds: the noise level of each window is shared by all
+		// electrodes reading the same input channel, and scaled here by the
+		// threshold of this electrode channel
+		// Channels that are inactive or failed the health check are skipped.
+		ElectrodeScan scan;
+		scan.numChannels = electrode->numChannels;
+		scan.prePeakSamples = electrode->prePeakSamples;
+		scan.postPeakSamples = electrode->postPeakSamples;
+
+		tracer.begin(PhaseTracer::ThresholdPass, i);
+		for (int chan = 0; chan < electrode->numChannels; chan++)
+		{
+			int currentChannel = *(electrode->channels + chan);
+
+			scan.channels[chan] = currentChannel;
+			scan.thresholds[chan] = float(*(electrode->thresholds + chan));
+			scan.lastWindow[chan] = core.getLastWindow(currentChannel);
+			scan.tileMaxima[chan] = nullptr;
+
+			if (isDeferred || ! *(electrode->isActive + chan)
+				|| (healthCheckEnabled && channelHealth[currentChannel] != ChannelHealthy))
+			{
+				scan.noiseLevels[chan] = nullptr; // still filtered below
+			}
+			else if (holdThresholds && electrode->heldNoiseLevels[chan] >= 0)
+			{
+				// the block must still be filtered for the scan and the chain
+				core.filterChannel(currentChannel);
+
+				scan.noiseLevels[chan] = electrode->heldNoiseLevels + chan;
+				scan.lastWindow[chan] = 0; // no tile maxima either
+			}
+			else
+			{
+				scan.noiseLevels[chan] = core.getNoiseLevels(currentChannel, electrode->noiseEstimator,
+				                                             sheddingLevel >= ReuseNoiseLevels);
+				scan.tileMaxima[chan] = core.getTileMaxima(currentChannel, electrode->noiseEstimator);
+
+				// held from the last full window, not from the few samples the
+				// last one may hold
+				int lastFullWindow = core.getLastFullWindow(currentChannel);
+
+				if (lastFullWindow >= 0 || electrode->heldNoiseLevels[chan] < 0)
+					electrode->heldNoiseLevels[chan] = scan.noiseLevels[chan][jmax(lastFullWindow, 0)];
+			}
+		}
+
+		if (sheddingLevel == NoShedding)
+			electrode->heldNoiseBlock = blockCounter;
+		tracer.end(PhaseTracer::ThresholdPass, i);
+
+        // peaks come back through peakFound()
+        tracer.begin(PhaseTracer::DetectionScan, i);
+        scanIndex = i;
+        electrode->lastBufferIndex = core.scanElectrode(scan, electrode->lastBufferIndex, *this);
+        tracer.end(PhaseTracer::DetectionScan, i);
+
+    } // end cycle through electrodes
+
+    // every input channel reaches the chain filtered, including the ones no
+    // electrode scanned in this block; before packing, so that waveforms of
+    // channels that were not scanned are filtered too
+    for (int chan = 0; chan < jmin(core.getNumChannels(), buffer.getNumChannels()); chan++)
+        core.filterChannel(chan);
+
+    if (coincidenceElectrodes > 0)
+        rejectCoincidentSpikes();
+
+    // artifacts are rejected before the rate limit, so they take no tokens.
+    // The overflow tails still hold the end of the previous block, so peaks
+    // found in the overflow region can be packed too
+    for (int n = 0; n < numCandidates; n++)
+    {
+        if (! candidates[n].isRejected && takeSpikeToken(candidates[n]))
+            addSpikeFromCandidate(candidates[n], events);
+    }
+
+    if (numDropped > 0)
+    {
+        addOverflowEvent(events, firstDroppedIndex, buffer.getNumSamples(), firstDroppedTimestamp,
+                         lastDroppedTimestamp, numDropped, numLimitedElectrodes);
+        droppedSpikeCount += numDropped;
+    }
+
+    {
+        PhaseTracer::Scope overflowScope(tracer, PhaseTracer::OverflowCopy);
+        core.endBlock();
+    }
+}
+
+void SpikeDetectorDynamic::peakFound(int chan, int crossingIndex, int peakIndex, float threshold)
+{
+    // waveforms are packed once every electrode has been scanned, so that
+    // coincident peaks can be rejected first
+    SpikeCandidate candidate;
+    candidate.electrode = scanIndex;
+    candidate.peakIndex = peakIndex;
+    candidate.crossingIndex = crossingIndex;
+    candidate.channel = chan;
+    candidate.threshold = int(floor(threshold));
+    candidate.isRejected = false;
+
+    if (numCandidates < candidateCapacity)
+    {
+        candidates[numCandidates++] = candidate;
+    }
+    else if (takeSpikeToken(candidate))
+    {
+        addSpikeFromCandidate(candidate, *scanEvents); // no room left: not tested
+    }
+}
+
+bool SpikeDetectorDynamic::takeSpikeToken(const SpikeCandidate& candidate)
+{
+    if (maxSpikeRate <= 0)
         return true;
+
+    SimpleElectrode* electrode = electrodes[candidate.electrode];
+
+    if (electrode->spikeTokens >= 1.0)
+    {
+        electrode->spikeTokens -= 1.0;
+        return true;
+    }
+
+    // over the rate cap: the dead time was still skipped, but the spike is
+    // only counted for the overflow event
+    int64 droppedTimestamp = blockTimestamps[*electrode->channels] + candidate.peakIndex;
+
+    if (numDropped == 0)
+    {
+        firstDroppedIndex = candidate.peakIndex;
+        firstDroppedTimestamp = droppedTimestamp;
     }
+
+    // candidates are grouped by electrode
+    if (candidate.electrode != lastLimitedElectrode)
+    {
+        lastLimitedElectrode = candidate.electrode;
+        numLimitedElectrodes++;
+    }
+
+    lastDroppedTimestamp = droppedTimestamp;
+    numDropped++;
+    return false;
 }
 
-void SpikeDetectorDynamic::saveCustomParametersToXml(XmlElement* parentElement)
+void SpikeDetectorDynamic::addSpikeFromCandidate(const SpikeCandidate& candidate, MidiBuffer& events)
+{
+    int i = candidate.electrode;
+    int peakIndex = candidate.peakIndex;
+    SimpleElectrode* electrode = electrodes[i];
+
+    PhaseTracer::Scope packingScope(tracer, PhaseTracer::SpikePacking, i);
+
+    // the trigger marks accepted spikes only: coincident peaks and those over
+    // the rate limit never get here
+    if (triggerEventsEnabled)
+        addTriggerEvent(events, electrode, candidate.channel, candidate.crossingIndex,
+                        blockNumSamples[*electrode->channels]);
+
+    sampleIndex = peakIndex - (electrode->prePeakSamples - 1);
+
+    SpikeObject newSpike;
+    newSpike.timestamp = 0; //getTimestamp(currentChannel) + peakIndex;
+    newSpike.timestamp_software = -1;
+    newSpike.source = i;
+    newSpike.nChannels = electrode->numChannels;
+    newSpike.sortedId = 0;
+    newSpike.electrodeID = electrode->electrodeID;
+    newSpike.channel = 0;
+    newSpike.samplingFrequencyHz = sampleRateForElectrode;
+
+    currentIndex = 0;
+
+    // package spikes;
+    for (int channel = 0; channel < electrode->numChannels; channel++)
+    {
+        addWaveformToSpikeObject(&newSpike, peakIndex, i, channel, candidate.threshold);
+    }
+
+    if (sortingActive)
+    {
+        newSpike.sortedId = uint16(sorter.classify(&newSpike));
+        classifiedSpikeCount++;
+
+        if (newSpike.sortedId != 0)
+            sortedSpikeCount++;
+    }
+
+    float bitVolts[MAX_NUMBER_OF_SPIKE_CHANNELS];
+
+    for (int channel = 0; channel < jmin(electrode->numChannels, MAX_NUMBER_OF_SPIKE_CHANNELS); channel++)
+        bitVolts[channel] = channels[*(electrode->channels + channel)]->bitVolts;
+
+    recentSpikes.add(i, &newSpike, bitVolts);
+
+    if (featuresEnabled)
+    {
+        featureExtractor.computeFeatures(&newSpike, electrode->prePeakSamples - 1, spikeFeatures);
+        addSpikeEvent(&newSpike, events, peakIndex, spikeFeatures);
+    }
+    else
+    {
+        addSpikeEvent(&newSpike, events, peakIndex);
+    }
+
+    if (triggerEventsEnabled)
+    {
+        // how much earlier in the signal the trigger marked this spike
+        int lead = peakIndex - candidate.crossingIndex;
+        triggerLeadSum += lead;
+        triggerLeadCount++;
+        triggerLeadMax = jmax(triggerLeadMax, lead);
+    }
+}
+
+void SpikeDetectorDynamic::prepareCandidates(int nSamples)
 {
+    // consecutive spikes of an electrode are at least its dead time apart
+    int minSpacing = core.getTailSize();
+
     for (int i = 0; i < electrodes.size(); i++)
+        minSpacing = jmin(minSpacing, electrodes[i]->postPeakSamples + 1);
+
+    int scanLength = nSamples + core.getTailSize();
+    int capacity = electrodes.size() * (scanLength / jmax(minSpacing, 1) + 1);
+
+    // only grows during acquisition if a block is longer than anticipated in enable()
+    if (capacity > candidateCapacity)
+    {
+        candidateCapacity = capacity;
+        candidates.malloc(candidateCapacity);
+        candidateOrder.malloc(candidateCapacity);
+    }
+
+    if (scanLength + 1 > numPeakCounts)
+    {
+        numPeakCounts = scanLength + 1;
+        peakCounts.calloc(numPeakCounts);
+    }
+
+    if (electrodes.size() > numElectrodeCounts)
+    {
+        numElectrodeCounts = electrodes.size();
+        electrodeCounts.calloc(numElectrodeCounts);
+    }
+}
+
+void SpikeDetectorDynamic::rejectCoincidentSpikes()
+{
+    // the candidates are sorted by peak with a counting sort over the samples
+    // of the scan, and a window of coincidenceWindow samples on either side
+    // of each peak slides over them, counting the distinct electrodes inside
+    // it. Both passes are linear in the number of candidates.
+    int tailSize = core.getTailSize();
+    int lastPeak = numPeakCounts - 2;
+
+    for (int n = 0; n < numCandidates; n++)
+        peakCounts[jlimit(0, lastPeak, candidates[n].peakIndex + tailSize) + 1]++;
+
+    // peakCounts[p] becomes the first position of peak p in candidateOrder;
+    // only the entries up to the last peak are touched, and cleared below
+    int lastUsedPeak = 0;
+
+    for (int n = 0; n < numCandidates; n++)
+        lastUsedPeak = jmax(lastUsedPeak, jlimit(0, lastPeak, candidates[n].peakIndex + tailSize));
+
+    for (int p = 1; p <= lastUsedPeak + 1; p++)
+        peakCounts[p] += peakCounts[p - 1];
+
+    // in scan order, so the candidates of a peak keep their electrode order
+    for (int n = 0; n < numCandidates; n++)
+        candidateOrder[peakCounts[jlimit(0, lastPeak, candidates[n].peakIndex + tailSize)]++] = n;
+
+    int window = jmax(coincidenceWindow, 1);
+    int first = 0;
+    int end = 0;
+    int numElectrodes = 0;
+    int numRejected = 0;
+
+    for (int n = 0; n < numCandidates; n++)
+    {
+        int peak = candidates[candidateOrder[n]].peakIndex;
+
+        while (end < numCandidates && candidates[candidateOrder[end]].peakIndex <= peak + window)
+        {
+            if (electrodeCounts[candidates[candidateOrder[end]].electrode]++ == 0)
+                numElectrodes++;
+            end++;
+        }
+
+        while (candidates[candidateOrder[first]].peakIndex < peak - window)
+        {
+            if (--electrodeCounts[candidates[candidateOrder[first]].electrode] == 0)
+                numElectrodes--;
+            first++;
+        }
+
+        if (numElectrodes > coincidenceElectrodes)
+        {
+            candidates[candidateOrder[n]].isRejected = true;
+            numRejected++;
+        }
+    }
+
+    for (int n = first; n < end; n++)
+        electrodeCounts[candidates[candidateOrder[n]].electrode] = 0;
+
+    for (int p = 0; p <= lastUsedPeak + 1; p++)
+        peakCounts[p] = 0;
+
+    rejectedSpikeCount += numRejected;
+}
+
+void SpikeDetectorDynamic::saveCustomParametersToXml(XmlElement* parentElement)
+{
+    // large layouts can be kept in a binary sidecar instead of one element per channel
+    if (electrodeMapFile.getFullPathName().isNotEmpty() && writeElectrodeMap(electrodeMapFile))
     {
-        XmlElement* electrodeNode = parentElement->createNewChildElement("ELECTRODE");
-        electrodeNode->setAttribute("name", electrodes[i]->name);
-        electrodeNode->setAttribute("numChannels", electrodes[i]->numChannels);
-        electrodeNode->setAttribute("prePeakSamples", electrodes[i]->prePeakSamples);
-        electrodeNode->setAttribute("postPeakSamples", electrodes[i]->postPeakSamples);
-        electrodeNode->setAttribute("electrodeID", electrodes[i]->electrodeID);
+        XmlElement* mapNode = parentElement->createNewChildElement("ELECTRODE_MAP");
+        mapNode->setAttribute("file", electrodeMapFile.getFullPathName());
+        mapNode->setAttribute("numElectrodes", electrodes.size());
+    }
+    else
+    {
+        for (int i = 0; i < electrodes.size(); i++)
+        {
+            XmlElement* electrodeNode = parentElement->createNewChildElement("ELECTRODE");
+            electrodeNode->setAttribute("name", electrodes[i]->name);
+            electrodeNode->setAttribute("numChannels", electrodes[i]->numChannels);
+            electrodeNode->setAttribute("prePeakSamples", electrodes[i]->prePeakSamples);
+            electrodeNode->setAttribute("postPeakSamples", electrodes[i]->postPeakSamples);
+            electrodeNode->setAttribute("electrodeID", electrodes[i]->electrodeID);
+            electrodeNode->setAttribute("noiseEstimator", getNoiseEstimatorName(electrodes[i]->noiseEstimator));
+
+            for (int j = 0; j < electrodes[i]->numChannels; j++)
+            {
+                XmlElement* channelNode = electrodeNode->createNewChildElement("SUBCHANNEL");
+                channelNode->setAttribute("ch",*(electrodes[i]->channels+j));
+                channelNode->setAttribute("thresh",*(electrodes[i]->thresholds+j));
+                channelNode->setAttribute("isActive",*(electrodes[i]->isActive+j));
+            }
+        }
+    }
+
+    XmlElement* detectorNode = parentElement->createNewChildElement("DETECTOR");
+    detectorNode->setAttribute("triggerEvents", triggerEventsEnabled);
+    detectorNode->setAttribute("pipelined", pipelinedMode);
+    detectorNode->setAttribute("maxSpikeRate", maxSpikeRate);
+    detectorNode->setAttribute("spikeBurst", spikeBurst);
+    detectorNode->setAttribute("coincidenceElectrodes", coincidenceElectrodes);
+    detectorNode->setAttribute("coincidenceWindow", coincidenceWindowMs);
+    detectorNode->setAttribute("timeBudget", timeBudgetMs);
+    detectorNode->setAttribute("electrodeMapFile", electrodeMapFile.getFullPathName());
+    detectorNode->setAttribute("filter", filterEnabled);
+    detectorNode->setAttribute("filterLowCut", filterLowCut);
+    detectorNode->setAttribute("filterHighCut", filterHighCut);
+    detectorNode->setAttribute("healthCheck", healthCheckEnabled);
+    detectorNode->setAttribute("compressWaveforms", compressedWaveforms);
+    detectorNode->setAttribute("spikeStream", spikeStreamName);
+    detectorNode->setAttribute("templateFile", sorter.getTemplateFile().getFullPathName());
+    detectorNode->setAttribute("features", featuresEnabled);
+    detectorNode->setAttribute("featureBasisFile", featureBasisFile.getFullPathName());
+    detectorNode->setAttribute("simdLevel", getSimdLevelName(simdLevel));
+    detectorNode->setAttribute("captureFile", captureFile.getFullPathName());
+    detectorNode->setAttribute("tracing", tracer.isEnabled());
+    detectorNode->setAttribute("traceFile", traceFile.getFullPathName());
+    detectorNode->setAttribute("warmStart", warmStartEnabled);
+
+    // one list of levels per estimator, indexed by input channel
+    if (warmNoiseChannels > 0)
+    {
+        XmlElement* noiseNode = parentElement->createNewChildElement("NOISE_LEVELS");
+        noiseNode->setAttribute("numChannels", warmNoiseChannels);
+        noiseNode->setAttribute("filtered", warmNoiseFiltered);
 
-        for (int j = 0; j < electrodes[i]->numChannels; j++)
+        for (int type = 0; type < NumNoiseEstimators; type++)
         {
-            XmlElement* channelNode = electrodeNode->createNewChildElement("SUBCHANNEL");
-            channelNode->setAttribute("ch",*(electrodes[i]->channels+j));
-            channelNode->setAttribute("thresh",*(electrodes[i]->thresholds+j));
-            channelNode->setAttribute("isActive",*(electrodes[i]->isActive+j));
+            StringArray levels;
+
+            for (int chan = 0; chan < warmNoiseChannels; chan++)
+                levels.add(String(warmNoiseLevels[type * warmNoiseChannels + chan]));
+
+            noiseNode->setAttribute(getNoiseEstimatorName(type), levels.joinIntoString(" "));
         }
     }
 }
@@ -560,40 +1744,103 @@ void SpikeDetectorDynamic::loadCustomParametersFromXml()
         // use parametersAsXml to restore state
 		SpikeDetectorDynamicEditor* sde = (SpikeDetectorDynamicEditor*)getEditor();
 
-        int electrodeIndex = -1;
+        // collect the whole electrode map first, so that it is applied in one
+        // pass with a single editor refresh and signal chain update
+        Array<ElectrodeConfig> configs;
+
         forEachXmlChildElement(*parametersAsXml, xmlNode)
         {
             if (xmlNode->hasTagName("ELECTRODE"))
             {
-                electrodeIndex++;
-                std::cout << "ELECTRODE>>>" << std::endl;
-
-                int channelsPerElectrode = xmlNode->getIntAttribute("numChannels");
-                int electrodeID = xmlNode->getIntAttribute("electrodeID");
-
-                sde->addElectrode(channelsPerElectrode, electrodeID);
-
-                setElectrodeName(electrodeIndex+1, xmlNode->getStringAttribute("name"));
-                sde->refreshElectrodeList();
-
-                int channelIndex = -1;
+                ElectrodeConfig config;
+                config.name = xmlNode->getStringAttribute("name");
+                config.electrodeID = xmlNode->getIntAttribute("electrodeID");
+                config.noiseEstimator = getNoiseEstimatorType(xmlNode->getStringAttribute("noiseEstimator").toRawUTF8());
 
                 forEachXmlChildElement(*xmlNode, channelNode)
                 {
                     if (channelNode->hasTagName("SUBCHANNEL"))
                     {
-                        channelIndex++;
+                        config.channels.add(channelNode->getIntAttribute("ch"));
+                        config.thresholds.add(channelNode->getDoubleAttribute("thresh"));
+                        config.isActive.add(channelNode->getBoolAttribute("isActive"));
+                    }
+                }
 
-                        std::cout << "Subchannel " << channelIndex << std::endl;
+                configs.add(config);
+            }
+            else if (xmlNode->hasTagName("ELECTRODE_MAP"))
+            {
+                File mapFile(xmlNode->getStringAttribute("file"));
 
-                        setChannel(electrodeIndex, channelIndex, channelNode->getIntAttribute("ch"));
-                        setChannelThreshold(electrodeIndex, channelIndex, channelNode->getDoubleAttribute("thresh"));
-                        setChannelActive(electrodeIndex, channelIndex, channelNode->getBoolAttribute("isActive"));
-                    }
+                if (readElectrodeMap(mapFile, configs))
+                    setElectrodeMapFile(mapFile);
+                else
+                    CoreServices::sendStatusMessage("Could not read electrode map " + mapFile.getFileName());
+            }
+            else if (xmlNode->hasTagName("DETECTOR"))
+            {
+                setTriggerEventsEnabled(xmlNode->getBoolAttribute("triggerEvents", false));
+                setPipelinedMode(xmlNode->getBoolAttribute("pipelined", false));
+                setSpikeRateLimit(xmlNode->getDoubleAttribute("maxSpikeRate", 0.0),
+                                  xmlNode->getDoubleAttribute("spikeBurst", 10.0));
+                setCoincidenceRejection(xmlNode->getIntAttribute("coincidenceElectrodes", 0),
+                                        xmlNode->getDoubleAttribute("coincidenceWindow", 0.2));
+                setTimeBudget(xmlNode->getDoubleAttribute("timeBudget", 0.0));
+
+                String mapFile = xmlNode->getStringAttribute("electrodeMapFile");
+
+                if (mapFile.isNotEmpty())
+                    setElectrodeMapFile(File(mapFile));
+
+                setFilterEnabled(xmlNode->getBoolAttribute("filter", false));
+                setFilterCutoffs(xmlNode->getDoubleAttribute("filterLowCut", 300.0),
+                                 xmlNode->getDoubleAttribute("filterHighCut", 6000.0));
+
+                setHealthCheckEnabled(xmlNode->getBoolAttribute("healthCheck", false));
+                setCompressedWaveforms(xmlNode->getBoolAttribute("compressWaveforms", false));
+                setSpikeStreamName(xmlNode->getStringAttribute("spikeStream"));
+
+                if (xmlNode->getStringAttribute("templateFile").isNotEmpty())
+                    setTemplateFile(File(xmlNode->getStringAttribute("templateFile")));
+
+                setFeaturesEnabled(xmlNode->getBoolAttribute("features", false));
+
+                if (xmlNode->getStringAttribute("featureBasisFile").isNotEmpty())
+                    setFeatureBasisFile(File(xmlNode->getStringAttribute("featureBasisFile")));
+
+                setSimdLevel(getSimdLevelType(xmlNode->getStringAttribute("simdLevel", "auto").toRawUTF8()));
+
+                if (xmlNode->getStringAttribute("captureFile").isNotEmpty())
+                    setCaptureFile(File(xmlNode->getStringAttribute("captureFile")));
+
+                setTracingEnabled(xmlNode->getBoolAttribute("tracing", false));
+
+                if (xmlNode->getStringAttribute("traceFile").isNotEmpty())
+                    traceFile = File(xmlNode->getStringAttribute("traceFile"));
+
+                setWarmStartEnabled(xmlNode->getBoolAttribute("warmStart", true));
+            }
+            else if (xmlNode->hasTagName("NOISE_LEVELS"))
+            {
+                warmNoiseChannels = jmax(0, xmlNode->getIntAttribute("numChannels"));
+                warmNoiseFiltered = xmlNode->getBoolAttribute("filtered");
+                warmNoiseLevels.clearQuick();
+                warmNoiseLevels.insertMultiple(0, 0.0f, NumNoiseEstimators * warmNoiseChannels);
+
+                for (int type = 0; type < NumNoiseEstimators; type++)
+                {
+                    StringArray levels;
+                    levels.addTokens(xmlNode->getStringAttribute(getNoiseEstimatorName(type)), false);
+
+                    for (int chan = 0; chan < jmin(levels.size(), warmNoiseChannels); chan++)
+                        warmNoiseLevels.set(type * warmNoiseChannels + chan, levels[chan].getFloatValue());
                 }
             }
         }
+
+        applyElectrodeMap(configs);
+        sde->refreshElectrodeList();
         sde->checkSettings();
     }
 }
-
@@ -4,6 +4,15 @@
 
 #include <ProcessorHeaders.h>
 #include "SpikeDetectorDynamicEditor.h"
+#include "DetectionThread.h"
+#include "PhaseTracer.h"
+#include "DetectorCore.h"
+#include "WaveformCodec.h"
+#include "SpikeStreamWriter.h"
+#include "BlockRecorder.h"
+#include "RecentSpikeBuffer.h"
+#include "TemplateSorter.h"
+#include "FeatureExtractor.h"
 #include <SpikeLib.h>
 
 struct SimpleElectrode
@@ -17,19 +26,72 @@ struct SimpleElectrode
     int electrodeID;
     int sourceNodeId;
 
+    /** NoiseEstimatorType used for the dynamic thresholds of this electrode. */
+    int noiseEstimator;
+
+    /** Token bucket of the spike rate limit. */
+    double spikeTokens;
+
+    /** Noise level of the last window of each channel, kept for the blocks
+        over the time budget (negative until the first scan). */
+    HeapBlock<float> heldNoiseLevels;
+    int64 heldNoiseBlock;
+
     HeapBlock<int> channels;
     HeapBlock<double> thresholds;
     HeapBlock<bool> isActive;
 
 };
 
+/** Settings of one electrode, used to apply a whole electrode map at once. */
+struct ElectrodeConfig
+{
+    ElectrodeConfig() : electrodeID(0), noiseEstimator(MedianNoise) {}
+
+    String name;
+    int electrodeID;
+    int noiseEstimator;
+
+    Array<int> channels;
+    Array<double> thresholds;
+    Array<bool> isActive;
+};
+
+/** Status of an input channel, from the periodic health check. */
+enum ChannelHealth
+{
+    ChannelHealthy = 0,
+    ChannelFlat,        // no noise: disconnected or dead
+    ChannelSaturated,   // railed at the ADC limit
+    ChannelFloating     // noise far above any neural signal
+};
+
+/** Steps taken when detection approaches its time budget, in this order. */
+enum LoadShedding
+{
+    NoShedding = 0,
+    ReuseNoiseLevels,   // channels keep the noise level of a previous block
+    HoldThresholds,     // electrodes keep their last thresholds, noise tables are not read
+    DeferElectrodes,    // electrodes that are not monitored skip the block
+    NumSheddingSteps
+};
+
+/** What happened to blocks in pipelined mode, counted since acquisition started. */
+enum PipelineCount
+{
+    LateBlocks = 0,     // spikes emitted more than one block late
+    WaitingBlocks,      // the audio thread waited for a free slot
+    InlineBlocks        // longer than the slots, detected on the audio thread
+};
+
 class SpikeDetectorDynamicEditor;
 
 /**
   Detects spikes in a continuous signal using dynamic thresholds and outputs events containing the spike data.
 */
 
-class SpikeDetectorDynamic : public GenericProcessor
+class SpikeDetectorDynamic : public GenericProcessor,
+                             private DetectorCore::Listener
 {
 public:
     // CONSTRUCTOR AND DESTRUCTOR //
@@ -59,13 +121,6 @@ public:
     /** Creates the SpikeDetectorEditor. */
     AudioProcessorEditor* createEditor();
 
-
-    // INTERNAL BUFFERS //
-
-    /** Extra samples are placed in this buffer to allow seamless
-        transitions between callbacks. */
-    AudioSampleBuffer overflowBuffer;
-
     // CREATE AND DELETE ELECTRODES //
 
     /** Adds an electrode with n channels to be processed. */
@@ -74,6 +129,21 @@ public:
     /** Removes an electrode with a given index. */
     bool removeElectrode(int index);
 
+    /** Replaces all electrodes with the given layout in a single pass. The caller
+        is responsible for refreshing the editor and the signal chain once. */
+    void applyElectrodeMap(const Array<ElectrodeConfig>& configs);
+
+    /** Saves the electrode layout to this binary file instead of the settings XML
+        (useful for very large layouts). An empty File keeps it in the XML. */
+    void setElectrodeMapFile(const File& file);
+
+    bool writeElectrodeMap(const File& file);
+
+    /** Appends the electrodes stored in a binary electrode map to configs.
+        Adds nothing and returns false if any part of the file is cut short,
+        out of range for the current inputs, or left over at its end. */
+    bool readElectrodeMap(const File& file, Array<ElectrodeConfig>& configs);
+
     // EDIT AND QUERY ELECTRODE SETTINGS //
 
     /** Returns the number of channels for a given electrode. */
@@ -100,6 +170,11 @@ public:
     /** Returns a StringArray containing the names of all electrodes */
     StringArray getElectrodeNames();
 
+    int getNumElectrodes();
+
+    /** Returns the name of the electrode with a given index. */
+    String getElectrodeName(int index);
+
     /** Returns array of electrodes. */
 	void getElectrodes(Array<SimpleElectrode*>& electrodeArray);
 
@@ -116,26 +191,208 @@ public:
 
     double getChannelThreshold(int electrodeNum, int channelNum);
 
+    /** Selects the noise estimator (a NoiseEstimatorType) used for the dynamic
+        thresholds of an electrode; cheaper estimators can be used on less
+        critical electrodes. */
+    void setNoiseEstimator(int electrodeNum, int type);
+
+    int getNoiseEstimator(int electrodeNum);
+
+    /** Enables a TTL event at the sample where the threshold is crossed,
+        before the peak at which the full waveform event is placed (for
+        closed-loop use). */
+    void setTriggerEventsEnabled(bool enabled);
+
+    bool getTriggerEventsEnabled();
+
+    /** Runs detection on a dedicated thread, one block behind the signal chain.
+        Takes effect the next time acquisition starts. */
+    void setPipelinedMode(bool enabled);
+
+    bool getPipelinedMode();
+
+    /** A PipelineCount of the current acquisition; 0 when not pipelined. */
+    int getPipelineCount(int type);
+
+    /** Band-pass filters every input channel in place, in the same pass that
+        computes the noise levels of the scanned ones. Takes effect the next
+        time acquisition starts. */
+    void setFilterEnabled(bool enabled);
+
+    bool getFilterEnabled();
+
+    /** In Hz; cutoffs above 0.45 times the sample rate are lowered to it when
+        acquisition starts. */
+    void setFilterCutoffs(double lowCut, double highCut);
+
+    /** Checks the input channels about once per second and leaves flat,
+        saturated and floating ones out of detection until they recover.
+        Off by default. */
+    void setHealthCheckEnabled(bool enabled);
+
+    bool getHealthCheckEnabled();
+
+    /** Starts the running noise estimators of each input channel from the
+        level it had when acquisition last stopped (also kept in the settings
+        file), instead of from the first window of the session. Takes effect
+        the next time acquisition starts. */
+    void setWarmStartEnabled(bool enabled);
+
+    bool getWarmStartEnabled();
+
+    /** Returns the ChannelHealth of an input channel. */
+    int getChannelHealth(int inputChannel);
+
+    /** Incremented whenever the health of an input channel changes, so the
+        editor only has to refresh when something happened. */
+    int getHealthChangeCount();
+
+    /** The last waveforms of each electrode, which the editor draws during
+        acquisition. Read it from the message thread only. */
+    const RecentSpikeBuffer& getRecentSpikes() const { return recentSpikes; }
+
+    /** Emits spikes in the compact encoding of WaveformCodec.h instead of
+        packSpike(). Downstream processors must be able to decode
+        COMPRESSED_SPIKE_EVENT_CODE events. */
+    void setCompressedWaveforms(bool enabled);
+
+    bool getCompressedWaveforms();
+
+    /** Classifies spikes against the templates in this file (see TemplateSorter)
+        and sets their sortedId. The file is reloaded in the background when it
+        changes during acquisition. An empty File turns sorting off. */
+    void setTemplateFile(const File& file);
+
+    /** Appends a feature vector (PCA projections, peak and trough amplitudes
+        and widths, see FeatureExtractor) to every spike event and fills its
+        pcProj. */
+    void setFeaturesEnabled(bool enabled);
+
+    bool getFeaturesEnabled();
+
+    /** PCA bases for the feature projections, read when acquisition starts.
+        Without a basis file the projections are zero. */
+    void setFeatureBasisFile(const File& file);
+
+    /** Also publishes every spike into the named POSIX shared-memory ring (see
+        SpikeStreamWriter); an empty name turns it off. Takes effect the next
+        time acquisition starts. */
+    void setSpikeStreamName(const String& name);
+
+    String getSpikeStreamName();
+
+    /** Records begin/end marks of each phase of process() (see PhaseTracer). */
+    void setTracingEnabled(bool enabled);
+
+    bool getTracingEnabled();
+
+    /** Captures the input of process() (samples, block sizes, timestamps and
+        electrode settings) to this file while acquiring, for offline replay
+        with tools/replay (see BlockRecorder). An empty File turns it off.
+        Takes effect the next time acquisition starts. */
+    void setCaptureFile(const File& file);
+
+    const File& getCaptureFile();
+
+    /** Forces the instruction set of the detection kernels (a SimdLevel, see
+        SimdKernels.h) for comparisons and benchmarks; SimdAuto picks the best
+        one the CPU supports. Levels the CPU lacks fall back to the next lower
+        one. Takes effect the next time acquisition starts. */
+    void setSimdLevel(int level);
+
+    int getSimdLevel();
+
+    /** The level of the kernels in use, once acquisition has started. */
+    int getActiveSimdLevel();
+
+    /** Writes the phases recorded so far as Chrome trace JSON. */
+    bool writeTrace(const File& file);
+
+    /** Caps the number of spikes each electrode can emit (token bucket of
+        maxRate spikes per second, holding up to burst spikes). Spikes over the
+        cap are dropped and summarised in one "Spike overflow" event per block.
+        A rate of 0 disables the limit. */
+    void setSpikeRateLimit(double maxRate, double burst);
+
+    double getSpikeRateLimit();
+
+    /** Rejects peaks that occur on more than maxElectrodes electrodes within
+        windowMs of each other (artifacts), before their waveforms are packed
+        and before they count against the spike rate limit. 0 disables the
+        rejection. Takes effect the next time acquisition starts. */
+    void setCoincidenceRejection(int maxElectrodes, double windowMs);
+
+    int getCoincidenceElectrodes();
+
+    /** Limits the time detection may take per block. When a block uses half of
+        it, noise levels not computed yet are reused from a previous block; at
+        three quarters, electrodes keep their last thresholds; at 90%, electrodes
+        that are not monitored skip the rest of the block. Noise levels are
+        never reused for more than about a second. 0 disables the budget. */
+    void setTimeBudget(double milliseconds);
+
+    double getTimeBudget();
+
+    /** Number of blocks that reached a LoadShedding step since acquisition
+        started. */
+    int getSheddingCount(int step);
+
+    /** Mean number of samples by which a threshold-crossing trigger precedes
+        the detected peak of the same spike (the peak minus the crossing). Both
+        events leave the detector in the same block, once the spike has been
+        accepted, so this is not a processing latency; it is how much earlier
+        in the signal the trigger marks the spike. */
+    double getMeanTriggerLead();
+
     void saveCustomParametersToXml(XmlElement* parentElement);
     void loadCustomParametersFromXml();
 
 private:
+    friend class DetectionThread;
+
+    /** Extracts spikes from a block. Runs on the audio thread, or on the
+        detection thread in pipelined mode. */
+    void detectSpikes(AudioSampleBuffer& buffer, MidiBuffer& events,
+                      const int64* timestamps, const int* numSamples);
+
     /** Pointer to a continuous buffer. */
     AudioSampleBuffer* dataBuffer;
 
+    /** Timestamps and sample counts of the block being detected, per input channel. */
+    const int64* blockTimestamps;
+    const int* blockNumSamples;
+
+    HeapBlock<int64> inputTimestamps;
+    HeapBlock<int> inputNumSamples;
+
+    ScopedPointer<DetectionThread> detectionThread;
+    bool pipelinedMode;
+    bool pipelineActive;
+
     float getDefaultThreshold();
 
-    int overflowBufferSize;
+    /** Noise levels, filter, threshold scan and overflow tails, shared with
+        the C API. */
+    DetectorCore core;
 
-    int sampleIndex;
+    /** Turns the peaks of the electrode being scanned into candidates. */
+    void peakFound(int chan, int crossingIndex, int peakIndex, float threshold) override;
 
-    Array<int> electrodeCounter;
+    /** The electrode being scanned, for peakFound(). */
+    int scanIndex;
+    MidiBuffer* scanEvents;
+
+    /** Spikes dropped by the rate limit in the current block, reported in one event. */
+    int numDropped;
+    int numLimitedElectrodes;
+    int lastLimitedElectrode;
+    int firstDroppedIndex;
+    int64 firstDroppedTimestamp;
+    int64 lastDroppedTimestamp;
 
-    float getNextSample(int& chan);
-    float getCurrentSample(int& chan);
-    bool samplesAvailable(int nSamples);
+    int sampleIndex;
 
-    Array<bool> useOverflowBuffer;
+    Array<int> electrodeCounter;
 
     int currentElectrode;
     int currentChannelIndex;
@@ -149,7 +406,53 @@ private:
 
     void handleEvent(int eventType, MidiMessage& event, int sampleNum);
 
-    void addSpikeEvent(SpikeObject* s, MidiBuffer& eventBuffer, int peakIndex);
+    void addSpikeEvent(SpikeObject* s, MidiBuffer& eventBuffer, int peakIndex,
+                       const float* features = nullptr);
+    void addTriggerEvent(MidiBuffer& eventBuffer, SimpleElectrode* e, int chan,
+                         int crossingIndex, int nSamples);
+    void addOverflowEvent(MidiBuffer& eventBuffer, int sampleNum, int nSamples,
+                          int64 firstTimestamp, int64 lastTimestamp,
+                          int numDropped, int numElectrodes);
+    /** A detected peak whose waveform has not been packed yet. */
+    struct SpikeCandidate
+    {
+        int electrode;
+        int peakIndex;
+        int crossingIndex;
+        int channel;        // electrode channel that crossed the threshold
+        int threshold;
+        bool isRejected;
+    };
+
+    /** Makes sure a block of nSamples cannot produce more candidates than fit. */
+    void prepareCandidates(int nSamples);
+
+    /** Marks the candidates of this block that coincide on too many electrodes. */
+    void rejectCoincidentSpikes();
+
+    /** Takes a token of the rate limit for the candidate; if there is none,
+        counts it for the overflow event and returns false. */
+    bool takeSpikeToken(const SpikeCandidate& candidate);
+
+    void addSpikeFromCandidate(const SpikeCandidate& candidate, MidiBuffer& events);
+
+    HeapBlock<SpikeCandidate> candidates;
+    int numCandidates;
+    int candidateCapacity;
+
+    /** Candidates per peak sample, counted to sort candidateOrder by peak. */
+    HeapBlock<int> peakCounts;
+    int numPeakCounts;
+    HeapBlock<int> candidateOrder;
+
+    /** Candidates of each electrode inside the coincidence window. */
+    HeapBlock<int> electrodeCounts;
+    int numElectrodeCounts;
+    int coincidenceElectrodes;
+    double coincidenceWindowMs;
+    int coincidenceWindow;
+    int64 rejectedSpikeCount;
+
     void addWaveformToSpikeObject(SpikeObject* s,
                                   int& peakIndex,
                                   int& electrodeNumber,
@@ -157,10 +460,116 @@ private:
 								  int dyn_threshold);
 
     void resetElectrode(SimpleElectrode*);
+
+    /** Allocates an electrode with default settings, mapped to inputs 0..nChans-1. */
+    SimpleElectrode* createElectrode(int nChans, int electrodeID);
+
+    File electrodeMapFile;
+
+    int64 blockCounter;
+
+    /** Raises sheddingLevel from the time spent in the current block. */
+    void updateSheddingLevel();
+
+    double timeBudgetMs;
+    int64 timeBudgetTicks;
+    int64 detectionStartTicks;
+    int sheddingLevel;
+    int noiseHoldBlocks;
+    std::atomic<int> sheddingCounts[NumSheddingSteps];
+
+    /** Scratch space for |x| of one window of the health check. */
+    HeapBlock<float> windowValues;
+
+    /** Kernels of the health check and the waveform packing, picked in
+        enable() together with the ones of the core. */
+    const SimdKernels* kernels;
+    int simdLevel;
+
+    /** Filters every input channel on the audio thread, used in pipelined mode
+        where detection only sees a copy of the buffer (the core filters in all
+        other cases). */
+    void filterInputs(AudioSampleBuffer& buffer);
+
+    BandpassFilter bandpass;
+    HeapBlock<BiquadState> filterState;
+    bool filterEnabled;
+    bool filterActive;
+    double filterLowCut;
+    double filterHighCut;
+
+    PhaseTracer tracer;
+    File traceFile;
+
+    /** Copies the electrode settings into captureLayout; returns their number. */
+    int fillCaptureLayout();
+
+    BlockRecorder recorder;
+    File captureFile;
+    HeapBlock<CaptureElectrode> captureLayout;
+    int captureLayoutSize;
+    std::atomic<bool> captureLayoutChanged;
+
+    /** Classifies an input channel from its samples in the current block. */
+    void checkChannelHealth(int chan);
+
+    bool healthCheckEnabled;
+    HeapBlock<uint8> channelHealth;
+    std::atomic<int> healthChangeCount;
+    int healthCheckInterval;
+    int64 nextHealthCheck;
+
+    /** Keeps the last noise level of each estimator and input channel when
+        acquisition stops. */
+    void storeWarmNoiseLevels();
+
+    /** Seeds the estimator states from the stored levels; returns the number
+        of input channels that were seeded. */
+    int restoreWarmNoiseLevels();
+
+    /** Noise level per estimator and input channel (index estimatorType *
+        warmNoiseChannels + chan), 0 if unknown, and whether it was measured
+        on filtered data. */
+    bool warmStartEnabled;
+    Array<float> warmNoiseLevels;
+    int warmNoiseChannels;
+    bool warmNoiseFiltered;
+
+    TemplateSorter sorter;
+    bool sortingActive;
+    int64 sortedSpikeCount;
+    int64 classifiedSpikeCount;
+
+    FeatureExtractor featureExtractor;
+    bool featuresEnabled;
+    File featureBasisFile;
+    HeapBlock<float> spikeFeatures;
+
+    SpikeStreamWriter spikeStream;
+    String spikeStreamName;
+
+    RecentSpikeBuffer recentSpikes;
+
+    bool compressedWaveforms;
+    int64 compressedSpikeCount;
+    int64 compressedBytes;
+    int64 fullWidthBytes;
+    int64 compressionTicks;
     
     uint16_t sampleRateForElectrode;
 	int window_size;
-	float scalar = 0.6745f;
+
+    bool triggerEventsEnabled;
+    int triggerChannelIndex;
+    int64 triggerLeadSum;
+    int64 triggerLeadCount;
+    int triggerLeadMax;
+
+    double maxSpikeRate;
+    double spikeBurst;
+    double spikeTokensPerSample;
+    int overflowChannelIndex;
+    int64 droppedSpikeCount;
 
 	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SpikeDetectorDynamic);
 };
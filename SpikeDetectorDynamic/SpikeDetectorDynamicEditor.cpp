@@ -4,7 +4,7 @@
 #include <stdio.h>
 
 SpikeDetectorDynamicEditor::SpikeDetectorDynamicEditor(GenericProcessor* parentNode, bool useDefaultParameterEditors = true)
-    : GenericEditor(parentNode, useDefaultParameterEditors), isPlural(true)
+    : GenericEditor(parentNode, useDefaultParameterEditors), selectedElectrode(-1), lastHealthChangeCount(-1), isPlural(true)
 
 {
 	int silksize;
@@ -13,7 +13,7 @@ SpikeDetectorDynamicEditor::SpikeDetectorDynamicEditor(GenericProcessor* parentN
     Typeface::Ptr typeface = new CustomTypeface(mis);
     font = Font(typeface);
 
-    desiredWidth = 300;
+    desiredWidth = 550;
 
     electrodeTypes = new ComboBox("Electrode Types");
 
@@ -32,13 +32,29 @@ SpikeDetectorDynamicEditor::SpikeDetectorDynamicEditor(GenericProcessor* parentN
     electrodeTypes->setSelectedId(2);
     addAndMakeVisible(electrodeTypes);
 
-    electrodeList = new ComboBox("Electrode List");
-    electrodeList->setEditableText(false);
-    electrodeList->setJustificationType(Justification::centredLeft);
-    electrodeList->addListener(this);
-    electrodeList->setBounds(15,75,115,20);
+    electrodeName = new Label("Electrode Name", "");
+    electrodeName->setEditable(false);
+    electrodeName->addListener(this);
+    electrodeName->setBounds(15,75,115,20);
+    addAndMakeVisible(electrodeName);
+
+    electrodeSearch = new TextEditor("Electrode Search");
+    electrodeSearch->setTextToShowWhenEmpty("search", Colours::grey);
+    electrodeSearch->addListener(this);
+    electrodeSearch->setBounds(285,30,120,16);
+    addAndMakeVisible(electrodeSearch);
+
+    // only the visible rows are drawn, however many electrodes there are
+    electrodeList = new ListBox("Electrode List", this);
+    electrodeList->setRowHeight(14);
+    electrodeList->setOutlineThickness(1);
+    electrodeList->setBounds(285,50,120,70);
     addAndMakeVisible(electrodeList);
 
+    waveformDisplay = new SpikeWaveformDisplay();
+    waveformDisplay->setBounds(415,30,125,75);
+    addAndMakeVisible(waveformDisplay);
+
     numElectrodes = new Label("Number of Electrodes","1");
     numElectrodes->setEditable(true);
     numElectrodes->addListener(this);
@@ -96,6 +112,23 @@ SpikeDetectorDynamicEditor::SpikeDetectorDynamicEditor(GenericProcessor* parentN
     thresholdLabel->setColour(Label::textColourId, Colours::grey);
     addAndMakeVisible(thresholdLabel);
 
+    sheddingLabel = new Label("Load Shedding", "");
+    sheddingLabel->setFont(font);
+    sheddingLabel->setBounds(413, 106, 130, 15);
+    sheddingLabel->setColour(Label::textColourId, Colours::grey);
+    sheddingLabel->setTooltip("Blocks over the detection time budget: noise levels reused / "
+                              "thresholds held / electrodes deferred. In pipelined mode, blocks "
+                              "whose spikes were late / waited for a free slot / were detected "
+                              "on the audio thread");
+    addAndMakeVisible(sheddingLabel);
+
+    simdLabel = new Label("SIMD Level", "");
+    simdLabel->setFont(font);
+    simdLabel->setBounds(15, 95, 115, 15);
+    simdLabel->setColour(Label::textColourId, Colours::grey);
+    simdLabel->setTooltip("Instruction set of the detection kernels in use (simdLevel)");
+    addAndMakeVisible(simdLabel);
+
     channelSelector->inactivateButtons();
     channelSelector->paramButtonsToggledByDefault(false);
 }
@@ -123,7 +156,7 @@ void SpikeDetectorDynamicEditor::sliderEvent(Slider* slider)
     if (electrodeNum > -1)
     {
 		SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
-        processor->setChannelThreshold(electrodeList->getSelectedItemIndex(),
+        processor->setChannelThreshold(selectedElectrode,
                                        electrodeNum,
                                        slider->getValue());
     }
@@ -145,7 +178,7 @@ void SpikeDetectorDynamicEditor::buttonEvent(Button* button)
 			SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
 
             thresholdSlider->setActive(true);
-            thresholdSlider->setValue(processor->getChannelThreshold(electrodeList->getSelectedItemIndex(),
+            thresholdSlider->setValue(processor->getChannelThreshold(selectedElectrode,
                                                                      electrodeButtons.indexOf((ElectrodeButton*) button)));
         }
         else
@@ -153,7 +186,7 @@ void SpikeDetectorDynamicEditor::buttonEvent(Button* button)
 			SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
 
             ElectrodeButton* eb = (ElectrodeButton*) button;
-            int electrodeNum = electrodeList->getSelectedItemIndex();
+            int electrodeNum = selectedElectrode;
             int channelNum = electrodeButtons.indexOf(eb);
 
             processor->setChannelActive(electrodeNum,
@@ -248,10 +281,9 @@ void SpikeDetectorDynamicEditor::buttonEvent(Button* button)
             thresholdSlider->setActive(false);
 
             // This will be -1 with nothing selected
-            int selectedItemIndex = electrodeList->getSelectedItemIndex();
-            if (selectedItemIndex != -1)
+            if (selectedElectrode != -1)
             {
-                drawElectrodeButtons(selectedItemIndex);
+                drawElectrodeButtons(selectedElectrode);
             }
             else
             {
@@ -301,7 +333,8 @@ void SpikeDetectorDynamicEditor::buttonEvent(Button* button)
             CoreServices::sendStatusMessage("Stop acquisition before deleting electrodes.");
             return;
         }
-        removeElectrode(electrodeList->getSelectedItemIndex());
+        if (selectedElectrode != -1)
+            removeElectrode(selectedElectrode);
 
 		CoreServices::updateSignalChain(this);
 		CoreServices::highlightEditor(this);
@@ -316,6 +349,7 @@ void SpikeDetectorDynamicEditor::channelChanged(int channel, bool /*newState*/)
     {
         //std::cout << "New channel: " << chan << std::endl;
 
+        // only the selected electrode channel changes, so only its button is repainted
         for (int i = 0; i < electrodeButtons.size(); i++)
         {
             if (electrodeButtons[i]->getToggleState())
@@ -324,7 +358,7 @@ void SpikeDetectorDynamicEditor::channelChanged(int channel, bool /*newState*/)
                 electrodeButtons[i]->repaint();
 
 				SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
-                processor->setChannel(electrodeList->getSelectedItemIndex(),
+                processor->setChannel(selectedElectrode,
                                       i,
                                       channel - 1);
             }
@@ -334,25 +368,63 @@ void SpikeDetectorDynamicEditor::channelChanged(int channel, bool /*newState*/)
 
 void SpikeDetectorDynamicEditor::refreshElectrodeList()
 {
-    electrodeList->clear();
+	SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
 
+    updateVisibleElectrodes();
+    selectElectrode(processor->getNumElectrodes() - 1);
+}
+
+void SpikeDetectorDynamicEditor::updateVisibleElectrodes()
+{
 	SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
-    StringArray electrodeNames = processor->getElectrodeNames();
+    String searchText = electrodeSearch->getText().trim();
 
-    for (int i = 0; i < electrodeNames.size(); i++)
+    visibleElectrodes.clearQuick();
+
+    for (int i = 0; i < processor->getNumElectrodes(); i++)
     {
-        electrodeList->addItem(electrodeNames[i], electrodeList->getNumItems()+1);
+        if (searchText.isEmpty() || processor->getElectrodeName(i).containsIgnoreCase(searchText))
+            visibleElectrodes.add(i);
     }
 
-    if (electrodeList->getNumItems() > 0)
-    {
-        electrodeList->setSelectedId(electrodeList->getNumItems(), sendNotification);
-        electrodeList->setText(electrodeList->getItemText(electrodeList->getNumItems()-1));
-        lastId = electrodeList->getNumItems();
-        electrodeList->setEditableText(true);
+    electrodeList->updateContent();
+}
+
+void SpikeDetectorDynamicEditor::selectElectrode(int index)
+{
+	SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
+
+    if (index < 0 || index >= processor->getNumElectrodes())
+        index = -1;
+
+    selectedElectrode = index;
+
+    // selecting the row calls selectedRowsChanged(), which ignores the
+    // electrode that is already selected
+    int row = visibleElectrodes.indexOf(index);
+
+    if (row >= 0)
+        electrodeList->selectRow(row);
+    else
+        electrodeList->deselectAllRows();
 
-        drawElectrodeButtons(electrodeList->getNumItems()-1);
+    thresholdSlider->setActive(false);
+    waveformDisplay->update(processor->getRecentSpikes(), index);
+
+    if (index == -1)
+    {
+        electrodeButtons.clear();
+        electrodeName->setText("", dontSendNotification);
+        electrodeName->setEditable(false);
+        return;
     }
+
+    SimpleElectrode* e = processor->setCurrentElectrodeIndex(index);
+    electrodeEditorButtons[1]->setToggleState(e->isMonitored, dontSendNotification);
+    electrodeName->setText(e->name, dontSendNotification);
+    electrodeName->setEditable(true);
+
+    drawElectrodeButtons(index);
 }
 
 bool SpikeDetectorDynamicEditor::addElectrode(int nChans, int electrodeID)
@@ -360,7 +432,16 @@ bool SpikeDetectorDynamicEditor::addElectrode(int nChans, int electrodeID)
 	SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
     if (processor->addElectrode(nChans, electrodeID))
     {
-        refreshElectrodeList();
+        int index = processor->getNumElectrodes() - 1;
+        String searchText = electrodeSearch->getText().trim();
+
+        if (searchText.isEmpty() || processor->getElectrodeName(index).containsIgnoreCase(searchText))
+        {
+            visibleElectrodes.add(index);
+            electrodeList->updateContent();
+        }
+
+        selectElectrode(index);
         return true;
     }
     else
@@ -374,23 +455,136 @@ void SpikeDetectorDynamicEditor::removeElectrode(int index)
     std::cout << "Deleting electrode number " << index << std::endl;
 	SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
     processor->removeElectrode(index);
-    refreshElectrodeList();
 
-    int newIndex = jmin(index, electrodeList->getNumItems()-1);
-    newIndex = jmax(newIndex, 0);
+    // indices after the removed electrode have shifted
+    updateVisibleElectrodes();
+    selectElectrode(jmin(index, processor->getNumElectrodes() - 1));
+}
 
-    electrodeList->setSelectedId(newIndex, sendNotification);
-    electrodeList->setText(electrodeList->getItemText(newIndex));
+int SpikeDetectorDynamicEditor::getNumRows()
+{
+    return visibleElectrodes.size();
+}
 
-    if (electrodeList->getNumItems() == 0)
+void SpikeDetectorDynamicEditor::paintListBoxItem(int rowNumber, Graphics& g, int width, int height, bool rowIsSelected)
+{
+	SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
+
+    if (rowIsSelected)
+        g.fillAll(Colours::lightgrey);
+
+    int index = visibleElectrodes[rowNumber];
+
+    g.setColour(isElectrodeHealthy(index) ? Colours::black : Colours::grey);
+    g.drawText(processor->getElectrodeName(index), 4, 0, width - 4, height,
+               Justification::centredLeft, true);
+}
+
+bool SpikeDetectorDynamicEditor::isElectrodeHealthy(int index)
+{
+	SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
+
+    for (int i = 0; i < processor->getNumChannels(index); i++)
     {
-        electrodeButtons.clear();
-        electrodeList->setEditableText(false);
+        if (processor->getChannelHealth(processor->getChannel(index, i)) != ChannelHealthy)
+            return false;
     }
+
+    return true;
+}
+
+void SpikeDetectorDynamicEditor::startAcquisition()
+{
+    GenericEditor::startAcquisition();
+    sheddingLabel->setText("", dontSendNotification);
+    simdLabel->setText("", dontSendNotification);
+    startTimer(100);
+}
+
+void SpikeDetectorDynamicEditor::stopAcquisition()
+{
+    GenericEditor::stopAcquisition();
+    stopTimer();
+}
+
+void SpikeDetectorDynamicEditor::timerCallback()
+{
+	SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
+    waveformDisplay->update(processor->getRecentSpikes(), selectedElectrode);
+
+    String loadText;
+
+    if (processor->getTimeBudget() > 0)
+        loadText = "OVER BUDGET " + String(processor->getSheddingCount(ReuseNoiseLevels))
+                   + "/" + String(processor->getSheddingCount(HoldThresholds))
+                   + "/" + String(processor->getSheddingCount(DeferElectrodes));
+
+    int lateBlocks = processor->getPipelineCount(LateBlocks);
+    int waitingBlocks = processor->getPipelineCount(WaitingBlocks);
+    int inlineBlocks = processor->getPipelineCount(InlineBlocks);
+
+    if (lateBlocks + waitingBlocks + inlineBlocks > 0)
+        loadText += (loadText.isEmpty() ? "LATE " : " LATE ") + String(lateBlocks)
+                    + "/" + String(waitingBlocks) + "/" + String(inlineBlocks);
+
+    sheddingLabel->setText(loadText, dontSendNotification);
+
+    // picked by enable(), which may run after startAcquisition()
+    simdLabel->setText(String("SIMD ") + String(getSimdLevelName(processor->getActiveSimdLevel())).toUpperCase(),
+                       dontSendNotification);
+
+    int healthChangeCount = processor->getHealthChangeCount();
+
+    if (healthChangeCount == lastHealthChangeCount)
+        return;
+
+    lastHealthChangeCount = healthChangeCount;
+    electrodeList->repaint();
+
+    if (selectedElectrode >= 0)
+        drawElectrodeButtons(selectedElectrode);
+}
+
+void SpikeDetectorDynamicEditor::selectedRowsChanged(int lastRowSelected)
+{
+    if (lastRowSelected < 0)
+        return;
+
+    int index = visibleElectrodes[lastRowSelected];
+
+    if (index != selectedElectrode)
+        selectElectrode(index);
+}
+
+void SpikeDetectorDynamicEditor::textEditorTextChanged(TextEditor& /*editor*/)
+{
+    updateVisibleElectrodes();
+
+    int row = visibleElectrodes.indexOf(selectedElectrode);
+
+    if (row >= 0)
+        electrodeList->selectRow(row);
+    else
+        electrodeList->deselectAllRows();
 }
 
 void SpikeDetectorDynamicEditor::labelTextChanged(Label* label)
 {
+    if (label == electrodeName)
+    {
+        if (selectedElectrode != -1)
+        {
+			SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
+            processor->setElectrodeName(selectedElectrode + 1, label->getText());
+
+            int row = visibleElectrodes.indexOf(selectedElectrode);
+
+            if (row >= 0)
+                electrodeList->repaintRow(row);
+        }
+        return;
+    }
+
     if (label->getText().equalsIgnoreCase("1") && isPlural)
     {
         for (int n = 1; n < electrodeTypes->getNumItems()+1; n++)
@@ -424,31 +618,15 @@ void SpikeDetectorDynamicEditor::labelTextChanged(Label* label)
 
 void SpikeDetectorDynamicEditor::comboBoxChanged(ComboBox* comboBox)
 {
-    if (comboBox == electrodeList)
-    {
-        int ID = comboBox->getSelectedId();
-
-        if (ID == 0)
-        {
-            refreshElectrodeList();
-        }
-        else
-        {
-            lastId = ID;
-
-			SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
-            SimpleElectrode* e = processor->setCurrentElectrodeIndex(ID-1);
-            electrodeEditorButtons[1]->setToggleState(e->isMonitored, dontSendNotification);
-            drawElectrodeButtons(ID-1);
-        }
-    }
     thresholdSlider->setActive(false);
 }
 
 void SpikeDetectorDynamicEditor::checkSettings()
 {
-    electrodeList->setSelectedId(0);
-    drawElectrodeButtons(0);
+	SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
+
+    updateVisibleElectrodes();
+    selectElectrode(processor->getNumElectrodes() > 0 ? 0 : -1);
 
 	CoreServices::updateSignalChain(this);
 	CoreServices::highlightEditor(this);
@@ -457,22 +635,60 @@ void SpikeDetectorDynamicEditor::checkSettings()
 void SpikeDetectorDynamicEditor::drawElectrodeButtons(int ID)
 {
 	SpikeDetectorDynamic* processor = (SpikeDetectorDynamic*)getProcessor();
-    electrodeButtons.clear();
 
     int width = 20;
     int height = 15;
 
     int numChannels = processor->getNumChannels(ID);
-    int row = 0;
-    int column = 0;
+
+    // buttons are only recreated when the number of channels changes
+    if (electrodeButtons.size() != numChannels)
+    {
+        electrodeButtons.clear();
+
+        int row = 0;
+        int column = 0;
+
+        for (int i = 0; i < numChannels; i++)
+        {
+            ElectrodeButton* button = new ElectrodeButton(processor->getChannel(ID,i)+1);
+            electrodeButtons.add(button);
+
+            if (numChannels < 3)
+                button->setBounds(145+(column++)*width, 78+row*height, width, 15);
+            else
+                button->setBounds(145+(column++)*width, 70+row*height, width, 15);
+
+            addAndMakeVisible(button);
+            button->addListener(this);
+
+            if (column%2 == 0)
+            {
+                column = 0;
+                row++;
+            }
+        }
+    }
 
     Array<int> activeChannels;
     Array<double> thresholds;
 
     for (int i = 0; i < numChannels; i++)
     {
-        ElectrodeButton* button = new ElectrodeButton(processor->getChannel(ID,i)+1);
-        electrodeButtons.add(button);
+        ElectrodeButton* button = electrodeButtons[i];
+        button->setChannelNum(processor->getChannel(ID,i)+1);
+
+        int health = processor->getChannelHealth(processor->getChannel(ID,i));
+
+        switch (health)
+        {
+            case ChannelFlat:       button->setTooltip("Flat channel, skipped"); break;
+            case ChannelSaturated:  button->setTooltip("Saturated channel, skipped"); break;
+            case ChannelFloating:   button->setTooltip("Floating channel, skipped"); break;
+            default:                button->setTooltip(String()); break;
+        }
+
+        button->setAlpha(health == ChannelHealthy ? 1.0f : 0.4f);
 
         thresholds.add(processor->getChannelThreshold(ID,i));
 
@@ -484,24 +700,137 @@ void SpikeDetectorDynamicEditor::drawElectrodeButtons(int ID)
         else
         {
             activeChannels.add(processor->getChannel(ID,i));
+            button->setRadioGroupId(0);
             button->setToggleState(processor->isChannelActive(ID,i), dontSendNotification);
         }
 
-        if (numChannels < 3)
-            button->setBounds(145+(column++)*width, 78+row*height, width, 15);
-        else
-            button->setBounds(145+(column++)*width, 70+row*height, width, 15);
+        button->repaint();
+    }
+
+    channelSelector->setActiveChannels(activeChannels);
+    thresholdSlider->setValues(thresholds);
+}
+
+//==============================================================================
+SpikeWaveformDisplay::SpikeWaveformDisplay()
+    : numSpikes(0), currentElectrode(-1), lastNumSpikes(0)
+{
+    spikes.malloc(RECENT_SPIKES_PER_ELECTRODE);
+}
+
+SpikeWaveformDisplay::~SpikeWaveformDisplay()
+{
+}
+
+void SpikeWaveformDisplay::update(const RecentSpikeBuffer& recentSpikes, int electrode)
+{
+    uint64 count = recentSpikes.getNumSpikes(electrode);
+
+    if (electrode == currentElectrode && count == lastNumSpikes)
+        return;
+
+    currentElectrode = electrode;
+    lastNumSpikes = count;
+    numSpikes = recentSpikes.getRecentSpikes(electrode, spikes, RECENT_SPIKES_PER_ELECTRODE);
+    repaint();
+}
+
+// inactive channels are packed as zeros, far below any real sample
+static bool isBlankChannel(const RecentSpike& spike, int chan)
+{
+    return spike.data[chan * spike.nSamples] == 0;
+}
+
+static float getMicrovolts(const RecentSpike& spike, int chan, int sample)
+{
+    return (float(spike.data[chan * spike.nSamples + sample]) - 32768.0f) * spike.bitVolts[chan];
+}
 
-        addAndMakeVisible(button);
-        button->addListener(this);
+void SpikeWaveformDisplay::paint(Graphics& g)
+{
+    g.fillAll(Colours::black);
+    g.setColour(Colours::darkgrey);
+    g.drawRect(0, 0, getWidth(), getHeight());
+
+    if (numSpikes == 0)
+        return;
+
+    const RecentSpike& newest = spikes[numSpikes - 1];
+    int nChannels = newest.nChannels;
+    int nSamples = newest.nSamples;
+
+    if (nChannels == 0 || nSamples < 2)
+        return;
 
-        if (column%2 == 0)
+    // one scale for all channels, so that their amplitudes can be compared
+    float range = 1.0f;
+
+    for (int n = 0; n < numSpikes; n++)
+    {
+        const RecentSpike& spike = spikes[n];
+
+        // waveforms of another length were taken before the electrode changed
+        if (spike.nChannels != nChannels || spike.nSamples != nSamples)
+            continue;
+
+        for (int chan = 0; chan < nChannels; chan++)
         {
-            column = 0;
-            row++;
+            if (isBlankChannel(spike, chan))
+                continue;
+
+            range = jmax(range, 1.2f * spike.threshold[chan]);
+
+            for (int sample = 0; sample < nSamples; sample++)
+                range = jmax(range, std::abs(getMicrovolts(spike, chan, sample)));
         }
     }
 
-    channelSelector->setActiveChannels(activeChannels);
-    thresholdSlider->setValues(thresholds);
+    float panelWidth = float(getWidth() - 2) / nChannels;
+    float centre = getHeight() / 2.0f;
+    float scale = (centre - 2.0f) / range;
+    float step = (panelWidth - 4.0f) / (nSamples - 1);
+
+    Path path;
+    path.preallocateSpace(3 * nSamples + 3);
+
+    for (int chan = 0; chan < nChannels; chan++)
+    {
+        float left = 1.0f + chan * panelWidth;
+
+        if (chan > 0)
+        {
+            g.setColour(Colours::darkgrey);
+            g.drawVerticalLine(int(left), 1.0f, getHeight() - 1.0f);
+        }
+
+        if (isBlankChannel(newest, chan))
+            continue;
+
+        // detection compares the absolute value with the threshold
+        float threshold = newest.threshold[chan] * scale;
+        g.setColour(Colours::red.withAlpha(0.6f));
+        g.drawHorizontalLine(int(centre - threshold), left + 2.0f, left + panelWidth - 2.0f);
+        g.drawHorizontalLine(int(centre + threshold), left + 2.0f, left + panelWidth - 2.0f);
+
+        for (int n = 0; n < numSpikes; n++)
+        {
+            const RecentSpike& spike = spikes[n];
+
+            if (spike.nChannels != nChannels || spike.nSamples != nSamples || isBlankChannel(spike, chan))
+                continue;
+
+            path.clear();
+            path.startNewSubPath(left + 2.0f, centre - getMicrovolts(spike, chan, 0) * scale);
+
+            for (int sample = 1; sample < nSamples; sample++)
+                path.lineTo(left + 2.0f + sample * step, centre - getMicrovolts(spike, chan, sample) * scale);
+
+            if (spike.sortedId == 0)
+                g.setColour(Colours::white.withAlpha(0.4f));
+            else
+                g.setColour(Colour::fromHSV((spike.sortedId % 8) / 8.0f, 0.8f, 1.0f, 0.6f));
+
+            g.strokePath(path, PathStrokeType(1.0f));
+        }
+    }
 }
@@ -6,6 +6,35 @@
 
 class TriangleButton;
 class UtilityButton;
+class RecentSpikeBuffer;
+struct RecentSpike;
+
+/**
+  Draws the last waveforms of one electrode on top of each other, one panel
+  per channel, with the threshold of the newest spike. Spikes that were
+  sorted into a unit are coloured by their sortedId.
+*/
+
+class SpikeWaveformDisplay : public Component
+{
+public:
+    SpikeWaveformDisplay();
+    ~SpikeWaveformDisplay();
+
+    /** Copies the waveforms of an electrode (-1 for none) out of the
+        processor's rings and repaints when they changed. */
+    void update(const RecentSpikeBuffer& recentSpikes, int electrode);
+
+    void paint(Graphics& g);
+
+private:
+    HeapBlock<RecentSpike> spikes;
+    int numSpikes;
+    int currentElectrode;
+    uint64 lastNumSpikes;
+
+    JUCE_DECLARE_NON_COPYABLE(SpikeWaveformDisplay);
+};
 
 /**
   User interface for the SpikeDetector using dynamic thresholds.
@@ -14,11 +43,22 @@ class UtilityButton;
 
   Parameters of individual channels, such as channel mapping, threshold,
   and enabled state, can be edited.
+
+  Electrodes are shown in a virtualized list that can be filtered by name,
+  so the cost of the editor does not grow with the number of electrodes.
+
+  During acquisition, electrodes and channels that fail the processor's health
+  check are shown dimmed, and the last waveforms of the selected electrode are
+  drawn next to the list. With a time budget, the number of blocks that had
+  to shed load is shown below them.
 */
 
 class SpikeDetectorDynamicEditor : public GenericEditor,
     public Label::Listener,
-    public ComboBox::Listener
+    public ComboBox::Listener,
+    public TextEditor::Listener,
+    public ListBoxModel,
+    public Timer
 
 {
 public:
@@ -34,12 +74,35 @@ public:
     void checkSettings();
     void refreshElectrodeList();
 
+    void startAcquisition();
+    void stopAcquisition();
+
+    /** Redraws the waveforms of the selected electrode, updates the load
+        shedding counts, and refreshes the health flags when the processor
+        reports a change. */
+    void timerCallback();
+
+    void textEditorTextChanged(TextEditor& editor);
+
+    // ListBoxModel methods for the electrode list
+    int getNumRows();
+    void paintListBoxItem(int rowNumber, Graphics& g, int width, int height, bool rowIsSelected);
+    void selectedRowsChanged(int lastRowSelected);
+
 private:
 
     void drawElectrodeButtons(int);
 
+    /** Selects an electrode by index (-1 for none) and updates the list and buttons. */
+    void selectElectrode(int index);
+
+    /** Rebuilds the list of electrode indices matching the search text. */
+    void updateVisibleElectrodes();
+
     ComboBox* electrodeTypes;
-    ComboBox* electrodeList;
+    ListBox* electrodeList;
+    TextEditor* electrodeSearch;
+    Label* electrodeName;
     Label* numElectrodes;
     Label* thresholdLabel;
     TriangleButton* upButton;
@@ -48,12 +111,23 @@ private:
 
     ThresholdSlider* thresholdSlider;
 
+    SpikeWaveformDisplay* waveformDisplay;
+    Label* sheddingLabel;
+    Label* simdLabel;
+
     OwnedArray<ElectrodeButton> electrodeButtons;
     Array<ElectrodeEditorButton*> electrodeEditorButtons;
 
     void editElectrode(int index, int chan, int newChan);
 
-    int lastId;
+    /** Indices of the electrodes shown in electrodeList. */
+    Array<int> visibleElectrodes;
+    int selectedElectrode;
+
+    bool isElectrodeHealthy(int index);
+
+    int lastHealthChangeCount;
+
     bool isPlural;
 
     Font font;
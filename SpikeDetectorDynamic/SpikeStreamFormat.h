@@ -0,0 +1,67 @@
+
+#ifndef __SPIKESTREAMFORMAT_H_4A9E2C71__
+#define __SPIKESTREAMFORMAT_H_4A9E2C71__
+
+#include <atomic>
+#include <cstdint>
+
+/**
+  Layout of the shared-memory spike stream (see SpikeStreamWriter).
+
+  The segment is a header followed by a ring of fixed-size records. There is a
+  single writer (the detector) and any number of readers, which never write to
+  the segment. The writer does not wait for readers: a reader that falls more
+  than SPIKE_STREAM_NUM_RECORDS behind loses the oldest records.
+
+  Each record carries a sequence number. The writer sets it to 0, writes the
+  record, then sets it to index + 1 and advances writeIndex. A reader copies
+  the record and accepts it only if the sequence number was index + 1 both
+  before and after the copy.
+
+  This header only depends on the standard library, so that external
+  consumers can include it on its own.
+*/
+
+#define SPIKE_STREAM_MAGIC "SDSPIKE"
+#define SPIKE_STREAM_VERSION 1
+#define SPIKE_STREAM_NUM_RECORDS 4096     // power of two
+#define SPIKE_STREAM_MAX_CHANNELS 4
+#define SPIKE_STREAM_MAX_SAMPLES 80
+
+struct SpikeStreamRecord
+{
+    std::atomic<uint64_t> sequence;
+
+    int64_t timestamp;          // sample number of the peak
+    uint64_t publishTimeNs;     // CLOCK_MONOTONIC when the record was written
+    uint16_t electrodeID;
+    uint16_t source;            // electrode index in the detector
+    uint16_t nChannels;
+    uint16_t nSamples;
+    uint16_t samplingFrequencyHz;
+    uint16_t threshold[SPIKE_STREAM_MAX_CHANNELS];
+    float gain[SPIKE_STREAM_MAX_CHANNELS];
+
+    // nChannels x nSamples, offset by 32768 as in SpikeObject
+    uint16_t data[SPIKE_STREAM_MAX_CHANNELS * SPIKE_STREAM_MAX_SAMPLES];
+};
+
+struct SpikeStreamHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numRecords;
+    uint32_t recordSize;
+    uint32_t reserved;
+
+    // number of records published so far, on its own cache line
+    alignas(64) std::atomic<uint64_t> writeIndex;
+};
+
+struct SpikeStreamSegment
+{
+    SpikeStreamHeader header;
+    alignas(64) SpikeStreamRecord records[SPIKE_STREAM_NUM_RECORDS];
+};
+
+#endif  // __SPIKESTREAMFORMAT_H_4A9E2C71__
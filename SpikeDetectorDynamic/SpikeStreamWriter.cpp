@@ -0,0 +1,133 @@
+
+#include "SpikeStreamWriter.h"
+
+#if ! JUCE_WINDOWS
+ #include <fcntl.h>
+ #include <sys/mman.h>
+ #include <time.h>
+ #include <unistd.h>
+#endif
+
+static_assert(SPIKE_STREAM_MAX_CHANNELS >= MAX_NUMBER_OF_SPIKE_CHANNELS
+              && SPIKE_STREAM_MAX_SAMPLES >= MAX_NUMBER_OF_SPIKE_CHANNEL_SAMPLES,
+              "spike stream records must hold any SpikeObject");
+
+SpikeStreamWriter::SpikeStreamWriter()
+    : segment(nullptr)
+{
+}
+
+SpikeStreamWriter::~SpikeStreamWriter()
+{
+    close();
+}
+
+#if JUCE_WINDOWS
+
+bool SpikeStreamWriter::open(const String& /*name*/)
+{
+    return false;
+}
+
+void SpikeStreamWriter::close()
+{
+}
+
+void SpikeStreamWriter::publish(const SpikeObject* /*s*/)
+{
+}
+
+#else
+
+bool SpikeStreamWriter::open(const String& name)
+{
+    close();
+
+    // a stale segment from a previous run may have another size
+    shm_unlink(name.toRawUTF8());
+
+    int fd = shm_open(name.toRawUTF8(), O_CREAT | O_RDWR, 0644);
+
+    if (fd < 0)
+        return false;
+
+    if (ftruncate(fd, sizeof(SpikeStreamSegment)) != 0)
+    {
+        ::close(fd);
+        shm_unlink(name.toRawUTF8());
+        return false;
+    }
+
+    void* memory = mmap(nullptr, sizeof(SpikeStreamSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (memory == MAP_FAILED)
+    {
+        shm_unlink(name.toRawUTF8());
+        return false;
+    }
+
+    // ftruncate() zero-fills the segment, so all sequence numbers start at 0;
+    // touching every page here keeps page faults out of publish()
+    memset(memory, 0, sizeof(SpikeStreamSegment));
+    segment = static_cast<SpikeStreamSegment*>(memory);
+
+    SpikeStreamHeader& header = segment->header;
+    memcpy(header.magic, SPIKE_STREAM_MAGIC, sizeof(SPIKE_STREAM_MAGIC));
+    header.version = SPIKE_STREAM_VERSION;
+    header.numRecords = SPIKE_STREAM_NUM_RECORDS;
+    header.recordSize = sizeof(SpikeStreamRecord);
+    header.writeIndex.store(0, std::memory_order_release);
+
+    segmentName = name;
+    return true;
+}
+
+void SpikeStreamWriter::close()
+{
+    if (segment == nullptr)
+        return;
+
+    munmap(segment, sizeof(SpikeStreamSegment));
+    shm_unlink(segmentName.toRawUTF8());
+
+    segment = nullptr;
+    segmentName = String();
+}
+
+void SpikeStreamWriter::publish(const SpikeObject* s)
+{
+    if (segment == nullptr)
+        return;
+
+    // single writer: nobody else changes writeIndex
+    uint64_t index = segment->header.writeIndex.load(std::memory_order_relaxed);
+    SpikeStreamRecord& r = segment->records[index & (SPIKE_STREAM_NUM_RECORDS - 1)];
+
+    r.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    r.timestamp = s->timestamp;
+    r.publishTimeNs = uint64_t(now.tv_sec) * 1000000000ull + uint64_t(now.tv_nsec);
+    r.electrodeID = s->electrodeID;
+    r.source = s->source;
+    r.nChannels = s->nChannels;
+    r.nSamples = s->nSamples;
+    r.samplingFrequencyHz = s->samplingFrequencyHz;
+
+    for (int chan = 0; chan < s->nChannels; chan++)
+    {
+        r.threshold[chan] = s->threshold[chan];
+        r.gain[chan] = s->gain[chan];
+    }
+
+    memcpy(r.data, s->data, sizeof(uint16_t) * s->nChannels * s->nSamples);
+
+    r.sequence.store(index + 1, std::memory_order_release);
+    segment->header.writeIndex.store(index + 1, std::memory_order_release);
+}
+
+#endif
@@ -0,0 +1,48 @@
+
+#ifndef __SPIKESTREAMWRITER_H_C3B81F5E__
+#define __SPIKESTREAMWRITER_H_C3B81F5E__
+
+#include <ProcessorHeaders.h>
+#include <SpikeLib.h>
+#include "SpikeStreamFormat.h"
+
+/**
+  Publishes detected spikes into a named POSIX shared-memory ring, so that
+  other processes (an online sorter, a decoder) can read them directly instead
+  of through the signal chain and the recording path.
+
+  publish() copies one spike into the ring with a few stores and never blocks
+  or allocates, so it can be called from the real-time path. The layout is
+  described in SpikeStreamFormat.h; tools/spikestream contains a reader.
+
+  Only available on POSIX systems; open() fails elsewhere.
+*/
+
+class SpikeStreamWriter
+{
+public:
+    SpikeStreamWriter();
+
+    /** Unmaps and removes the segment. */
+    ~SpikeStreamWriter();
+
+    /** Creates (or replaces) the segment with the given name, e.g.
+        "/dynamic_detector_spikes". */
+    bool open(const String& name);
+
+    void close();
+
+    bool isOpen() const { return segment != nullptr; }
+
+    const String& getName() const { return segmentName; }
+
+    void publish(const SpikeObject* s);
+
+private:
+    SpikeStreamSegment* segment;
+    String segmentName;
+
+    JUCE_DECLARE_NON_COPYABLE(SpikeStreamWriter);
+};
+
+#endif  // __SPIKESTREAMWRITER_H_C3B81F5E__
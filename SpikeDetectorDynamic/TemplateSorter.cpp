@@ -0,0 +1,257 @@
+
+#include "TemplateSorter.h"
+
+#include "SimdKernels.h"
+
+#include <cmath>
+
+#define TEMPLATE_FILE_MAGIC "SDTM"
+#define TEMPLATE_FILE_VERSION 1
+
+const TemplateSet* TemplateLibrary::getSet(int electrodeID) const
+{
+    int first = 0;
+    int last = sets.size();
+
+    while (first < last)
+    {
+        int middle = (first + last) / 2;
+
+        if (sets[middle]->electrodeID < electrodeID)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+
+    if (first < sets.size() && sets[first]->electrodeID == electrodeID)
+        return sets[first];
+
+    return nullptr;
+}
+
+TemplateSorter::TemplateSorter()
+    : Thread("Template Sorter"), activeLibrary(nullptr), pendingLibrary(nullptr),
+      retiredLibrary(nullptr)
+{
+    spikeValues.calloc(paddedLength(MAX_NUMBER_OF_SPIKE_CHANNELS * MAX_NUMBER_OF_SPIKE_CHANNEL_SAMPLES));
+}
+
+TemplateSorter::~TemplateSorter()
+{
+    stopWatching();
+    collectGarbage();
+    delete pendingLibrary.exchange(nullptr);
+    delete activeLibrary;
+}
+
+void TemplateSorter::setTemplateFile(const File& file)
+{
+    // run() reads the file and its time without a lock, so it is stopped
+    // while they change
+    bool wasWatching = isThreadRunning();
+    stopWatching();
+
+    templateFile = file;
+    lastModificationTime = file.getLastModificationTime();
+
+    if (TemplateLibrary* library = loadTemplates(file))
+        setLibrary(library);
+    else
+        setLibrary(new TemplateLibrary()); // no templates: everything stays unsorted
+
+    if (wasWatching)
+        startWatching();
+}
+
+void TemplateSorter::startWatching()
+{
+    if (templateFile.getFullPathName().isNotEmpty())
+        startThread(3);
+}
+
+void TemplateSorter::stopWatching()
+{
+    stopThread(2000);
+}
+
+void TemplateSorter::run()
+{
+    while (! threadShouldExit())
+    {
+        collectGarbage();
+
+        Time modificationTime = templateFile.getLastModificationTime();
+
+        if (modificationTime != lastModificationTime)
+        {
+            lastModificationTime = modificationTime;
+
+            if (TemplateLibrary* library = loadTemplates(templateFile))
+            {
+                setLibrary(library);
+                std::cout << "Reloaded spike templates from " << templateFile.getFileName() << std::endl;
+            }
+        }
+
+        wait(1000);
+    }
+}
+
+void TemplateSorter::collectGarbage()
+{
+    delete retiredLibrary.exchange(nullptr);
+}
+
+void TemplateSorter::setLibrary(TemplateLibrary* library)
+{
+    collectGarbage();
+
+    // a library that was never adopted is simply replaced
+    delete pendingLibrary.exchange(library);
+}
+
+void TemplateSorter::prepareBlock()
+{
+    // the previous library can only be retired once the last one was collected
+    if (retiredLibrary.load() != nullptr)
+        return;
+
+    if (TemplateLibrary* library = pendingLibrary.exchange(nullptr))
+    {
+        retiredLibrary.store(activeLibrary);
+        activeLibrary = library;
+    }
+}
+
+int TemplateSorter::classify(const SpikeObject* s)
+{
+    if (activeLibrary == nullptr)
+        return 0;
+
+    const TemplateSet* set = activeLibrary->getSet(s->electrodeID);
+
+    if (set == nullptr || set->nChannels != s->nChannels || set->nSamples != s->nSamples)
+        return 0;
+
+    int numValues = s->nChannels * s->nSamples;
+    float* x = spikeValues;
+
+    for (int i = 0; i < numValues; i++)
+        x[i] = float(int(s->data[i]) - 32768);
+
+    for (int i = numValues; i < set->length; i++)
+        x[i] = 0;
+
+    // |x - t|^2 = |x|^2 - 2 x.t + |t|^2
+    float squaredNorm = dotProduct(x, x, set->length);
+    int best = -1;
+    float bestDistance = 0;
+
+    for (int n = 0; n < set->numTemplates; n++)
+    {
+        float distance = squaredNorm - 2.0f * dotProduct(x, set->data + n * set->length, set->length)
+                         + set->squaredNorms[n];
+
+        if (best < 0 || distance < bestDistance)
+        {
+            best = n;
+            bestDistance = distance;
+        }
+    }
+
+    if (best >= 0 && bestDistance <= set->maxDistances[best])
+        return set->unitIds[best];
+
+    return 0;
+}
+
+TemplateLibrary* TemplateSorter::loadTemplates(const File& file)
+{
+    FileInputStream stream(file);
+
+    if (! stream.openedOk())
+        return nullptr;
+
+    char magic[4];
+
+    if (stream.read(magic, 4) != 4 || memcmp(magic, TEMPLATE_FILE_MAGIC, 4) != 0
+        || stream.readInt() != TEMPLATE_FILE_VERSION)
+        return nullptr;
+
+    // readInt() returns 0 past the end, so every part is checked against
+    // the bytes left before it is read
+    const int64 electrodeHeaderSize = 4 * sizeof(int32);
+
+    if (stream.getNumBytesRemaining() < int64(sizeof(int32)))
+        return nullptr;
+
+    int numElectrodes = stream.readInt();
+
+    if (numElectrodes < 0 || numElectrodes * electrodeHeaderSize > stream.getNumBytesRemaining())
+        return nullptr;
+
+    ScopedPointer<TemplateLibrary> library = new TemplateLibrary();
+
+    for (int e = 0; e < numElectrodes; e++)
+    {
+        if (stream.getNumBytesRemaining() < electrodeHeaderSize)
+            return nullptr;
+
+        ScopedPointer<TemplateSet> set = new TemplateSet();
+        set->electrodeID = stream.readInt();
+        set->numTemplates = stream.readInt();
+        set->nChannels = stream.readInt();
+        set->nSamples = stream.readInt();
+
+        if (set->numTemplates < 0 || set->numTemplates > MAX_TEMPLATES_PER_ELECTRODE
+            || set->nChannels < 1 || set->nChannels > MAX_NUMBER_OF_SPIKE_CHANNELS
+            || set->nSamples < 1 || set->nSamples > MAX_NUMBER_OF_SPIKE_CHANNEL_SAMPLES
+            || library->getSet(set->electrodeID) != nullptr)
+            return nullptr;
+
+        int numValues = set->nChannels * set->nSamples;
+
+        // unit ID, maximum distance and the waveform of each template
+        int64 templateSize = sizeof(int32) + sizeof(float) + numValues * int64(sizeof(float));
+
+        if (stream.getNumBytesRemaining() < set->numTemplates * templateSize)
+            return nullptr;
+
+        set->length = paddedLength(numValues);
+        set->data.calloc(jmax(set->numTemplates, 1) * set->length);
+        set->squaredNorms.malloc(jmax(set->numTemplates, 1));
+        set->maxDistances.malloc(jmax(set->numTemplates, 1));
+        set->unitIds.malloc(jmax(set->numTemplates, 1));
+
+        for (int n = 0; n < set->numTemplates; n++)
+        {
+            float* row = set->data + n * set->length;
+
+            set->unitIds[n] = stream.readInt();
+            float maxDistance = stream.readFloat();
+            set->maxDistances[n] = maxDistance * maxDistance;
+
+            // unit IDs end up in SpikeObject::sortedId
+            if (set->unitIds[n] < 0 || set->unitIds[n] > 0xffff || ! (maxDistance >= 0))
+                return nullptr;
+
+            for (int i = 0; i < numValues; i++)
+                row[i] = stream.readFloat();
+
+            set->squaredNorms[n] = dotProduct(row, row, set->length);
+
+            if (! std::isfinite(set->squaredNorms[n]) || ! std::isfinite(set->maxDistances[n]))
+                return nullptr;
+        }
+
+        // sets are looked up by electrode ID with a binary search
+        int index = 0;
+
+        while (index < library->sets.size() && library->sets[index]->electrodeID < set->electrodeID)
+            index++;
+
+        library->sets.insert(index, set.release());
+    }
+
+    return library.release();
+}
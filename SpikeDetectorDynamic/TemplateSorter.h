@@ -0,0 +1,106 @@
+
+#ifndef __TEMPLATESORTER_H_1D6F8B42__
+#define __TEMPLATESORTER_H_1D6F8B42__
+
+#include <ProcessorHeaders.h>
+#include <SpikeLib.h>
+
+// each spike is compared with every template of its electrode
+#define MAX_TEMPLATES_PER_ELECTRODE 64
+
+/** The templates of one electrode, stored as padded rows of floats. */
+struct TemplateSet
+{
+    int electrodeID;
+    int nChannels;
+    int nSamples;
+    int length;         // nChannels * nSamples, rounded up to a multiple of 4
+    int numTemplates;
+
+    HeapBlock<float> data;          // numTemplates rows of length floats
+    HeapBlock<float> squaredNorms;
+    HeapBlock<float> maxDistances;  // squared
+    HeapBlock<int> unitIds;
+};
+
+/** An immutable collection of template sets, sorted by electrode ID. */
+struct TemplateLibrary
+{
+    OwnedArray<TemplateSet> sets;
+
+    const TemplateSet* getSet(int electrodeID) const;
+};
+
+/**
+  Online template-matching classification of detected spikes.
+
+  Each spike is compared with the templates of its electrode (squared
+  Euclidean distance, computed with SSE dot products) and gets the unit ID of
+  the closest template if it lies within that template's maximum distance;
+  otherwise it stays unsorted (0).
+
+  Templates are read from a binary file (see loadTemplates) by a background
+  thread, which also reloads the file whenever it changes. A new library is
+  handed over through an atomic pointer and adopted at the start of the next
+  block, and the replaced one is deleted by the background thread, so the
+  detection thread never waits and never frees memory.
+*/
+
+class TemplateSorter : private Thread
+{
+public:
+    TemplateSorter();
+    ~TemplateSorter();
+
+    /** Loads the file now and, while watching, again whenever it changes.
+        The watcher is stopped while the file changes. */
+    void setTemplateFile(const File& file);
+
+    const File& getTemplateFile() const { return templateFile; }
+
+    /** Starts or stops reloading the template file in the background. */
+    void startWatching();
+    void stopWatching();
+
+    /** Reads a template file; returns nullptr if it cannot be read. The file
+        holds "SDTM", version (int32), number of electrodes (int32), then per
+        electrode: electrode ID, number of templates, number of channels,
+        samples per channel (int32 each), then per template: unit ID (int32),
+        maximum distance (float32) and nChannels x nSamples floats in the
+        units of SpikeObject::data minus 32768. All little-endian.
+        The whole file is rejected if it is cut short, repeats an electrode,
+        or holds more than MAX_TEMPLATES_PER_ELECTRODE templates per
+        electrode, unit IDs outside 0-65535 or values that are not finite. */
+    static TemplateLibrary* loadTemplates(const File& file);
+
+    /** Takes ownership of the library and hands it to the detection thread. */
+    void setLibrary(TemplateLibrary* library);
+
+    /** Called by the detection thread once per block, adopts a new library. */
+    void prepareBlock();
+
+    /** Called by the detection thread; returns the unit ID, or 0 if unsorted. */
+    int classify(const SpikeObject* s);
+
+    bool hasTemplates() const { return activeLibrary != nullptr; }
+
+private:
+    void run();
+
+    void collectGarbage();
+
+    File templateFile;
+    Time lastModificationTime;
+
+    // owned by the detection thread
+    TemplateLibrary* activeLibrary;
+
+    std::atomic<TemplateLibrary*> pendingLibrary;
+    std::atomic<TemplateLibrary*> retiredLibrary;
+
+    HeapBlock<float> spikeValues;
+
+    JUCE_DECLARE_NON_COPYABLE(TemplateSorter);
+};
+
+#endif  // __TEMPLATESORTER_H_1D6F8B42__
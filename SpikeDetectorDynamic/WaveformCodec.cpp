@@ -0,0 +1,211 @@
+
+#include "WaveformCodec.h"
+
+namespace
+{
+    // eventType, timestamp, timestamp_software, source, nChannels, nSamples, sortedId,
+    // electrodeID, channel, color, pcProj, samplingFrequencyHz
+    const int headerSize = 1 + 8 + 8 + 6 * 2 + 3 + 2 * 4 + 2;
+
+    // gain, threshold, bit width and first sample of each channel
+    const int channelHeaderSize = 4 + 2 + 1 + 2;
+
+    inline uint32 zigzag(int value)
+    {
+        return (uint32(value) << 1) ^ uint32(value >> 31);
+    }
+
+    inline int unzigzag(uint32 value)
+    {
+        return int(value >> 1) ^ -int(value & 1);
+    }
+
+    inline int getBitWidth(uint32 value)
+    {
+        int width = 0;
+
+        while (value != 0)
+        {
+            value >>= 1;
+            width++;
+        }
+
+        return width;
+    }
+
+    inline int getPackedSize(int numValues, int width)
+    {
+        return (numValues * width + 7) / 8;
+    }
+
+    template <typename Type>
+    inline void write(uint8_t*& p, const Type& value)
+    {
+        memcpy(p, &value, sizeof(Type));
+        p += sizeof(Type);
+    }
+
+    template <typename Type>
+    inline void read(const uint8_t*& p, Type& value)
+    {
+        memcpy(&value, p, sizeof(Type));
+        p += sizeof(Type);
+    }
+}
+
+int getFullWidthSpikeSize(const SpikeObject* s)
+{
+    return headerSize + s->nChannels * (4 + 2) + 2 * s->nChannels * s->nSamples;
+}
+
+int packCompressedSpike(const SpikeObject* s, uint8_t* buffer, int bufferSize)
+{
+    int nChannels = s->nChannels;
+    int nSamples = s->nSamples;
+
+    if (nChannels > MAX_NUMBER_OF_SPIKE_CHANNELS || nSamples > MAX_NUMBER_OF_SPIKE_CHANNEL_SAMPLES
+        || nSamples < 1)
+        return 0;
+
+    uint32 deltas[MAX_NUMBER_OF_SPIKE_CHANNEL_SAMPLES];
+    int widths[MAX_NUMBER_OF_SPIKE_CHANNELS];
+    int size = headerSize + nChannels * channelHeaderSize;
+
+    // first pass: the bit width of each channel decides the size
+    for (int chan = 0; chan < nChannels; chan++)
+    {
+        const uint16_t* data = s->data + chan * nSamples;
+        uint32 bits = 0;
+
+        for (int i = 1; i < nSamples; i++)
+            bits |= zigzag(int(data[i]) - int(data[i - 1]));
+
+        widths[chan] = getBitWidth(bits);
+        size += getPackedSize(nSamples - 1, widths[chan]);
+    }
+
+    if (size > bufferSize)
+        return 0;
+
+    uint8_t* p = buffer;
+    uint8_t eventType = COMPRESSED_SPIKE_EVENT_CODE;
+
+    write(p, eventType);
+    write(p, s->timestamp);
+    write(p, s->timestamp_software);
+    write(p, s->source);
+    write(p, s->nChannels);
+    write(p, s->nSamples);
+    write(p, s->sortedId);
+    write(p, s->electrodeID);
+    write(p, s->channel);
+    memcpy(p, s->color, 3);
+    p += 3;
+    write(p, s->pcProj[0]);
+    write(p, s->pcProj[1]);
+    write(p, s->samplingFrequencyHz);
+
+    for (int chan = 0; chan < nChannels; chan++)
+    {
+        const uint16_t* data = s->data + chan * nSamples;
+        int width = widths[chan];
+
+        write(p, s->gain[chan]);
+        write(p, s->threshold[chan]);
+        *p++ = uint8_t(width);
+        write(p, data[0]);
+
+        for (int i = 1; i < nSamples; i++)
+            deltas[i] = zigzag(int(data[i]) - int(data[i - 1]));
+
+        // widths are at most 17 bits, so the accumulator never overflows
+        uint64 accumulator = 0;
+        int numBits = 0;
+
+        for (int i = 1; i < nSamples; i++)
+        {
+            accumulator |= uint64(deltas[i]) << numBits;
+            numBits += width;
+
+            while (numBits >= 8)
+            {
+                *p++ = uint8_t(accumulator);
+                accumulator >>= 8;
+                numBits -= 8;
+            }
+        }
+
+        if (numBits > 0)
+            *p++ = uint8_t(accumulator);
+    }
+
+    return int(p - buffer);
+}
+
+bool unpackCompressedSpike(SpikeObject* s, const uint8_t* buffer, int bufferSize)
+{
+    if (bufferSize < headerSize || buffer[0] != COMPRESSED_SPIKE_EVENT_CODE)
+        return false;
+
+    const uint8_t* p = buffer;
+    const uint8_t* end = buffer + bufferSize;
+
+    read(p, s->eventType);
+    read(p, s->timestamp);
+    read(p, s->timestamp_software);
+    read(p, s->source);
+    read(p, s->nChannels);
+    read(p, s->nSamples);
+    read(p, s->sortedId);
+    read(p, s->electrodeID);
+    read(p, s->channel);
+    memcpy(s->color, p, 3);
+    p += 3;
+    read(p, s->pcProj[0]);
+    read(p, s->pcProj[1]);
+    read(p, s->samplingFrequencyHz);
+
+    int nChannels = s->nChannels;
+    int nSamples = s->nSamples;
+
+    if (nChannels > MAX_NUMBER_OF_SPIKE_CHANNELS || nSamples > MAX_NUMBER_OF_SPIKE_CHANNEL_SAMPLES
+        || nSamples < 1)
+        return false;
+
+    for (int chan = 0; chan < nChannels; chan++)
+    {
+        if (end - p < channelHeaderSize)
+            return false;
+
+        uint16_t* data = s->data + chan * nSamples;
+
+        read(p, s->gain[chan]);
+        read(p, s->threshold[chan]);
+        int width = *p++;
+        read(p, data[0]);
+
+        if (width > 17 || end - p < getPackedSize(nSamples - 1, width))
+            return false;
+
+        uint32 mask = (uint32(1) << width) - 1;
+        uint64 accumulator = 0;
+        int numBits = 0;
+        int value = data[0];
+
+        for (int i = 1; i < nSamples; i++)
+        {
+            while (numBits < width)
+            {
+                accumulator |= uint64(*p++) << numBits;
+                numBits += 8;
+            }
+
+            value += unzigzag(uint32(accumulator) & mask);
+            accumulator >>= width;
+            numBits -= width;
+            data[i] = uint16_t(value);
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,33 @@
+
+#ifndef __WAVEFORMCODEC_H_8E4D1F37__
+#define __WAVEFORMCODEC_H_8E4D1F37__
+
+#include <ProcessorHeaders.h>
+#include <SpikeLib.h>
+
+/** Event type of spikes with compressed waveforms. Processors that only know
+    SPIKE_EVENT_CODE ignore these events. */
+#define COMPRESSED_SPIKE_EVENT_CODE (SPIKE_EVENT_CODE + 100)
+
+/**
+  Compact encoding of spike events.
+
+  The header holds the same fields as packSpike(). Each channel's waveform is
+  stored as its first sample followed by the zigzag-encoded differences between
+  consecutive samples, bit-packed at the smallest width that fits the largest
+  difference of that channel. Spike waveforms are smooth, so this usually
+  takes well under 16 bits per sample, and nothing for blank (inactive)
+  channels. Decoding is a shift and a mask per sample.
+*/
+
+/** Encodes a spike; returns the number of bytes written, or 0 if the buffer
+    is too small. */
+int packCompressedSpike(const SpikeObject* s, uint8_t* buffer, int bufferSize);
+
+/** Decodes an event produced by packCompressedSpike(). */
+bool unpackCompressedSpike(SpikeObject* s, const uint8_t* buffer, int bufferSize);
+
+/** Size of the same spike with 16-bit samples, to measure the compression ratio. */
+int getFullWidthSpikeSize(const SpikeObject* s);
+
+#endif  // __WAVEFORMCODEC_H_8E4D1F37__
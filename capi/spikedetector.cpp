@@ -0,0 +1,368 @@
+
+#include "spikedetector.h"
+#include "../SpikeDetectorDynamic/DetectorCore.h"
+
+#include <algorithm>
+#include <cmath>
+#include <new>
+#include <vector>
+
+static_assert(SDD_MAX_CHANNELS == DETECTOR_CORE_MAX_CHANNELS, "channel limits differ");
+static_assert(SDD_MAX_SAMPLES == DETECTOR_CORE_MAX_SAMPLES, "sample limits differ");
+static_assert(int(SDD_NOISE_MEDIAN) == int(MedianNoise) && int(SDD_NOISE_RUNNING_MAD) == int(RunningMadNoise)
+              && int(SDD_NOISE_RMS) == int(RmsNoise), "noise estimators differ");
+
+/**
+  A DetectorCore with the electrode layout, scratch space for blocks that
+  need converting and the queue of packed spikes. Planar float blocks are
+  read where the caller keeps them; int16 and interleaved blocks are
+  converted to planar microvolts first. Waveforms are packed as in the
+  plugin; int16 blocks are rounded back to their counts, so that their
+  waveforms hold exactly the pushed values.
+*/
+struct sdd_detector : private DetectorCore::Listener
+{
+    sdd_detector(const sdd_config& config, const sdd_electrode* layout, int numElectrodes)
+        : format(config.format), numLost(0), numChannels(config.num_channels),
+          maxBlockSize(config.max_block_size), blockTimestamp(0), scanIndex(0), scan(nullptr),
+          queueStart(0), numQueued(0)
+    {
+        electrodes.assign(layout, layout + numElectrodes);
+        lastBufferIndex.assign(numElectrodes, 0);
+
+        bitVolts.assign(numChannels, 0.195f);
+
+        if (config.bit_volts != nullptr)
+            bitVolts.assign(config.bit_volts, config.bit_volts + numChannels);
+
+        samples.assign(size_t(numChannels) * maxBlockSize, 0.0f);
+        channelData.resize(numChannels);
+        blockData.resize(numChannels);
+        blockNumSamples.assign(numChannels, 0);
+
+        for (int chan = 0; chan < numChannels; chan++)
+            channelData[chan] = &samples[size_t(chan) * maxBlockSize];
+
+        queue.resize(config.spike_queue_size);
+
+        core.prepare(numChannels, maxBlockSize);
+        core.setSampleRate(config.sample_rate);
+    }
+
+    template <typename SampleType>
+    int push(const SampleType* const* channels, int stride, int numSamples, int64_t timestamp)
+    {
+        if (channels == nullptr || stride < 1 || numSamples < 0 || numSamples > maxBlockSize)
+            return SDD_ERROR_INVALID_ARGUMENT;
+
+        for (int chan = 0; chan < numChannels; chan++)
+        {
+            if (channels[chan] == nullptr)
+                return SDD_ERROR_INVALID_ARGUMENT;
+        }
+
+        // the core reads planar microvolts; it only writes to them when it
+        // has a filter, which the library never sets
+        for (int chan = 0; chan < numChannels; chan++)
+        {
+            if (! getPlanar(channels[chan], stride, blockData[chan]))
+            {
+                const SampleType* source = channels[chan];
+                float* dest = channelData[chan];
+                float scale = format == SDD_FORMAT_INT16 ? bitVolts[chan] : 1.0f;
+
+                for (int n = 0; n < numSamples; n++)
+                    dest[n] = float(source[n * stride]) * scale;
+
+                blockData[chan] = dest;
+            }
+
+            blockNumSamples[chan] = numSamples;
+        }
+
+        blockTimestamp = timestamp;
+        core.beginBlock(&blockData[0], &blockNumSamples[0], numChannels, numSamples);
+
+        for (size_t i = 0; i < electrodes.size(); i++)
+        {
+            const sdd_electrode& electrode = electrodes[i];
+            ElectrodeScan electrodeScan;
+
+            electrodeScan.numChannels = electrode.num_channels;
+            electrodeScan.prePeakSamples = electrode.pre_peak_samples;
+            electrodeScan.postPeakSamples = electrode.post_peak_samples;
+
+            for (int chan = 0; chan < electrode.num_channels; chan++)
+            {
+                int inputChannel = electrode.channels[chan];
+
+                electrodeScan.channels[chan] = inputChannel;
+                electrodeScan.thresholds[chan] = electrode.thresholds[chan];
+                electrodeScan.lastWindow[chan] = core.getLastWindow(inputChannel);
+                electrodeScan.noiseLevels[chan] = nullptr;
+                electrodeScan.tileMaxima[chan] = nullptr;
+
+                if (electrode.active[chan] != 0)
+                {
+                    electrodeScan.noiseLevels[chan] = core.getNoiseLevels(inputChannel, electrode.noise_estimator);
+                    electrodeScan.tileMaxima[chan] = core.getTileMaxima(inputChannel, electrode.noise_estimator);
+                }
+            }
+
+            scanIndex = int(i);
+            scan = &electrodeScan;
+            lastBufferIndex[i] = core.scanElectrode(electrodeScan, lastBufferIndex[i], *this);
+        }
+
+        scan = nullptr;
+        core.endBlock();
+
+        return SDD_OK;
+    }
+
+    int readSpikes(sdd_spike* spikes, int maxSpikes)
+    {
+        int numRead = std::min(std::max(maxSpikes, 0), numQueued);
+        int capacity = int(queue.size());
+
+        for (int n = 0; n < numRead; n++)
+            spikes[n] = queue[(queueStart + n) % capacity];
+
+        queueStart = (queueStart + numRead) % capacity;
+        numQueued -= numRead;
+
+        return numRead;
+    }
+
+    void reset()
+    {
+        core.resetNoiseLevels();
+        core.resetSignal();
+        std::fill(lastBufferIndex.begin(), lastBufferIndex.end(), 0);
+
+        queueStart = 0;
+        numQueued = 0;
+        numLost = 0;
+    }
+
+    sdd_sample_format format;
+    int64_t numLost;
+
+private:
+    /** Points data at a block the core can read in place: planar floats. */
+    static bool getPlanar(const float* channel, int stride, float*& data)
+    {
+        if (stride != 1)
+            return false;
+
+        data = const_cast<float*>(channel);
+        return true;
+    }
+
+    static bool getPlanar(const int16_t*, int, float*&)
+    {
+        return false;
+    }
+
+    void peakFound(int, int crossingIndex, int peakIndex, float) override
+    {
+        if (numQueued == int(queue.size()))
+        {
+            numLost++;
+            return;
+        }
+
+        const sdd_electrode& electrode = electrodes[scanIndex];
+        sdd_spike& spike = queue[(queueStart + numQueued) % int(queue.size())];
+        numQueued++;
+
+        int spikeLength = electrode.pre_peak_samples + electrode.post_peak_samples;
+        int firstSample = peakIndex - (electrode.pre_peak_samples - 1);
+        int window = (crossingIndex - core.getNoiseWindowStart()) / core.getWindowSize();
+
+        spike.electrode = scanIndex;
+        spike.electrode_id = electrode.electrode_id;
+        spike.timestamp = blockTimestamp + peakIndex;
+        spike.num_channels = electrode.num_channels;
+        spike.num_samples = spikeLength;
+
+        uint16_t* data = spike.data;
+
+        for (int chan = 0; chan < electrode.num_channels; chan++)
+        {
+            int inputChannel = electrode.channels[chan];
+            const float* levels = scan->noiseLevels[chan];
+
+            spike.thresholds[chan] = levels != nullptr
+                                     ? scan->thresholds[chan] * levels[std::min(std::max(window, 0), scan->lastWindow[chan])]
+                                     : 0.0f;
+
+            for (int n = 0; n < spikeLength; n++)
+            {
+                float value = core.getSample(inputChannel, firstSample + n) / bitVolts[inputChannel];
+
+                if (electrode.active[chan] == 0)
+                    *data++ = 0;
+                else if (format == SDD_FORMAT_INT16)
+                    *data++ = uint16_t(int(std::floor(value + 0.5f)) + 32768);
+                else
+                    *data++ = uint16_t(value + 32768);
+            }
+        }
+    }
+
+    DetectorCore core;
+
+    int numChannels;
+    int maxBlockSize;
+    std::vector<float> bitVolts;
+
+    std::vector<sdd_electrode> electrodes;
+    std::vector<int> lastBufferIndex;
+
+    // the block being detected, and the scratch copy of blocks that need converting
+    std::vector<float*> blockData;
+    std::vector<float> samples;
+    std::vector<float*> channelData;
+    std::vector<int> blockNumSamples;
+    int64_t blockTimestamp;
+    int scanIndex;
+    const ElectrodeScan* scan;
+
+    std::vector<sdd_spike> queue;
+    int queueStart;
+    int numQueued;
+};
+
+static bool isValidElectrode(const sdd_electrode& electrode, int numChannels)
+{
+    if (electrode.num_channels < 1 || electrode.num_channels > SDD_MAX_CHANNELS
+        || electrode.pre_peak_samples < 1 || electrode.post_peak_samples < 1
+        || electrode.pre_peak_samples + electrode.post_peak_samples > SDD_MAX_SAMPLES
+        || int(electrode.noise_estimator) < 0 || int(electrode.noise_estimator) >= NumNoiseEstimators)
+        return false;
+
+    for (int chan = 0; chan < electrode.num_channels; chan++)
+    {
+        if (electrode.channels[chan] < 0 || electrode.channels[chan] >= numChannels)
+            return false;
+    }
+
+    return true;
+}
+
+void sdd_default_config(sdd_config* config)
+{
+    if (config == nullptr)
+        return;
+
+    config->sample_rate = 30000.0;
+    config->num_channels = 1;
+    config->format = SDD_FORMAT_FLOAT32;
+    config->bit_volts = nullptr;
+    config->max_block_size = 8192;
+    config->spike_queue_size = 4096;
+}
+
+void sdd_default_electrode(sdd_electrode* electrode, int electrode_id, int num_channels, int first_channel,
+                           double sample_rate)
+{
+    if (electrode == nullptr)
+        return;
+
+    electrode->electrode_id = electrode_id;
+    electrode->num_channels = num_channels;
+
+    for (int chan = 0; chan < SDD_MAX_CHANNELS; chan++)
+    {
+        electrode->channels[chan] = first_channel + chan;
+        electrode->thresholds[chan] = 4.0f;
+        electrode->active[chan] = 1;
+    }
+
+    // as in SpikeDetectorDynamic::createElectrode()
+    int prePeakSamples = std::max(1, int(std::floor(0.4 * sample_rate / 1000)));
+    int postPeakSamples = std::max(1, int(std::floor(0.7 * sample_rate / 1000)));
+
+    if (prePeakSamples + postPeakSamples > SDD_MAX_SAMPLES)
+    {
+        postPeakSamples = SDD_MAX_SAMPLES * 7 / 11;
+        prePeakSamples = SDD_MAX_SAMPLES - postPeakSamples;
+    }
+
+    electrode->pre_peak_samples = prePeakSamples;
+    electrode->post_peak_samples = postPeakSamples;
+    electrode->noise_estimator = SDD_NOISE_MEDIAN;
+}
+
+sdd_detector* sdd_create(const sdd_config* config, const sdd_electrode* electrodes, int num_electrodes)
+{
+    if (config == nullptr || ! (config->sample_rate > 0) || config->num_channels < 1
+        || config->max_block_size < 1 || config->spike_queue_size < 1
+        || (config->format != SDD_FORMAT_FLOAT32 && config->format != SDD_FORMAT_INT16)
+        || num_electrodes < 0 || (num_electrodes > 0 && electrodes == nullptr))
+        return nullptr;
+
+    for (int i = 0; i < num_electrodes; i++)
+    {
+        if (! isValidElectrode(electrodes[i], config->num_channels))
+            return nullptr;
+    }
+
+    try
+    {
+        return new sdd_detector(*config, electrodes, num_electrodes);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+void sdd_destroy(sdd_detector* detector)
+{
+    delete detector;
+}
+
+int sdd_push_float(sdd_detector* detector, const float* const* channels, int stride,
+                   int num_samples, int64_t timestamp)
+{
+    if (detector == nullptr)
+        return SDD_ERROR_INVALID_ARGUMENT;
+
+    if (detector->format != SDD_FORMAT_FLOAT32)
+        return SDD_ERROR_WRONG_FORMAT;
+
+    return detector->push(channels, stride, num_samples, timestamp);
+}
+
+int sdd_push_int16(sdd_detector* detector, const int16_t* const* channels, int stride,
+                   int num_samples, int64_t timestamp)
+{
+    if (detector == nullptr)
+        return SDD_ERROR_INVALID_ARGUMENT;
+
+    if (detector->format != SDD_FORMAT_INT16)
+        return SDD_ERROR_WRONG_FORMAT;
+
+    return detector->push(channels, stride, num_samples, timestamp);
+}
+
+int sdd_read_spikes(sdd_detector* detector, sdd_spike* spikes, int max_spikes)
+{
+    if (detector == nullptr || spikes == nullptr)
+        return 0;
+
+    return detector->readSpikes(spikes, max_spikes);
+}
+
+int64_t sdd_get_num_lost_spikes(const sdd_detector* detector)
+{
+    return detector != nullptr ? detector->numLost : 0;
+}
+
+void sdd_reset(sdd_detector* detector)
+{
+    if (detector != nullptr)
+        detector->reset();
+}
@@ -0,0 +1,150 @@
+
+#ifndef __SPIKEDETECTOR_H_9E3B2D17__
+#define __SPIKEDETECTOR_H_9E3B2D17__
+
+/**
+  C API of the dynamic-threshold spike detector, for use outside the Open
+  Ephys GUI. Blocks go through the same DetectorCore as in the plugin (see
+  DetectorCore.h for what the detection does).
+
+  Typical use:
+
+      sdd_config config;
+      sdd_default_config(&config);
+      config.num_channels = 32;
+
+      sdd_electrode electrodes[8];
+      for (int i = 0; i < 8; i++)
+          sdd_default_electrode(&electrodes[i], i, 4, 4 * i, config.sample_rate);
+
+      sdd_detector* detector = sdd_create(&config, electrodes, 8);
+
+      // for every block: one pointer per channel; stride 1 for planar
+      // buffers, the number of channels for interleaved ones
+      sdd_push_float(detector, channels, 1, num_samples, first_timestamp);
+      int n = sdd_read_spikes(detector, spikes, max_spikes);
+
+      sdd_destroy(detector);
+
+  Planar float blocks (stride 1) are read in place and never written to.
+  int16 and interleaved blocks are converted into buffers allocated by
+  sdd_create(). No block is kept after the call; push and read do not
+  allocate, so they can run on a real-time thread. A detector must not be used by two threads at the same
+  time.
+
+  Programs that link the DLL on Windows just include this header; the
+  library itself is built with SDD_BUILDING_LIBRARY, and SDD_STATIC_LIBRARY
+  selects a static build.
+*/
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined (_WIN32)
+ #if defined (SDD_STATIC_LIBRARY)
+  #define SDD_API
+ #elif defined (SDD_BUILDING_LIBRARY)
+  #define SDD_API __declspec(dllexport)
+ #else
+  #define SDD_API __declspec(dllimport)
+ #endif
+#else
+ #define SDD_API __attribute__((visibility("default")))
+#endif
+
+#define SDD_MAX_CHANNELS 4
+#define SDD_MAX_SAMPLES 80
+
+/* return codes */
+#define SDD_OK 0
+#define SDD_ERROR_INVALID_ARGUMENT -1
+#define SDD_ERROR_WRONG_FORMAT -2
+
+typedef enum
+{
+    SDD_FORMAT_FLOAT32 = 0,     /* microvolts */
+    SDD_FORMAT_INT16 = 1        /* ADC counts, scaled by bit_volts */
+} sdd_sample_format;
+
+typedef enum
+{
+    SDD_NOISE_MEDIAN = 0,
+    SDD_NOISE_RUNNING_MAD = 1,
+    SDD_NOISE_RMS = 2
+} sdd_noise_estimator;
+
+typedef struct
+{
+    double sample_rate;
+    int num_channels;
+    sdd_sample_format format;
+    const float* bit_volts;     /* microvolts per count, one per channel; NULL for 0.195 */
+    int max_block_size;         /* longest block that will be pushed */
+    int spike_queue_size;       /* spikes kept until read */
+} sdd_config;
+
+typedef struct
+{
+    int electrode_id;
+    int num_channels;
+    int channels[SDD_MAX_CHANNELS];
+    float thresholds[SDD_MAX_CHANNELS];     /* multiples of the noise level */
+    int active[SDD_MAX_CHANNELS];
+    int pre_peak_samples;
+    int post_peak_samples;
+    sdd_noise_estimator noise_estimator;
+} sdd_electrode;
+
+typedef struct
+{
+    int electrode;                  /* index into the layout */
+    int electrode_id;
+    int64_t timestamp;              /* of the peak */
+    int num_channels;
+    int num_samples;
+    float thresholds[SDD_MAX_CHANNELS];     /* microvolts */
+    uint16_t data[SDD_MAX_CHANNELS * SDD_MAX_SAMPLES];  /* num_samples per channel, counts + 32768 */
+} sdd_spike;
+
+typedef struct sdd_detector sdd_detector;
+
+/** 30 kHz, 1 channel, float samples, blocks of up to 8192 samples, 4096 queued spikes. */
+SDD_API void sdd_default_config(sdd_config* config);
+
+/** Threshold 4, all channels active, median noise, and the waveform window
+    of the plugin: 0.4 ms before and 0.7 ms after the peak at this sample
+    rate (shortened to fit SDD_MAX_SAMPLES at very high rates). */
+SDD_API void sdd_default_electrode(sdd_electrode* electrode, int electrode_id,
+                                   int num_channels, int first_channel, double sample_rate);
+
+/** Returns NULL if the configuration or the layout is invalid. */
+SDD_API sdd_detector* sdd_create(const sdd_config* config, const sdd_electrode* electrodes,
+                                 int num_electrodes);
+
+SDD_API void sdd_destroy(sdd_detector* detector);
+
+/** Detects spikes in a block. Sample i of channel c is channels[c][i * stride];
+    timestamp is the timestamp of sample 0. Returns an SDD_ code. */
+SDD_API int sdd_push_float(sdd_detector* detector, const float* const* channels, int stride,
+                           int num_samples, int64_t timestamp);
+
+SDD_API int sdd_push_int16(sdd_detector* detector, const int16_t* const* channels, int stride,
+                           int num_samples, int64_t timestamp);
+
+/** Moves up to max_spikes detected spikes into spikes; returns their number. */
+SDD_API int sdd_read_spikes(sdd_detector* detector, sdd_spike* spikes, int max_spikes);
+
+/** Spikes dropped because the queue was full. */
+SDD_API int64_t sdd_get_num_lost_spikes(const sdd_detector* detector);
+
+/** Starts again as if no block had been pushed. */
+SDD_API void sdd_reset(sdd_detector* detector);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __SPIKEDETECTOR_H_9E3B2D17__
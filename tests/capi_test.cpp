@@ -0,0 +1,287 @@
+// Pushes a synthetic recording through the C API in its different formats
+// and layouts and checks that they detect the same spikes: float and int16
+// blocks, planar (read in place) and interleaved buffers, and a detector
+// that was reset.
+// Also checks the default electrode against the plugin's waveform window.
+
+#include "spikedetector.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static int numFailures = 0;
+
+static void check(bool condition, const char* what)
+{
+    if (! condition)
+    {
+        printf("FAILED: %s\n", what);
+        numFailures++;
+    }
+}
+
+static const int numChannels = 4;
+static const int numSamples = 120000;
+static const int spikeInterval = 997;
+static const float bitVolts = 0.195f;
+
+/** Noise of about 20 counts on every channel, with a negative spike every
+    spikeInterval samples whose peak is 2 samples after its start. */
+static std::vector<int16_t> makeRecording()
+{
+    static const int spikeShape[] = { -100, -250, -400, -200, -80 };
+
+    std::vector<int16_t> counts(size_t(numChannels) * numSamples);
+    uint32_t seed = 12345;
+
+    for (int chan = 0; chan < numChannels; chan++)
+    {
+        for (int n = 0; n < numSamples; n++)
+        {
+            int value = 0;
+
+            for (int k = 0; k < 4; k++)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                value += int(seed >> 26) - 32;
+            }
+
+            if (n % spikeInterval >= 500 && n % spikeInterval < 505 && (n / spikeInterval) % numChannels == chan)
+                value += spikeShape[n % spikeInterval - 500];
+
+            counts[size_t(chan) * numSamples + n] = int16_t(value);
+        }
+    }
+
+    return counts;
+}
+
+static void defaultLayout(sdd_electrode* electrodes)
+{
+    sdd_default_electrode(&electrodes[0], 10, 2, 0, 30000.0);
+    sdd_default_electrode(&electrodes[1], 11, 2, 2, 30000.0);
+    electrodes[1].noise_estimator = SDD_NOISE_RUNNING_MAD;
+}
+
+static sdd_detector* createDetector(sdd_sample_format format)
+{
+    static const float channelBitVolts[numChannels] = { bitVolts, bitVolts, bitVolts, bitVolts };
+
+    sdd_config config;
+    sdd_default_config(&config);
+    config.num_channels = numChannels;
+    config.format = format;
+    config.bit_volts = channelBitVolts;
+    config.max_block_size = 2048;
+
+    sdd_electrode electrodes[2];
+    defaultLayout(electrodes);
+
+    return sdd_create(&config, electrodes, 2);
+}
+
+static void readSpikes(sdd_detector* detector, std::vector<sdd_spike>& spikes)
+{
+    sdd_spike buffer[64];
+    int numRead;
+
+    while ((numRead = sdd_read_spikes(detector, buffer, 64)) > 0)
+        spikes.insert(spikes.end(), buffer, buffer + numRead);
+}
+
+/** Blocks of changing length, so that spikes and noise windows straddle them. */
+static int getBlockSize(int block)
+{
+    static const int sizes[] = { 1024, 333, 2048, 97, 1500, 640 };
+    return sizes[block % 6];
+}
+
+static std::vector<sdd_spike> detectFloat(sdd_detector* detector, const std::vector<int16_t>& counts,
+                                          bool interleaved)
+{
+    std::vector<float> samples(counts.size());
+
+    for (int chan = 0; chan < numChannels; chan++)
+    {
+        for (int n = 0; n < numSamples; n++)
+        {
+            float value = float(counts[size_t(chan) * numSamples + n]) * bitVolts;
+
+            if (interleaved)
+                samples[size_t(n) * numChannels + chan] = value;
+            else
+                samples[size_t(chan) * numSamples + n] = value;
+        }
+    }
+
+    std::vector<float> pushed = samples;
+    std::vector<sdd_spike> spikes;
+    const float* channels[numChannels];
+
+    for (int start = 0, block = 0; start < numSamples; block++)
+    {
+        int blockSize = std::min(getBlockSize(block), numSamples - start);
+
+        for (int chan = 0; chan < numChannels; chan++)
+            channels[chan] = interleaved ? &samples[size_t(start) * numChannels + chan]
+                                         : &samples[size_t(chan) * numSamples + start];
+
+        check(sdd_push_float(detector, channels, interleaved ? numChannels : 1, blockSize, start) == SDD_OK,
+              "float block accepted");
+        readSpikes(detector, spikes);
+        start += blockSize;
+    }
+
+    // planar blocks are read in place
+    check(samples == pushed, "pushed samples left unchanged");
+
+    return spikes;
+}
+
+static std::vector<sdd_spike> detectInt16(sdd_detector* detector, const std::vector<int16_t>& counts)
+{
+    std::vector<sdd_spike> spikes;
+    const int16_t* channels[numChannels];
+
+    for (int start = 0, block = 0; start < numSamples; block++)
+    {
+        int blockSize = std::min(getBlockSize(block), numSamples - start);
+
+        for (int chan = 0; chan < numChannels; chan++)
+            channels[chan] = &counts[size_t(chan) * numSamples + start];
+
+        check(sdd_push_int16(detector, channels, 1, blockSize, start) == SDD_OK, "int16 block accepted");
+        readSpikes(detector, spikes);
+        start += blockSize;
+    }
+
+    return spikes;
+}
+
+/** Same spikes; waveform samples may differ by maxDifference counts. */
+static bool sameSpikes(const std::vector<sdd_spike>& a, const std::vector<sdd_spike>& b, int maxDifference)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i].electrode != b[i].electrode || a[i].electrode_id != b[i].electrode_id
+            || a[i].timestamp != b[i].timestamp || a[i].num_channels != b[i].num_channels
+            || a[i].num_samples != b[i].num_samples)
+            return false;
+
+        for (int chan = 0; chan < a[i].num_channels; chan++)
+        {
+            if (a[i].thresholds[chan] != b[i].thresholds[chan])
+                return false;
+        }
+
+        for (int n = 0; n < a[i].num_channels * a[i].num_samples; n++)
+        {
+            if (std::abs(int(a[i].data[n]) - int(b[i].data[n])) > maxDifference)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+static void testDefaultElectrode()
+{
+    sdd_electrode electrode;
+
+    sdd_default_electrode(&electrode, 3, 4, 8, 30000.0);
+    check(electrode.pre_peak_samples == 12 && electrode.post_peak_samples == 21, "0.4 + 0.7 ms at 30 kHz");
+    check(electrode.electrode_id == 3 && electrode.num_channels == 4 && electrode.channels[3] == 11,
+          "default electrode channels");
+
+    sdd_default_electrode(&electrode, 0, 1, 0, 20000.0);
+    check(electrode.pre_peak_samples == 8 && electrode.post_peak_samples == 14, "0.4 + 0.7 ms at 20 kHz");
+
+    sdd_default_electrode(&electrode, 0, 1, 0, 200000.0);
+    check(electrode.pre_peak_samples + electrode.post_peak_samples <= SDD_MAX_SAMPLES
+          && electrode.pre_peak_samples < electrode.post_peak_samples, "window shortened at 200 kHz");
+}
+
+static void testDetection()
+{
+    std::vector<int16_t> counts = makeRecording();
+
+    sdd_detector* floatDetector = createDetector(SDD_FORMAT_FLOAT32);
+    sdd_detector* int16Detector = createDetector(SDD_FORMAT_INT16);
+
+    check(floatDetector != nullptr && int16Detector != nullptr, "detectors created");
+
+    if (floatDetector == nullptr || int16Detector == nullptr)
+        return;
+
+    const int16_t* channels[numChannels] = {};
+    check(sdd_push_float(int16Detector, nullptr, 1, 0, 0) == SDD_ERROR_WRONG_FORMAT, "format checked");
+    check(sdd_push_int16(int16Detector, channels, 1, 4096, 0) == SDD_ERROR_INVALID_ARGUMENT, "block size checked");
+
+    std::vector<sdd_spike> planar = detectFloat(floatDetector, counts, false);
+
+    sdd_reset(floatDetector);
+    std::vector<sdd_spike> interleaved = detectFloat(floatDetector, counts, true);
+    std::vector<sdd_spike> fromCounts = detectInt16(int16Detector, counts);
+
+    int numInserted = numSamples / spikeInterval;
+    int numFound = 0;
+    int numFalse = 0;
+
+    for (size_t i = 0; i < fromCounts.size(); i++)
+    {
+        const sdd_spike& spike = fromCounts[i];
+        int64_t position = spike.timestamp % spikeInterval;
+
+        if (position == 502)
+            numFound++;
+        else if (spike.timestamp >= 10000)  // the running MAD settles in the first blocks
+            numFalse++;
+
+        // int16 waveforms hold the pushed counts, from 11 samples before the peak
+        int start = int(spike.timestamp) - 11;
+        bool exact = true;
+
+        for (int chan = 0; chan < spike.num_channels; chan++)
+        {
+            int inputChannel = 2 * spike.electrode + chan;
+
+            for (int n = 0; n < spike.num_samples; n++)
+            {
+                int index = start + n;
+                int expected = index >= 0 && index < numSamples ? counts[size_t(inputChannel) * numSamples + index] : 0;
+                exact = exact && spike.data[chan * spike.num_samples + n] == uint16_t(expected + 32768);
+            }
+        }
+
+        check(exact, "int16 waveform holds the pushed counts");
+    }
+
+    printf("%zu spikes, %d of %d inserted spikes found, %d others after 10000 samples\n",
+           fromCounts.size(), numFound, numInserted, numFalse);
+
+    check(numFound >= numInserted * 9 / 10, "inserted spikes found");
+    check(numFalse <= numInserted / 20, "few false positives");
+    check(sameSpikes(planar, interleaved, 0), "planar and interleaved blocks give the same spikes");
+    check(sameSpikes(planar, fromCounts, 1), "float and int16 blocks give the same spikes");
+    check(sdd_get_num_lost_spikes(floatDetector) == 0, "no spikes lost");
+
+    sdd_destroy(floatDetector);
+    sdd_destroy(int16Detector);
+}
+
+int main()
+{
+    testDefaultElectrode();
+    testDetection();
+
+    if (numFailures > 0)
+        return 1;
+
+    printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,245 @@
+// Round trip of the compressed spike encoding (WaveformCodec.h): tetrode
+// spikes with blank channels, full-range deltas that need the widest (17 bit)
+// packing, single-sample waveforms, and truncated or corrupted events, which
+// must be rejected without reading past their end.
+// Also prints the compression ratio and the encoding throughput on synthetic
+// spikes, like the plugin does when acquisition stops.
+//
+// The codec only needs SpikeObject from the Open Ephys headers; tests/openephys
+// provides it.
+
+#include "../SpikeDetectorDynamic/WaveformCodec.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+static int numFailures = 0;
+
+static void check(bool condition, const char* what)
+{
+    if (! condition)
+    {
+        printf("FAILED: %s\n", what);
+        numFailures++;
+    }
+}
+
+static uint32_t seed = 12345;
+
+static int nextRandom(int range)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return int((seed >> 8) % uint32_t(range));
+}
+
+static void makeSpike(SpikeObject& s, int nChannels, int nSamples)
+{
+    memset(&s, 0, sizeof(s));
+    s.eventType = SPIKE_EVENT_CODE;
+    s.timestamp = 1234567890123ll;
+    s.timestamp_software = -1;
+    s.source = 3;
+    s.nChannels = uint16_t(nChannels);
+    s.nSamples = uint16_t(nSamples);
+    s.sortedId = 2;
+    s.electrodeID = 17;
+    s.channel = 1;
+    s.color[0] = 10;
+    s.color[1] = 20;
+    s.color[2] = 30;
+    s.pcProj[0] = 1.5f;
+    s.pcProj[1] = -2.25f;
+    s.samplingFrequencyHz = 30000;
+
+    for (int chan = 0; chan < nChannels; chan++)
+    {
+        s.gain[chan] = 5128.2f + chan;
+        s.threshold[chan] = uint16_t(40 + chan);
+    }
+}
+
+/** A negative spike of about 100 uV in 10 uV of smooth noise, in the offset
+    counts of 0.195 uV the plugin packs. */
+static void fillWaveforms(SpikeObject& s)
+{
+    for (int chan = 0; chan < s.nChannels; chan++)
+    {
+        int noise = 0;
+
+        for (int i = 0; i < s.nSamples; i++)
+        {
+            noise = (noise * 3) / 4 + nextRandom(41) - 20;
+            double spike = -500.0 * exp(-0.5 * (i - 8) * (i - 8) / 4.0) / (chan + 1);
+            s.data[chan * s.nSamples + i] = uint16_t(32768 + noise * 2 + int(spike));
+        }
+    }
+}
+
+static bool sameSpike(const SpikeObject& a, const SpikeObject& b)
+{
+    if (a.timestamp != b.timestamp || a.timestamp_software != b.timestamp_software
+        || a.source != b.source || a.nChannels != b.nChannels || a.nSamples != b.nSamples
+        || a.sortedId != b.sortedId || a.electrodeID != b.electrodeID || a.channel != b.channel
+        || memcmp(a.color, b.color, 3) != 0 || a.pcProj[0] != b.pcProj[0] || a.pcProj[1] != b.pcProj[1]
+        || a.samplingFrequencyHz != b.samplingFrequencyHz)
+        return false;
+
+    for (int chan = 0; chan < a.nChannels; chan++)
+    {
+        if (a.gain[chan] != b.gain[chan] || a.threshold[chan] != b.threshold[chan])
+            return false;
+    }
+
+    return memcmp(a.data, b.data, sizeof(uint16_t) * a.nChannels * a.nSamples) == 0;
+}
+
+/** Packs and unpacks s; returns the packed size, or 0 on failure. */
+static int roundTrip(const SpikeObject& s, const char* what)
+{
+    uint8_t buffer[2048];
+    int size = packCompressedSpike(&s, buffer, sizeof(buffer));
+
+    check(size > 0, what);
+
+    SpikeObject decoded;
+    memset(&decoded, 0xff, sizeof(decoded));
+
+    bool isDecoded = unpackCompressedSpike(&decoded, buffer, size);
+    check(isDecoded, what);
+    check(isDecoded && decoded.eventType == COMPRESSED_SPIKE_EVENT_CODE, what);
+    check(isDecoded && sameSpike(s, decoded), what);
+
+    return size;
+}
+
+static void testRoundTrip()
+{
+    SpikeObject s;
+
+    makeSpike(s, 4, 40);
+    fillWaveforms(s);
+    roundTrip(s, "tetrode spike round trip");
+
+    // inactive channels are constant and take no bits beyond their header
+    SpikeObject blank = s;
+
+    for (int i = 0; i < blank.nSamples; i++)
+    {
+        blank.data[1 * blank.nSamples + i] = 32768;
+        blank.data[3 * blank.nSamples + i] = 0;
+    }
+
+    int fullSize = roundTrip(s, "spike before blanking");
+    int blankSize = roundTrip(blank, "spike with blank channels");
+    check(blankSize < fullSize, "blank channels are smaller");
+
+    // 0 -> 65535 -> 0: deltas of +-65535, the widest the codec packs
+    SpikeObject extreme;
+    makeSpike(extreme, 4, MAX_NUMBER_OF_SPIKE_CHANNEL_SAMPLES);
+
+    for (int chan = 0; chan < extreme.nChannels; chan++)
+    {
+        for (int i = 0; i < extreme.nSamples; i++)
+            extreme.data[chan * extreme.nSamples + i] = uint16_t((i + chan) % 2 == 0 ? 0 : 65535);
+    }
+
+    int extremeSize = roundTrip(extreme, "full-range deltas (17 bits)");
+    check(extremeSize > getFullWidthSpikeSize(&extreme), "full-range deltas take 17 bits per sample");
+
+    SpikeObject single;
+    makeSpike(single, 2, 1);
+    single.data[0] = 123;
+    single.data[1] = 65535;
+    roundTrip(single, "single-sample waveforms");
+
+    SpikeObject tooLong;
+    makeSpike(tooLong, 4, MAX_NUMBER_OF_SPIKE_CHANNEL_SAMPLES + 1);
+    uint8_t buffer[2048];
+    check(packCompressedSpike(&tooLong, buffer, sizeof(buffer)) == 0, "too many samples are not packed");
+}
+
+static void testTruncated()
+{
+    SpikeObject s;
+    makeSpike(s, 4, 40);
+    fillWaveforms(s);
+
+    uint8_t buffer[2048];
+    int size = packCompressedSpike(&s, buffer, sizeof(buffer));
+
+    check(packCompressedSpike(&s, buffer, size - 1) == 0, "packing into a short buffer fails");
+
+    // every cut is rejected; the copy has no slack after it, so a read past
+    // the end shows up under sanitizers
+    bool allRejected = true;
+
+    for (int cut = 0; cut < size; cut++)
+    {
+        std::vector<uint8_t> truncated(buffer, buffer + cut);
+        SpikeObject decoded;
+
+        if (unpackCompressedSpike(&decoded, truncated.empty() ? nullptr : &truncated[0], cut))
+            allRejected = false;
+    }
+
+    check(allRejected, "truncated events are rejected");
+
+    SpikeObject decoded;
+    uint8_t corrupted[2048];
+
+    memcpy(corrupted, buffer, size);
+    corrupted[0] = SPIKE_EVENT_CODE;
+    check(! unpackCompressedSpike(&decoded, corrupted, size), "other event types are rejected");
+
+    // the bit width of the first channel follows the header, its gain and its threshold
+    memcpy(corrupted, buffer, size);
+    corrupted[1 + 8 + 8 + 6 * 2 + 3 + 2 * 4 + 2 + 4 + 2] = 18;
+    check(! unpackCompressedSpike(&decoded, corrupted, size), "bit widths above 17 are rejected");
+}
+
+static void reportCompression()
+{
+    const int numSpikes = 20000;
+
+    std::vector<SpikeObject> spikes(numSpikes);
+
+    for (int n = 0; n < numSpikes; n++)
+    {
+        makeSpike(spikes[n], 4, 40);
+        fillWaveforms(spikes[n]);
+    }
+
+    uint8_t buffer[2048];
+    long long compressedBytes = 0;
+    long long fullWidthBytes = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (int n = 0; n < numSpikes; n++)
+        compressedBytes += packCompressedSpike(&spikes[n], buffer, sizeof(buffer));
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (int n = 0; n < numSpikes; n++)
+        fullWidthBytes += getFullWidthSpikeSize(&spikes[n]);
+
+    printf("Compression of %d tetrode spikes: ratio %.2f, %.0f bytes per spike, %.2f Mspikes/s\n",
+           numSpikes, double(fullWidthBytes) / double(compressedBytes), double(compressedBytes) / numSpikes,
+           seconds > 0 ? numSpikes / seconds * 1.0e-6 : 0.0);
+}
+
+int main()
+{
+    testRoundTrip();
+    testTruncated();
+
+    if (numFailures > 0)
+        return 1;
+
+    reportCompression();
+
+    printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef __PROCESSORHEADERS_H_5B2E90C4__
+#define __PROCESSORHEADERS_H_5B2E90C4__
+
+// The few JUCE integer types that the plugin's standalone sources use, so
+// that tests can build them without the Open Ephys GUI. Only for tests/.
+
+#include <cstdint>
+#include <cstring>
+
+typedef int8_t int8;
+typedef uint8_t uint8;
+typedef int16_t int16;
+typedef uint16_t uint16;
+typedef int32_t int32;
+typedef uint32_t uint32;
+typedef int64_t int64;
+typedef uint64_t uint64;
+
+#endif  // __PROCESSORHEADERS_H_5B2E90C4__
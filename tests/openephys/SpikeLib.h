@@ -0,0 +1,34 @@
+#ifndef __SPIKELIB_H_0D7A63F1__
+#define __SPIKELIB_H_0D7A63F1__
+
+// SpikeObject as declared by the Open Ephys GUI (Processors/Visualization/
+// SpikeObject.h), field for field, for tests of the waveform encodings.
+// Only for tests/.
+
+#include "ProcessorHeaders.h"
+
+#define MAX_NUMBER_OF_SPIKE_CHANNELS 4
+#define MAX_NUMBER_OF_SPIKE_CHANNEL_SAMPLES 80
+
+#define SPIKE_EVENT_CODE 4
+
+struct SpikeObject
+{
+    uint8_t eventType;
+    int64_t timestamp;
+    int64_t timestamp_software;
+    uint16_t source;
+    uint16_t nChannels;
+    uint16_t nSamples;
+    uint16_t sortedId;
+    uint16_t electrodeID;
+    uint16_t channel;
+    uint8_t color[3];
+    float pcProj[2];
+    uint16_t samplingFrequencyHz;
+    uint16_t data[MAX_NUMBER_OF_SPIKE_CHANNELS * MAX_NUMBER_OF_SPIKE_CHANNEL_SAMPLES];
+    float gain[MAX_NUMBER_OF_SPIKE_CHANNELS];
+    uint16_t threshold[MAX_NUMBER_OF_SPIKE_CHANNELS];
+};
+
+#endif  // __SPIKELIB_H_0D7A63F1__
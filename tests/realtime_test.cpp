@@ -0,0 +1,469 @@
+// Checks that the detection path neither allocates nor blocks.
+//
+// This executable installs the allocator and blocking-call hooks of the audio
+// thread guard (see AudioThreadGuard.h) for the whole process, so that
+// allocations made inside the shared library and the C++ runtime are seen as
+// well. It then drives the C API and DetectorCore (with the band-pass filter,
+// every noise estimator and reused noise levels) inside a real-time scope and
+// fails if anything was reported. Setup happens outside the scope, as in the
+// plugin's enable().
+//
+// What the plugin does with a peak after the core is not covered, as it needs
+// the Open Ephys headers: rate limit and coincidence rejection, waveform
+// packing (WaveformCodec), the feature trailer (FeatureExtractor), sorting
+// (TemplateSorter), the shared-memory publish (SpikeStreamWriter), the
+// capture ring (BlockRecorder) and the pipelined hand-over (DetectionThread).
+// A plugin built with SPIKEDETECTOR_AUDIO_THREAD_GUARD=1 counts the blocking
+// calls marked in those paths, but nothing hooks its allocations.
+
+#include "../SpikeDetectorDynamic/AudioThreadGuard.h"
+#include "../SpikeDetectorDynamic/DetectorCore.h"
+#include "spikedetector.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <unistd.h>
+
+#if ! SPIKEDETECTOR_AUDIO_THREAD_GUARD
+ #error "build with SPIKEDETECTOR_AUDIO_THREAD_GUARD=1"
+#endif
+
+//==============================================================================
+// allocator hooks
+
+#if defined (__GLIBC__)
+
+// JUCE containers allocate through malloc() rather than operator new, so on
+// glibc the C allocator itself is interposed (operator new ends up here too)
+
+extern "C"
+{
+    void* __libc_malloc (size_t);
+    void* __libc_calloc (size_t, size_t);
+    void* __libc_realloc (void*, size_t);
+    void* __libc_memalign (size_t, size_t);
+    void __libc_free (void*);
+
+    void* malloc (size_t size)
+    {
+        AudioThreadGuard::reportAllocation();
+        return __libc_malloc(size);
+    }
+
+    void* calloc (size_t num, size_t size)
+    {
+        AudioThreadGuard::reportAllocation();
+        return __libc_calloc(num, size);
+    }
+
+    void* realloc (void* p, size_t size)
+    {
+        AudioThreadGuard::reportAllocation();
+        return __libc_realloc(p, size);
+    }
+
+    int posix_memalign (void** p, size_t alignment, size_t size)
+    {
+        AudioThreadGuard::reportAllocation();
+        *p = __libc_memalign(alignment, size);
+        return *p != nullptr ? 0 : ENOMEM;
+    }
+
+    void* aligned_alloc (size_t alignment, size_t size)
+    {
+        AudioThreadGuard::reportAllocation();
+        return __libc_memalign(alignment, size);
+    }
+
+    void free (void* p)
+    {
+        if (p != nullptr)
+            AudioThreadGuard::reportAllocation();
+
+        __libc_free(p);
+    }
+}
+
+#else
+
+namespace
+{
+    void* guardedAllocate(std::size_t size)
+    {
+        AudioThreadGuard::reportAllocation();
+
+        if (void* p = std::malloc(size == 0 ? 1 : size))
+            return p;
+
+        throw std::bad_alloc();
+    }
+
+    void guardedFree(void* p)
+    {
+        if (p != nullptr)
+            AudioThreadGuard::reportAllocation();
+
+        std::free(p);
+    }
+}
+
+void* operator new (std::size_t size)                                   { return guardedAllocate(size); }
+void* operator new[] (std::size_t size)                                 { return guardedAllocate(size); }
+void* operator new (std::size_t size, const std::nothrow_t&) noexcept   { try { return guardedAllocate(size); } catch (...) { return nullptr; } }
+void* operator new[] (std::size_t size, const std::nothrow_t&) noexcept { try { return guardedAllocate(size); } catch (...) { return nullptr; } }
+void operator delete (void* p) noexcept                                 { guardedFree(p); }
+void operator delete[] (void* p) noexcept                               { guardedFree(p); }
+void operator delete (void* p, std::size_t) noexcept                    { guardedFree(p); }
+void operator delete[] (void* p, std::size_t) noexcept                  { guardedFree(p); }
+void operator delete (void* p, const std::nothrow_t&) noexcept          { guardedFree(p); }
+void operator delete[] (void* p, const std::nothrow_t&) noexcept        { guardedFree(p); }
+
+#endif
+
+//==============================================================================
+// blocking-call hooks: locks, sleeps and I/O, forwarded to the next definition
+
+namespace
+{
+    template <typename Function>
+    Function findNext(const char* name)
+    {
+        return reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+    }
+
+    struct BlockingFunctions
+    {
+        // resolved before main(), as dlsym() may allocate
+        BlockingFunctions()
+            : mutexLock(findNext<int (*)(pthread_mutex_t*)>("pthread_mutex_lock")),
+              semWait(findNext<int (*)(sem_t*)>("sem_wait")),
+              nanoSleep(findNext<int (*)(const timespec*, timespec*)>("nanosleep")),
+              uSleep(findNext<int (*)(useconds_t)>("usleep")),
+              writeFile(findNext<ssize_t (*)(int, const void*, size_t)>("write")),
+              writeStream(findNext<size_t (*)(const void*, size_t, size_t, FILE*)>("fwrite"))
+        {
+            AudioThreadGuard::setAllocationsHooked();
+        }
+
+        int (*mutexLock)(pthread_mutex_t*);
+        int (*semWait)(sem_t*);
+        int (*nanoSleep)(const timespec*, timespec*);
+        int (*uSleep)(useconds_t);
+        ssize_t (*writeFile)(int, const void*, size_t);
+        size_t (*writeStream)(const void*, size_t, size_t, FILE*);
+    };
+
+    const BlockingFunctions& getBlockingFunctions()
+    {
+        static BlockingFunctions functions;
+        return functions;
+    }
+
+    const BlockingFunctions& blockingFunctions = getBlockingFunctions();
+}
+
+extern "C"
+{
+    int pthread_mutex_lock (pthread_mutex_t* mutex)
+    {
+        AudioThreadGuard::reportBlockingCall(__func__);
+        return getBlockingFunctions().mutexLock(mutex);
+    }
+
+    int sem_wait (sem_t* semaphore)
+    {
+        AudioThreadGuard::reportBlockingCall(__func__);
+        return getBlockingFunctions().semWait(semaphore);
+    }
+
+    int nanosleep (const timespec* duration, timespec* remaining)
+    {
+        AudioThreadGuard::reportBlockingCall(__func__);
+        return getBlockingFunctions().nanoSleep(duration, remaining);
+    }
+
+    int usleep (useconds_t duration)
+    {
+        AudioThreadGuard::reportBlockingCall(__func__);
+        return getBlockingFunctions().uSleep(duration);
+    }
+
+    ssize_t write (int file, const void* data, size_t size)
+    {
+        AudioThreadGuard::reportBlockingCall(__func__);
+        return getBlockingFunctions().writeFile(file, data, size);
+    }
+
+    size_t fwrite (const void* data, size_t size, size_t count, FILE* stream)
+    {
+        AudioThreadGuard::reportBlockingCall(__func__);
+        return getBlockingFunctions().writeStream(data, size, count, stream);
+    }
+}
+
+//==============================================================================
+
+static int numFailures = 0;
+
+static void check(bool condition, const char* what)
+{
+    if (! condition)
+    {
+        printf("FAILED: %s\n", what);
+        numFailures++;
+    }
+}
+
+static const int numChannels = 8;
+static const int maxBlockSize = 2048;
+static const int numBlocks = 400;
+
+static float getSample(int chan, int64_t index)
+{
+    // noise of about 20 uV with a spike every 700 samples
+    uint32_t hash = uint32_t(index * 2654435761u) ^ uint32_t(chan * 40503u);
+    hash ^= hash >> 13;
+    hash *= 0x5bd1e995u;
+    hash ^= hash >> 15;
+
+    float value = (float(hash & 0xffff) / 65536.0f - 0.5f) * 70.0f;
+
+    if (index % 700 >= 300 && index % 700 < 304)
+        value -= 150.0f * (1 + int(index % 700) - 300);
+
+    return value;
+}
+
+static int getBlockSize(int block)
+{
+    static const int sizes[] = { 1024, 37, 2048, 500, 101, 1500, 640, 99 };
+    return sizes[block % 8];
+}
+
+class PeakCounter : public DetectorCore::Listener
+{
+public:
+    PeakCounter() : numPeaks(0) {}
+
+    void peakFound(int, int, int, float) override
+    {
+        numPeaks++;
+    }
+
+    int numPeaks;
+};
+
+/** The guard must see what it is meant to catch. */
+static void testHooks()
+{
+    int64_t allocations = AudioThreadGuard::getNumAllocations();
+    int64_t blockingCalls = AudioThreadGuard::getNumBlockingCalls();
+
+    {
+        AUDIO_THREAD_SCOPE
+        std::vector<float> values(16);
+        usleep(0);
+        check(AudioThreadGuard::isInsideScope(), "scope open");
+    }
+
+    check(! AudioThreadGuard::isInsideScope(), "scope closed");
+    check(AudioThreadGuard::getNumAllocations() - allocations == 2, "allocation and release counted");
+    check(AudioThreadGuard::getNumBlockingCalls() - blockingCalls == 1, "blocking call counted");
+
+    std::vector<float> values(16);
+    usleep(0);
+
+    check(AudioThreadGuard::getNumAllocations() - allocations == 2, "allocations outside the scope not counted");
+    check(AudioThreadGuard::getNumBlockingCalls() - blockingCalls == 1, "blocking calls outside the scope not counted");
+}
+
+static void testCApi()
+{
+    sdd_config config;
+    sdd_default_config(&config);
+    config.num_channels = numChannels;
+    config.max_block_size = maxBlockSize;
+    config.spike_queue_size = 64;
+
+    sdd_electrode electrodes[3];
+    sdd_default_electrode(&electrodes[0], 0, 4, 0, config.sample_rate);
+    sdd_default_electrode(&electrodes[1], 1, 4, 4, config.sample_rate);
+    sdd_default_electrode(&electrodes[2], 2, 2, 3, config.sample_rate);
+    electrodes[1].noise_estimator = SDD_NOISE_RUNNING_MAD;
+    electrodes[2].noise_estimator = SDD_NOISE_RMS;
+    electrodes[2].active[1] = 0;
+
+    sdd_detector* floatDetector = sdd_create(&config, electrodes, 3);
+    config.format = SDD_FORMAT_INT16;
+    sdd_detector* int16Detector = sdd_create(&config, electrodes, 3);
+
+    check(floatDetector != nullptr && int16Detector != nullptr, "detectors created");
+
+    if (floatDetector == nullptr || int16Detector == nullptr)
+        return;
+
+    // interleaved, as a driver would deliver them
+    std::vector<float> floatSamples(size_t(numChannels) * maxBlockSize);
+    std::vector<int16_t> int16Samples(size_t(numChannels) * maxBlockSize);
+    const float* floatChannels[numChannels];
+    const int16_t* int16Channels[numChannels];
+    sdd_spike spikes[16];
+
+    for (int chan = 0; chan < numChannels; chan++)
+    {
+        floatChannels[chan] = &floatSamples[chan];
+        int16Channels[chan] = &int16Samples[chan];
+    }
+
+    int64_t allocations = AudioThreadGuard::getNumAllocations();
+    int64_t blockingCalls = AudioThreadGuard::getNumBlockingCalls();
+    int64_t position = 0;
+    int numSpikes = 0;
+
+    for (int block = 0; block < numBlocks; block++)
+    {
+        int blockSize = getBlockSize(block);
+
+        for (int n = 0; n < blockSize; n++)
+        {
+            for (int chan = 0; chan < numChannels; chan++)
+            {
+                float value = getSample(chan, position + n);
+                floatSamples[size_t(n) * numChannels + chan] = value;
+                int16Samples[size_t(n) * numChannels + chan] = int16_t(std::lround(value / 0.195f));
+            }
+        }
+
+        AUDIO_THREAD_SCOPE
+
+        check(sdd_push_float(floatDetector, floatChannels, numChannels, blockSize, position) == SDD_OK,
+              "float block accepted");
+        check(sdd_push_int16(int16Detector, int16Channels, numChannels, blockSize, position) == SDD_OK,
+              "int16 block accepted");
+
+        int numRead;
+
+        while ((numRead = sdd_read_spikes(floatDetector, spikes, 16)) > 0)
+            numSpikes += numRead;
+
+        while ((numRead = sdd_read_spikes(int16Detector, spikes, 16)) > 0)
+            numSpikes += numRead;
+
+        position += blockSize;
+    }
+
+    printf("C API: %d spikes, %lld allocations, %lld blocking calls\n", numSpikes,
+           (long long) (AudioThreadGuard::getNumAllocations() - allocations),
+           (long long) (AudioThreadGuard::getNumBlockingCalls() - blockingCalls));
+
+    check(numSpikes > 0, "C API found spikes");
+    check(AudioThreadGuard::getNumAllocations() == allocations, "C API does not allocate");
+    check(AudioThreadGuard::getNumBlockingCalls() == blockingCalls, "C API does not block");
+
+    sdd_destroy(floatDetector);
+    sdd_destroy(int16Detector);
+}
+
+static void testDetectorCore()
+{
+    BandpassFilter filter;
+    filter.setCutoffs(30000.0, 300.0, 6000.0);
+
+    DetectorCore core;
+    core.prepare(numChannels, maxBlockSize);
+    core.setSampleRate(30000.0);
+    core.setFilter(&filter);
+    core.setNoiseHoldBlocks(3);
+
+    std::vector<float> samples(size_t(numChannels) * maxBlockSize);
+    std::vector<float*> channelData(numChannels);
+    std::vector<int> numSamples(numChannels);
+    std::vector<int> lastBufferIndex(numChannels, 0);
+    PeakCounter counter;
+
+    for (int chan = 0; chan < numChannels; chan++)
+        channelData[chan] = &samples[size_t(chan) * maxBlockSize];
+
+    int64_t allocations = AudioThreadGuard::getNumAllocations();
+    int64_t blockingCalls = AudioThreadGuard::getNumBlockingCalls();
+    int64_t position = 0;
+
+    for (int block = 0; block < numBlocks; block++)
+    {
+        int blockSize = getBlockSize(block);
+
+        for (int chan = 0; chan < numChannels; chan++)
+        {
+            for (int n = 0; n < blockSize; n++)
+                channelData[chan][n] = getSample(chan, position + n);
+
+            numSamples[chan] = blockSize;
+        }
+
+        AUDIO_THREAD_SCOPE
+
+        core.beginBlock(&channelData[0], &numSamples[0], numChannels, blockSize);
+
+        // one single-channel electrode per input, cycling through the
+        // estimators, with reused levels every other block on half of them
+        for (int chan = 0; chan < numChannels; chan++)
+        {
+            ElectrodeScan scan;
+            scan.numChannels = 1;
+            scan.channels[0] = chan;
+            scan.thresholds[0] = 4.0f;
+            scan.prePeakSamples = 12;
+            scan.postPeakSamples = 21;
+            scan.lastWindow[0] = core.getLastWindow(chan);
+
+            if (chan == numChannels - 1)
+            {
+                // not scanned, but filtered all the same
+                core.filterChannel(chan);
+                scan.noiseLevels[0] = nullptr;
+                scan.tileMaxima[0] = nullptr;
+            }
+            else
+            {
+                int estimator = chan % NumNoiseEstimators;
+                scan.noiseLevels[0] = core.getNoiseLevels(chan, estimator, chan % 2 == 1 && block % 2 == 1);
+                scan.tileMaxima[0] = core.getTileMaxima(chan, estimator);
+            }
+
+            lastBufferIndex[chan] = core.scanElectrode(scan, lastBufferIndex[chan], counter);
+        }
+
+        core.endBlock();
+        position += blockSize;
+    }
+
+    printf("DetectorCore: %d peaks, %lld allocations, %lld blocking calls\n", counter.numPeaks,
+           (long long) (AudioThreadGuard::getNumAllocations() - allocations),
+           (long long) (AudioThreadGuard::getNumBlockingCalls() - blockingCalls));
+
+    check(counter.numPeaks > 0, "DetectorCore found peaks");
+    check(AudioThreadGuard::getNumAllocations() == allocations, "DetectorCore does not allocate");
+    check(AudioThreadGuard::getNumBlockingCalls() == blockingCalls, "DetectorCore does not block");
+}
+
+int main()
+{
+    testHooks();
+    testCApi();
+    testDetectorCore();
+
+    if (numFailures > 0)
+        return 1;
+
+    printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,756 @@
+// Random differential test of DetectorCore against a frozen reference of the
+// whole detection: the band-pass filter, the noise level of each window with
+// each estimator (exact median computed with a plain sort, running MAD and
+// RMS with their state carried across blocks), and the scalar sample-by-sample
+// scan with its dead time, the overflow tail read through negative indices and
+// the carry-over of lastBufferIndex. This is the only reference of the
+// detection; the plugin has none of its own.
+//
+//     reference_test [seed] [blocks]
+//
+// Random recordings (noise of changing level, bursts of spikes, silent
+// stretches) are cut into blocks of random length, from a few samples to
+// several noise windows, and pushed through both with random electrode
+// layouts, estimators, filter cutoffs and warm-start levels, at every SIMD
+// level this CPU supports. The filtered samples, the noise levels of every
+// window and the crossing and peak of every spike must be identical. The
+// first divergence is printed with everything needed to reproduce it, and the
+// run fails if one of the edge cases below was never reached.
+
+#include "../SpikeDetectorDynamic/DetectorCore.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+struct Peak
+{
+    int chan;
+    int crossingIndex;
+    int peakIndex;
+
+    bool operator!= (const Peak& other) const
+    {
+        return chan != other.chan || crossingIndex != other.crossingIndex || peakIndex != other.peakIndex;
+    }
+};
+
+/** Edge cases the run must reach to pass. */
+struct Coverage
+{
+    long long scansFromTail;        // scan resumed at a negative lastBufferIndex
+    long long scansPastStart;       // scan resumed after the first sample (dead time over the block end)
+    long long peaksInTail;          // crossing in the previous block, found in this one
+    long long peaksPastEnd;         // waveform runs past the valid samples
+    long long partialWindows;       // last noise window of a block ends mid-block
+    long long shortBlocks;          // blocks no longer than the tail
+    long long unscannedElectrodes;  // electrodes without an active channel
+    long long windows[NumNoiseEstimators];  // noise windows per estimator
+    long long coldWindows;          // running MAD or RMS windows bootstrapped from the median
+    long long rmsSamplesLeftOut;    // samples beyond the clip level of the RMS
+    long long filteredBlocks;       // blocks band-passed before the noise pass
+    long long warmStarts;           // estimators seeded with an earlier level
+};
+
+/**
+  The frozen reference. Keep it in step with the behaviour of the detection,
+  never with its implementation: an optional band-pass (2nd-order Butterworth
+  high-pass then low-pass, transposed direct form II in double) over the valid
+  samples of each block, noise windows of 200 samples from sample -50 up to
+  the last sample the scan reads, the noise level of each from the state of
+  its estimator, and the scan of the plugin.
+*/
+class ReferenceDetection
+{
+public:
+    static const int tailSize = 100;
+    static const int windowSize = 200;
+    static const int noiseWindowStart = -50;
+
+    ReferenceDetection(int numChannels, double sampleRate, Coverage& coverage_)
+        : tails(numChannels, std::vector<float>(tailSize, 0.0f)),
+          filterState(numChannels, std::vector<double>(4, 0.0)), isFiltered(false),
+          state(NumNoiseEstimators * numChannels), levels(NumNoiseEstimators * numChannels),
+          levelsBlock(NumNoiseEstimators * numChannels, -1), numChannels(numChannels),
+          data(nullptr), numSamples(nullptr), bufferLength(0), sampleIndex(0), block(0),
+          step(float(1.0 / std::max(1.0, sampleRate * 0.5))), coverage(coverage_)
+    {
+    }
+
+    /** The RBJ cookbook sections, Q = 1/sqrt(2), cutoffs at most 0.45 times
+        the sample rate. */
+    void setFilter(double sampleRate, double lowCut, double highCut)
+    {
+        const double pi = 3.14159265358979323846;
+        const double q = 1.0 / std::sqrt(2.0);
+
+        lowCut = std::min(lowCut, 0.45 * sampleRate);
+        highCut = std::min(highCut, 0.45 * sampleRate);
+
+        double w0 = 2.0 * pi * lowCut / sampleRate;
+        double alpha = std::sin(w0) / (2.0 * q);
+        double cosw0 = std::cos(w0);
+        double a0 = 1.0 + alpha;
+
+        double highPass[5] = { (1.0 + cosw0) / 2.0 / a0, -(1.0 + cosw0) / a0, (1.0 + cosw0) / 2.0 / a0,
+                               -2.0 * cosw0 / a0, (1.0 - alpha) / a0 };
+
+        w0 = 2.0 * pi * highCut / sampleRate;
+        alpha = std::sin(w0) / (2.0 * q);
+        cosw0 = std::cos(w0);
+        a0 = 1.0 + alpha;
+
+        double lowPass[5] = { (1.0 - cosw0) / 2.0 / a0, (1.0 - cosw0) / a0, (1.0 - cosw0) / 2.0 / a0,
+                              -2.0 * cosw0 / a0, (1.0 - alpha) / a0 };
+
+        std::copy(highPass, highPass + 5, sections[0]);
+        std::copy(lowPass, lowPass + 5, sections[1]);
+        isFiltered = true;
+    }
+
+    /** Returns whether the estimator continues from this level instead of
+        the median of its first window. */
+    bool warmStart(int chan, int estimatorType, float noiseLevel)
+    {
+        NoiseEstimatorState& s = state[estimatorType * numChannels + chan];
+
+        if (estimatorType == RunningMadNoise)
+            s.value = noiseLevel * madScale;
+        else if (estimatorType == RmsNoise)
+            s.value = noiseLevel * noiseLevel;
+        else
+            return false;
+
+        s.isWarm = s.value > 0.0f;
+        return s.isWarm;
+    }
+
+    /** data_ is the reference's own copy of the block, filtered here. */
+    void beginBlock(float* const* data_, const int* numSamples_, int bufferLength_)
+    {
+        data = data_;
+        numSamples = numSamples_;
+        bufferLength = bufferLength_;
+        block++;
+
+        if (! isFiltered)
+            return;
+
+        for (int chan = 0; chan < numChannels; chan++)
+        {
+            double* z = &filterState[chan][0];
+
+            for (int n = 0; n < std::min(numSamples[chan], bufferLength); n++)
+            {
+                double y = filterSection(sections[0], z, data[chan][n]);
+                data[chan][n] = float(filterSection(sections[1], z + 2, y));
+            }
+        }
+
+        coverage.filteredBlocks++;
+    }
+
+    /** The estimator of each channel advances once per block, when the first
+        electrode using it asks for its levels. */
+    const std::vector<float>& getNoiseLevels(int chan, int estimatorType)
+    {
+        int slot = estimatorType * numChannels + chan;
+
+        if (levelsBlock[slot] == block)
+            return levels[slot];
+
+        levelsBlock[slot] = block;
+        levels[slot].clear();
+
+        NoiseEstimatorState& s = state[slot];
+        int lastSample = numSamples[chan] - tailSize / 2 + 1;
+
+        for (int windowStart = noiseWindowStart; windowStart <= lastSample; windowStart += windowSize)
+        {
+            std::vector<float> values;
+
+            for (int index = windowStart; index < windowStart + windowSize && index <= lastSample; index++)
+            {
+                // the noise pass reads zeros past the valid samples
+                float sample = index < 0 ? tails[chan][tailSize + index]
+                             : index < std::min(numSamples[chan], bufferLength) ? data[chan][index] : 0.0f;
+                values.push_back(std::abs(sample));
+            }
+
+            coverage.windows[estimatorType]++;
+
+            std::vector<float> sorted = values;
+            std::sort(sorted.begin(), sorted.end());
+            float median = sorted[sorted.size() / 2];
+
+            if (estimatorType == MedianNoise)
+            {
+                levels[slot].push_back(median / madScale);
+            }
+            else if (! s.isWarm)
+            {
+                // the first window, and any after silent ones, set the level
+                coverage.coldWindows++;
+
+                if (estimatorType == RunningMadNoise)
+                {
+                    s.value = median;
+                }
+                else
+                {
+                    float sigma = median / madScale;
+                    s.value = sigma * sigma;
+                }
+
+                s.isWarm = s.value > 0.0f;
+            }
+            else if (estimatorType == RunningMadNoise)
+            {
+                for (size_t n = 0; n < values.size(); n++)
+                    s.value *= values[n] > s.value ? 1.0f + step : 1.0f - step;
+            }
+            else
+            {
+                // mean square with a time constant of 0.5 s, leaving out
+                // samples beyond 4 times the RMS
+                for (size_t n = 0; n < values.size(); n++)
+                {
+                    float square = values[n] * values[n];
+
+                    if (square < 16.0f * s.value)
+                        s.value += step * (square - s.value);
+                    else
+                        coverage.rmsSamplesLeftOut++;
+                }
+            }
+
+            if (estimatorType == RunningMadNoise)
+                levels[slot].push_back(s.value / madScale);
+            else if (estimatorType == RmsNoise)
+                levels[slot].push_back(std::sqrt(s.value));
+        }
+
+        return levels[slot];
+    }
+
+    /** levels[chan] is empty for channels that are not scanned. */
+    int scan(const ElectrodeScan& electrode, const std::vector<float>* levels, int lastBufferIndex,
+             std::vector<Peak>& peaks)
+    {
+        int nSamples = numSamples[electrode.channels[0]];
+        int numScanned = 0;
+
+        for (int chan = 0; chan < electrode.numChannels; chan++)
+        {
+            if (! levels[chan].empty())
+                numScanned++;
+        }
+
+        sampleIndex = lastBufferIndex - 1;
+
+        if (numScanned == 0)
+            sampleIndex = std::max(sampleIndex, nSamples - tailSize / 2 + 1);
+
+        while (sampleIndex <= nSamples - tailSize / 2)
+        {
+            sampleIndex++;
+            int window_number = (sampleIndex - noiseWindowStart) / windowSize;
+
+            for (int chan = 0; chan < electrode.numChannels; chan++)
+            {
+                if (levels[chan].empty())
+                    continue;
+
+                int currentChannel = electrode.channels[chan];
+                int lastWindow = int(levels[chan].size()) - 1;
+
+                float dyn_threshold = electrode.thresholds[chan] *
+                    levels[chan][std::min(std::max(window_number, 0), lastWindow)];
+
+                if (std::abs(getNextSample(currentChannel)) > dyn_threshold)
+                {
+                    int crossingIndex = sampleIndex;
+
+                    int peakIndex = sampleIndex;
+                    sampleIndex++;
+
+                    while (std::abs(getCurrentSample(currentChannel)) < std::abs(getNextSample(currentChannel)))
+                        sampleIndex++;
+
+                    peakIndex = sampleIndex - 1;
+                    float peak_amp = std::abs(getCurrentSample(currentChannel));
+
+                    int num_samples = electrode.prePeakSamples + electrode.postPeakSamples;
+                    int current_test_sample = 1;
+
+                    while (current_test_sample < num_samples)
+                    {
+                        if (peak_amp > std::abs(getNextSample(currentChannel)))
+                        {
+                            current_test_sample++;
+                            sampleIndex++;
+                        }
+                        else
+                        {
+                            peakIndex = sampleIndex;
+                            peak_amp = std::abs(getCurrentSample(currentChannel));
+                            sampleIndex++;
+                            current_test_sample = 1;
+                        }
+                    }
+
+                    Peak peak = { chan, crossingIndex, peakIndex };
+                    peaks.push_back(peak);
+
+                    sampleIndex = peakIndex + electrode.postPeakSamples;
+                    break;
+                }
+            }
+        }
+
+        return sampleIndex - nSamples;
+    }
+
+    void endBlock()
+    {
+        for (int chan = 0; chan < numChannels; chan++)
+        {
+            int nSamples = numSamples[chan];
+
+            if (nSamples > tailSize && nSamples <= bufferLength)
+                std::copy(data[chan] + nSamples - tailSize, data[chan] + nSamples, tails[chan].begin());
+        }
+    }
+
+private:
+    static double filterSection(const double* c, double* z, double x)
+    {
+        double y = c[0] * x + z[0];
+        z[0] = c[1] * x - c[3] * y + z[1];
+        z[1] = c[2] * x - c[4] * y;
+        return y;
+    }
+
+    float getNextSample(int chan)
+    {
+        if (sampleIndex < 0)
+        {
+            int ind = tailSize + sampleIndex;
+            return ind >= 0 ? tails[chan][ind] : 0.0f;
+        }
+
+        return sampleIndex < bufferLength ? data[chan][sampleIndex] : 0.0f;
+    }
+
+    float getCurrentSample(int chan)
+    {
+        sampleIndex--;
+        float value = getNextSample(chan);
+        sampleIndex++;
+
+        return value;
+    }
+
+    std::vector<std::vector<float> > tails;
+
+    double sections[2][5];  // b0, b1, b2, a1, a2 of the high-pass and low-pass
+    std::vector<std::vector<double> > filterState;
+    bool isFiltered;
+
+    std::vector<NoiseEstimatorState> state;  // per estimator and input channel
+    std::vector<std::vector<float> > levels;
+    std::vector<int> levelsBlock;
+    int numChannels;
+
+    float* const* data;
+    const int* numSamples;
+    int bufferLength;
+    int sampleIndex;
+    int block;
+    float step;
+
+    Coverage& coverage;
+};
+
+class PeakCollector : public DetectorCore::Listener
+{
+public:
+    void peakFound(int chan, int crossingIndex, int peakIndex, float) override
+    {
+        Peak peak = { chan, crossingIndex, peakIndex };
+        peaks.push_back(peak);
+    }
+
+    std::vector<Peak> peaks;
+};
+
+static const int maxBlockSize = 4096;
+
+/** A recording of numChannels x numSamples with noise whose level changes
+    every few thousand samples, bursts of spikes of both signs, and silent
+    stretches where every window has a noise level of 0. */
+static std::vector<std::vector<float> > makeRecording(std::mt19937& random, int numChannels, int numSamples)
+{
+    std::normal_distribution<float> gaussian(0.0f, 1.0f);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<std::vector<float> > recording(numChannels, std::vector<float>(numSamples));
+
+    for (int chan = 0; chan < numChannels; chan++)
+    {
+        float level = 10.0f;
+        bool isSilent = false;
+
+        for (int n = 0; n < numSamples; n++)
+        {
+            if (n % 2500 == 0)
+            {
+                level = 2.0f + 40.0f * uniform(random);
+                isSilent = uniform(random) < 0.05f;
+            }
+
+            recording[chan][n] = isSilent ? 0.0f : level * gaussian(random);
+        }
+
+        // spikes of a few samples, some within one waveform of each other
+        for (int n = 0; n < numSamples - 8; n += 10 + int(uniform(random) * 400))
+        {
+            float amplitude = (uniform(random) < 0.7f ? -1.0f : 1.0f) * level * (3.0f + 10.0f * uniform(random));
+            int width = 2 + int(uniform(random) * 5);
+
+            for (int k = 0; k < width; k++)
+                recording[chan][n + k] += amplitude * std::sin(3.14159265f * (k + 1) / (width + 1));
+        }
+    }
+
+    return recording;
+}
+
+static std::vector<ElectrodeScan> makeLayout(std::mt19937& random, int numChannels)
+{
+    std::uniform_int_distribution<int> numElectrodes(1, 6);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<ElectrodeScan> layout(numElectrodes(random));
+
+    for (size_t i = 0; i < layout.size(); i++)
+    {
+        ElectrodeScan& electrode = layout[i];
+
+        electrode.numChannels = 1 + int(uniform(random) * std::min(numChannels, DETECTOR_CORE_MAX_CHANNELS));
+        electrode.prePeakSamples = 1 + int(uniform(random) * 20);
+        electrode.postPeakSamples = 1 + int(uniform(random) * (DETECTOR_CORE_MAX_SAMPLES - 1 - electrode.prePeakSamples));
+
+        for (int chan = 0; chan < electrode.numChannels; chan++)
+        {
+            // electrodes may share channels
+            electrode.channels[chan] = int(uniform(random) * numChannels);
+            electrode.thresholds[chan] = 2.0f + 4.0f * uniform(random);
+        }
+    }
+
+    return layout;
+}
+
+static int getBlockSize(std::mt19937& random)
+{
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    float kind = uniform(random);
+
+    if (kind < 0.15f)
+        return int(uniform(random) * 101);                  // no longer than the tail
+    if (kind < 0.25f)
+        return 200 * (1 + int(uniform(random) * 8));        // whole noise windows
+    if (kind < 0.35f)
+        return 200 * (1 + int(uniform(random) * 8)) + 50;   // windows ending on the block end
+
+    return 101 + int(uniform(random) * (maxBlockSize - 100));
+}
+
+/** Returns false at the first divergence, after describing it. */
+static bool runSeed(unsigned seed, int numBlocks, int simdLevel, Coverage& coverage)
+{
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    int numChannels = 1 + int(uniform(random) * 8);
+    std::vector<int> blockSizes(numBlocks);
+    int recordingLength = 0;
+
+    for (int block = 0; block < numBlocks; block++)
+    {
+        blockSizes[block] = getBlockSize(random);
+        recordingLength += blockSizes[block];
+    }
+
+    std::vector<std::vector<float> > recording = makeRecording(random, numChannels, recordingLength);
+    std::vector<ElectrodeScan> layout = makeLayout(random, numChannels);
+    std::vector<int> estimatorTypes(layout.size());
+
+    for (size_t i = 0; i < layout.size(); i++)
+        estimatorTypes[i] = int(uniform(random) * NumNoiseEstimators) % NumNoiseEstimators;
+
+    const double sampleRates[] = { 20000.0, 30000.0, 40000.0 };
+    double sampleRate = sampleRates[int(uniform(random) * 3) % 3];
+
+    DetectorCore core;
+    core.prepare(numChannels, maxBlockSize);
+    core.setKernels(getSimdKernels(simdLevel));
+    core.setSampleRate(sampleRate);
+
+    ReferenceDetection reference(numChannels, sampleRate, coverage);
+    PeakCollector collector;
+
+    // half of the seeds band-pass, some with a high cutoff above the clamp
+    BandpassFilter bandpass;
+
+    if (uniform(random) < 0.5f)
+    {
+        double lowCut = 100.0 + 500.0 * uniform(random);
+        double highCut = 3000.0 + (0.5 * sampleRate - 3000.0) * uniform(random);
+
+        bandpass.setCutoffs(sampleRate, lowCut, highCut);
+        reference.setFilter(sampleRate, lowCut, highCut);
+        core.setFilter(&bandpass);
+    }
+
+    // a third start the running estimators from the levels of an earlier session
+    if (uniform(random) < 0.3f)
+    {
+        for (int chan = 0; chan < numChannels; chan++)
+        {
+            for (int type = 0; type < NumNoiseEstimators; type++)
+            {
+                float level = 2.0f + 40.0f * uniform(random);
+                bool isWarm = core.warmStart(chan, type, level);
+
+                if (isWarm != reference.warmStart(chan, type, level))
+                {
+                    printf("seed %u, %s: warm start of the %s estimator on channel %d is %s, reference %s\n",
+                           seed, getSimdLevelName(simdLevel), getNoiseEstimatorName(type), chan,
+                           isWarm ? "taken" : "ignored", isWarm ? "ignored" : "taken");
+                    return false;
+                }
+
+                if (isWarm)
+                    coverage.warmStarts++;
+            }
+        }
+    }
+
+    std::vector<int> lastBufferIndex(layout.size(), 0);
+    std::vector<int> referenceIndex(layout.size(), 0);
+
+    // the core and the reference each filter their own copy of the block in place
+    std::vector<float> samples(size_t(numChannels) * maxBlockSize);
+    std::vector<float> referenceSamples(size_t(numChannels) * maxBlockSize);
+    std::vector<float*> channelData(numChannels);
+    std::vector<float*> referenceData(numChannels);
+    std::vector<int> numSamples(numChannels);
+
+    for (int chan = 0; chan < numChannels; chan++)
+    {
+        channelData[chan] = &samples[size_t(chan) * maxBlockSize];
+        referenceData[chan] = &referenceSamples[size_t(chan) * maxBlockSize];
+    }
+
+    int position = 0;
+
+    for (int block = 0; block < numBlocks; block++)
+    {
+        int bufferLength = blockSizes[block];
+
+        for (int chan = 0; chan < numChannels; chan++)
+        {
+            std::copy(recording[chan].begin() + position, recording[chan].begin() + position + bufferLength,
+                      channelData[chan]);
+            std::copy(channelData[chan], channelData[chan] + bufferLength, referenceData[chan]);
+
+            // now and then a channel has fewer valid samples than the buffer
+            numSamples[chan] = uniform(random) < 0.03f ? int(uniform(random) * bufferLength) : bufferLength;
+        }
+
+        position += bufferLength;
+
+        if (bufferLength <= ReferenceDetection::tailSize)
+            coverage.shortBlocks++;
+
+        core.beginBlock(&channelData[0], &numSamples[0], numChannels, bufferLength);
+        reference.beginBlock(&referenceData[0], &numSamples[0], bufferLength);
+
+        for (size_t i = 0; i < layout.size(); i++)
+        {
+            ElectrodeScan electrode = layout[i];
+            int estimatorType = estimatorTypes[i];
+            std::vector<float> levels[DETECTOR_CORE_MAX_CHANNELS];
+            bool isScanned = false;
+
+            for (int chan = 0; chan < electrode.numChannels; chan++)
+            {
+                int inputChannel = electrode.channels[chan];
+
+                electrode.lastWindow[chan] = core.getLastWindow(inputChannel);
+                electrode.noiseLevels[chan] = nullptr;
+                electrode.tileMaxima[chan] = nullptr;
+
+                if (uniform(random) < 0.1f)
+                    continue; // inactive in this block
+
+                electrode.noiseLevels[chan] = core.getNoiseLevels(inputChannel, estimatorType);
+                electrode.tileMaxima[chan] = core.getTileMaxima(inputChannel, estimatorType);
+                levels[chan] = reference.getNoiseLevels(inputChannel, estimatorType);
+                isScanned = true;
+
+                if (int(levels[chan].size()) != electrode.lastWindow[chan] + 1)
+                {
+                    printf("seed %u, %s, block %d (%d samples, %d valid on channel %d, %s): %d noise windows, reference %d\n",
+                           seed, getSimdLevelName(simdLevel), block, bufferLength, numSamples[inputChannel],
+                           inputChannel, getNoiseEstimatorName(estimatorType), electrode.lastWindow[chan] + 1,
+                           int(levels[chan].size()));
+                    return false;
+                }
+
+                for (size_t window = 0; window < levels[chan].size(); window++)
+                {
+                    if (electrode.noiseLevels[chan][window] != levels[chan][window])
+                    {
+                        printf("seed %u, %s, block %d (%d samples, %d valid on channel %d, %s): noise level of window %d is %g, reference %g\n",
+                               seed, getSimdLevelName(simdLevel), block, bufferLength, numSamples[inputChannel],
+                               inputChannel, getNoiseEstimatorName(estimatorType), int(window),
+                               electrode.noiseLevels[chan][window], levels[chan][window]);
+                        return false;
+                    }
+                }
+
+                int lastSample = numSamples[inputChannel] - ReferenceDetection::tailSize / 2 + 1;
+
+                if ((lastSample - ReferenceDetection::noiseWindowStart + 1) % ReferenceDetection::windowSize != 0)
+                    coverage.partialWindows++;
+            }
+
+            int nSamples = numSamples[electrode.channels[0]];
+
+            if (! isScanned)
+                coverage.unscannedElectrodes++;
+            else if (lastBufferIndex[i] < 0)
+                coverage.scansFromTail++;
+            else if (lastBufferIndex[i] > 0)
+                coverage.scansPastStart++;
+
+            std::vector<Peak> referencePeaks;
+            collector.peaks.clear();
+
+            lastBufferIndex[i] = core.scanElectrode(electrode, lastBufferIndex[i], collector);
+            referenceIndex[i] = reference.scan(electrode, levels, referenceIndex[i], referencePeaks);
+
+            for (size_t n = 0; n < std::max(collector.peaks.size(), referencePeaks.size()); n++)
+            {
+                if (n >= collector.peaks.size() || n >= referencePeaks.size()
+                    || collector.peaks[n] != referencePeaks[n])
+                {
+                    printf("seed %u, %s, block %d (%d samples, %d valid), electrode %d: ",
+                           seed, getSimdLevelName(simdLevel), block, bufferLength, nSamples, int(i));
+
+                    if (n >= collector.peaks.size())
+                        printf("reference peak %d at %d (channel %d, crossing %d) is missing\n", int(n),
+                               referencePeaks[n].peakIndex, referencePeaks[n].chan, referencePeaks[n].crossingIndex);
+                    else if (n >= referencePeaks.size())
+                        printf("extra peak %d at %d (channel %d, crossing %d)\n", int(n),
+                               collector.peaks[n].peakIndex, collector.peaks[n].chan, collector.peaks[n].crossingIndex);
+                    else
+                        printf("peak %d at %d (channel %d, crossing %d), reference at %d (channel %d, crossing %d)\n",
+                               int(n), collector.peaks[n].peakIndex, collector.peaks[n].chan,
+                               collector.peaks[n].crossingIndex, referencePeaks[n].peakIndex,
+                               referencePeaks[n].chan, referencePeaks[n].crossingIndex);
+
+                    return false;
+                }
+
+                if (referencePeaks[n].crossingIndex < 0)
+                    coverage.peaksInTail++;
+
+                if (referencePeaks[n].peakIndex + electrode.postPeakSamples > nSamples)
+                    coverage.peaksPastEnd++;
+            }
+
+            if (lastBufferIndex[i] != referenceIndex[i])
+            {
+                printf("seed %u, %s, block %d (%d samples, %d valid), electrode %d: resumes at %d, reference at %d\n",
+                       seed, getSimdLevelName(simdLevel), block, bufferLength, nSamples, int(i),
+                       lastBufferIndex[i], referenceIndex[i]);
+                return false;
+            }
+        }
+
+        // channels no electrode read in this block are filtered all the same,
+        // as the plugin does, so that their tails and filter states carry on
+        for (int chan = 0; chan < numChannels; chan++)
+        {
+            core.filterChannel(chan);
+
+            int dataLength = std::min(numSamples[chan], bufferLength);
+
+            for (int n = 0; n < dataLength; n++)
+            {
+                if (channelData[chan][n] != referenceData[chan][n])
+                {
+                    printf("seed %u, %s, block %d (%d samples, %d valid on channel %d): filtered sample %d is %g, reference %g\n",
+                           seed, getSimdLevelName(simdLevel), block, bufferLength, numSamples[chan], chan, n,
+                           channelData[chan][n], referenceData[chan][n]);
+                    return false;
+                }
+            }
+        }
+
+        core.endBlock();
+        reference.endBlock();
+    }
+
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned firstSeed = argc > 1 ? unsigned(strtoul(argv[1], nullptr, 10)) : 1;
+    int numBlocks = argc > 2 ? std::max(1, atoi(argv[2])) : 300;
+    int numSeeds = argc > 1 ? 1 : 10;
+
+    Coverage coverage = {};
+
+    for (int level = SimdScalar; level <= getSupportedSimdLevel(); level++)
+    {
+        for (unsigned seed = firstSeed; seed < firstSeed + numSeeds; seed++)
+        {
+            if (! runSeed(seed, numBlocks, level, coverage))
+            {
+                printf("Diverged; rerun with: reference_test %u %d\n", seed, numBlocks);
+                return 1;
+            }
+        }
+    }
+
+    printf("%d seeds x %d blocks at %d SIMD levels identical to the reference\n",
+           numSeeds, numBlocks, getSupportedSimdLevel() + 1);
+    printf("scans resumed in the tail %lld, after the block start %lld; peaks crossing in the tail %lld, "
+           "running past the block end %lld; partial last windows %lld; short blocks %lld; unscanned electrodes %lld\n",
+           coverage.scansFromTail, coverage.scansPastStart, coverage.peaksInTail, coverage.peaksPastEnd,
+           coverage.partialWindows, coverage.shortBlocks, coverage.unscannedElectrodes);
+    printf("noise windows: median %lld, running MAD %lld, RMS %lld (%lld bootstrapped, %lld RMS samples left out); "
+           "filtered blocks %lld; warm starts %lld\n",
+           coverage.windows[MedianNoise], coverage.windows[RunningMadNoise], coverage.windows[RmsNoise],
+           coverage.coldWindows, coverage.rmsSamplesLeftOut, coverage.filteredBlocks, coverage.warmStarts);
+
+    if (coverage.scansFromTail == 0 || coverage.scansPastStart == 0 || coverage.peaksInTail == 0
+        || coverage.peaksPastEnd == 0 || coverage.partialWindows == 0 || coverage.shortBlocks == 0
+        || coverage.unscannedElectrodes == 0 || coverage.windows[MedianNoise] == 0
+        || coverage.windows[RunningMadNoise] == 0 || coverage.windows[RmsNoise] == 0
+        || coverage.coldWindows == 0 || coverage.rmsSamplesLeftOut == 0 || coverage.filteredBlocks == 0
+        || coverage.warmStarts == 0)
+    {
+        printf("Some edge cases were not reached\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,543 @@
+// Replays a capture of the Dynamic Detector's input (captureFile option)
+// through the plugin's detection core at full speed and prints the
+// processing time per block, for profiling a session offline.
+//
+//     capture_replay file [repetitions]
+//
+// The capture is loaded into memory first, so that disk reads are not timed.
+// Blocks are replayed as process() received them: the whole buffer with the
+// valid sample count of each channel. The recorded settings select the same
+// kernels, band-pass filter and warm-start levels as the session. Layout
+// changes are applied in place, so noise estimates, the filter state and the
+// overflow tail carry over as they do in the plugin.
+//
+// Health checks, the rate limit, coincidence rejection, load shedding and
+// sorting are not replayed: every peak the core finds is counted. Captures
+// without a settings record are replayed with the filter off.
+//
+// The latency of each peak is measured from the moment its sample was
+// acquired: the rest of the block still had to arrive, then the block was
+// processed (as timed here). Pipelined sessions hand their events over one
+// block later. The same is reported for the threshold crossing, where the
+// trigger event of triggerEvents points.
+
+#include "../../SpikeDetectorDynamic/CaptureFormat.h"
+#include "../../SpikeDetectorDynamic/DetectorCore.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+struct ReplayBlock
+{
+    int layout;                     // index into the layouts
+    int64_t blockIndex;
+    int bufferLength;
+    std::vector<int> numSamples;    // valid samples of each channel
+    std::vector<float> data;        // numChannels x bufferLength
+};
+
+struct Capture
+{
+    CaptureFileHeader header;
+    std::vector<float> bitVolts;
+    bool hasSettings;
+    CaptureSettings settings;
+    std::vector<float> warmLevels;  // NumNoiseEstimators x numChannels
+    std::vector<std::vector<CaptureElectrode> > layouts;
+    std::vector<ReplayBlock> blocks;
+    int maxBlockSize;
+};
+
+static bool readSettings(const std::vector<char>& payload, uint32_t numChannels, Capture& capture)
+{
+    CaptureSettings& settings = capture.settings;
+
+    if (payload.size() < sizeof(settings))
+        return false;
+
+    memcpy(&settings, &payload[0], sizeof(settings));
+
+    size_t numLevels = size_t(settings.numNoiseEstimators) * numChannels;
+
+    if (payload.size() < sizeof(settings) + numLevels * sizeof(float))
+        return false;
+
+    // levels of estimators this build does not know are left out
+    capture.warmLevels.assign(size_t(NumNoiseEstimators) * numChannels, 0.0f);
+
+    for (uint32_t type = 0; type < std::min(settings.numNoiseEstimators, uint32_t(NumNoiseEstimators)); type++)
+        memcpy(&capture.warmLevels[size_t(type) * numChannels],
+               &payload[sizeof(settings) + size_t(type) * numChannels * sizeof(float)],
+               numChannels * sizeof(float));
+
+    capture.hasSettings = true;
+    return true;
+}
+
+static bool readLayout(const std::vector<char>& payload, uint32_t numChannels, std::vector<CaptureElectrode>& layout)
+{
+    uint32_t counts[2];
+
+    if (payload.size() < sizeof(counts))
+        return false;
+
+    memcpy(counts, &payload[0], sizeof(counts));
+
+    if (payload.size() < sizeof(counts) + counts[0] * sizeof(CaptureElectrode))
+        return false;
+
+    layout.resize(counts[0]);
+
+    for (uint32_t i = 0; i < counts[0]; i++)
+    {
+        CaptureElectrode& electrode = layout[i];
+        memcpy(&electrode, &payload[sizeof(counts) + i * sizeof(CaptureElectrode)], sizeof(electrode));
+
+        if (electrode.numChannels < 1 || electrode.numChannels > DETECTOR_CORE_MAX_CHANNELS
+            || electrode.noiseEstimator < 0 || electrode.noiseEstimator >= NumNoiseEstimators
+            || electrode.prePeakSamples < 0 || electrode.postPeakSamples < 0
+            || electrode.prePeakSamples + electrode.postPeakSamples > DETECTOR_CORE_MAX_SAMPLES)
+            return false;
+
+        for (int chan = 0; chan < electrode.numChannels; chan++)
+        {
+            if (electrode.channels[chan] < 0 || uint32_t(electrode.channels[chan]) >= numChannels)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+static bool readBlock(const std::vector<char>& payload, uint32_t numChannels, ReplayBlock& block)
+{
+    CaptureBlockHeader header;
+
+    if (payload.size() < sizeof(header))
+        return false;
+
+    memcpy(&header, &payload[0], sizeof(header));
+
+    size_t timestampsOffset = sizeof(header);
+    size_t numSamplesOffset = timestampsOffset + header.numChannels * sizeof(int64_t);
+    size_t dataOffset = numSamplesOffset + header.numChannels * sizeof(int32_t);
+
+    if (payload.size() < dataOffset + size_t(header.numChannels) * header.numSamples * sizeof(float))
+        return false;
+
+    block.blockIndex = header.blockIndex;
+    block.bufferLength = int(header.numSamples);
+
+    // channels missing from the block are replayed as silence
+    block.numSamples.assign(numChannels, 0);
+    block.data.assign(size_t(numChannels) * block.bufferLength, 0.0f);
+
+    for (uint32_t chan = 0; chan < std::min(numChannels, header.numChannels); chan++)
+    {
+        int32_t validSamples;
+        memcpy(&validSamples, &payload[numSamplesOffset + chan * sizeof(int32_t)], sizeof(int32_t));
+        block.numSamples[chan] = std::max(0, std::min(int(validSamples), block.bufferLength));
+
+        memcpy(&block.data[size_t(chan) * block.bufferLength],
+               &payload[dataOffset + size_t(chan) * header.numSamples * sizeof(float)],
+               block.bufferLength * sizeof(float));
+    }
+
+    return true;
+}
+
+static bool loadCapture(const char* path, Capture& capture)
+{
+    FILE* file = fopen(path, "rb");
+
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+
+    CaptureFileHeader& header = capture.header;
+
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0
+        || header.version != CAPTURE_VERSION || header.numChannels == 0)
+    {
+        fprintf(stderr, "%s is not a detector capture\n", path);
+        fclose(file);
+        return false;
+    }
+
+    capture.bitVolts.resize(header.numChannels);
+    capture.hasSettings = false;
+    memset(&capture.settings, 0, sizeof(capture.settings));
+    capture.settings.simdLevel = SimdAuto;
+    capture.warmLevels.assign(size_t(NumNoiseEstimators) * header.numChannels, 0.0f);
+    capture.maxBlockSize = 1;
+
+    if (fread(&capture.bitVolts[0], sizeof(float), header.numChannels, file) != header.numChannels)
+    {
+        fclose(file);
+        return false;
+    }
+
+    CaptureRecordHeader record;
+    std::vector<char> payload;
+
+    // a capture cut short by a crash ends with a partial record, which is ignored
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        payload.resize(record.size);
+
+        if (record.size > 0 && fread(&payload[0], 1, record.size, file) != record.size)
+            break;
+
+        if (record.type == CaptureSettingsRecord)
+        {
+            if (! readSettings(payload, header.numChannels, capture))
+                fprintf(stderr, "The settings of the capture are not valid and are ignored\n");
+        }
+        else if (record.type == CaptureLayoutRecord)
+        {
+            std::vector<CaptureElectrode> layout;
+
+            if (! readLayout(payload, header.numChannels, layout))
+            {
+                fprintf(stderr, "The electrode layout %zu of the capture is not valid for the detector\n",
+                        capture.layouts.size());
+                fclose(file);
+                return false;
+            }
+
+            capture.layouts.push_back(layout);
+        }
+        else if (record.type == CaptureBlockRecord && ! capture.layouts.empty())
+        {
+            capture.blocks.push_back(ReplayBlock());
+            ReplayBlock& block = capture.blocks.back();
+
+            if (! readBlock(payload, header.numChannels, block))
+            {
+                capture.blocks.pop_back();
+                continue;
+            }
+
+            block.layout = int(capture.layouts.size()) - 1;
+            capture.maxBlockSize = std::max(capture.maxBlockSize, block.bufferLength);
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+/** Runs the blocks through a DetectorCore set up like the plugin's enable(). */
+struct Replay : public DetectorCore::Listener
+{
+    Replay(const Capture& capture_) : capture(capture_), scanNumSamples(0), numPeaks(0)
+    {
+        const CaptureSettings& settings = capture.settings;
+        int numChannels = int(capture.header.numChannels);
+        double sampleRate = capture.header.sampleRate;
+
+        core.prepare(numChannels, capture.maxBlockSize);
+        core.setSampleRate(sampleRate);
+        core.resetNoiseLevels();
+
+        // as in the plugin: the held noise levels last about a second
+        int holdBlocks = std::max(1, int(sampleRate / std::max(capture.maxBlockSize, 1)));
+        core.setNoiseHoldBlocks(holdBlocks);
+
+        kernels = &getSimdKernels(settings.simdLevel);
+        core.setKernels(*kernels);
+
+        bandpass.setCutoffs(sampleRate, settings.filterLowCut, settings.filterHighCut);
+        core.setFilter(settings.filterEnabled ? &bandpass : nullptr);
+        core.resetSignal();
+
+        for (int type = 0; type < NumNoiseEstimators; type++)
+        {
+            for (int chan = 0; chan < numChannels; chan++)
+                core.warmStart(chan, type, capture.warmLevels[size_t(type) * numChannels + chan]);
+        }
+
+        channels.resize(numChannels);
+        scratch.resize(size_t(numChannels) * capture.maxBlockSize);
+        layout = -1;
+    }
+
+    /** Keeps the scan position of electrodes that are still there, as the
+        plugin keeps its electrodes when their settings change. */
+    void setLayout(int newLayout)
+    {
+        const std::vector<CaptureElectrode>& electrodes = capture.layouts[newLayout];
+        std::vector<int> newLastBufferIndex(electrodes.size(), 0);
+
+        for (size_t i = 0; i < electrodes.size() && layout >= 0; i++)
+        {
+            const std::vector<CaptureElectrode>& previous = capture.layouts[layout];
+
+            for (size_t j = 0; j < previous.size(); j++)
+            {
+                if (previous[j].electrodeID == electrodes[i].electrodeID)
+                    newLastBufferIndex[i] = lastBufferIndex[j];
+            }
+        }
+
+        lastBufferIndex.swap(newLastBufferIndex);
+        layout = newLayout;
+    }
+
+    /** Copies a block into the buffer the core works on; the filter writes
+        to it, and the capture is replayed more than once. */
+    void loadBlock(const ReplayBlock& block)
+    {
+        memcpy(&scratch[0], &block.data[0], block.data.size() * sizeof(float));
+
+        for (size_t chan = 0; chan < channels.size(); chan++)
+            channels[chan] = &scratch[chan * block.bufferLength];
+    }
+
+    void detect(const ReplayBlock& block)
+    {
+        int numChannels = int(channels.size());
+        const std::vector<CaptureElectrode>& electrodes = capture.layouts[layout];
+
+        blockPeakLags.clear();
+        blockCrossingLags.clear();
+
+        core.beginBlock(&channels[0], &block.numSamples[0], numChannels, block.bufferLength);
+
+        for (size_t i = 0; i < electrodes.size(); i++)
+        {
+            const CaptureElectrode& electrode = electrodes[i];
+
+            // events are placed by the valid samples of the first channel
+            scanNumSamples = block.numSamples[electrode.channels[0]];
+
+            ElectrodeScan scan;
+            scan.numChannels = electrode.numChannels;
+            scan.prePeakSamples = electrode.prePeakSamples;
+            scan.postPeakSamples = electrode.postPeakSamples;
+
+            for (int chan = 0; chan < electrode.numChannels; chan++)
+            {
+                int inputChannel = electrode.channels[chan];
+
+                scan.channels[chan] = inputChannel;
+                scan.thresholds[chan] = electrode.thresholds[chan];
+                scan.lastWindow[chan] = core.getLastWindow(inputChannel);
+                scan.noiseLevels[chan] = nullptr;
+                scan.tileMaxima[chan] = nullptr;
+
+                if (electrode.isActive[chan])
+                {
+                    scan.noiseLevels[chan] = core.getNoiseLevels(inputChannel, electrode.noiseEstimator);
+                    scan.tileMaxima[chan] = core.getTileMaxima(inputChannel, electrode.noiseEstimator);
+                }
+            }
+
+            lastBufferIndex[i] = core.scanElectrode(scan, lastBufferIndex[i], *this);
+        }
+
+        // channels no electrode scanned are still filtered for the tail
+        for (int chan = 0; chan < numChannels; chan++)
+            core.filterChannel(chan);
+
+        core.endBlock();
+    }
+
+    void peakFound(int chan, int crossingIndex, int peakIndex, float threshold) override
+    {
+        // peaks of the overflow region have negative indices
+        blockPeakLags.push_back(scanNumSamples - peakIndex);
+        blockCrossingLags.push_back(scanNumSamples - crossingIndex);
+        numPeaks++;
+    }
+
+    /** Adds the latencies of the last block's peaks, in microseconds. */
+    void addLatencies(double blockUs, std::vector<double>& peakUs, std::vector<double>& crossingUs) const
+    {
+        double usPerSample = 1.0e6 / capture.header.sampleRate;
+
+        for (size_t n = 0; n < blockPeakLags.size(); n++)
+        {
+            peakUs.push_back(blockPeakLags[n] * usPerSample + blockUs);
+            crossingUs.push_back(blockCrossingLags[n] * usPerSample + blockUs);
+        }
+    }
+
+    const Capture& capture;
+    DetectorCore core;
+    BandpassFilter bandpass;
+    const SimdKernels* kernels;
+
+    std::vector<float*> channels;
+    std::vector<float> scratch;
+    int layout;
+    std::vector<int> lastBufferIndex;
+
+    int scanNumSamples;
+    std::vector<int> blockPeakLags;         // samples from each peak to the block end
+    std::vector<int> blockCrossingLags;
+
+    int64_t numPeaks;
+};
+
+static void printSettings(const Capture& capture, const SimdKernels& kernels)
+{
+    const CaptureSettings& settings = capture.settings;
+
+    if (! capture.hasSettings)
+    {
+        printf("No settings recorded (older capture): replayed without the filter\n");
+        return;
+    }
+
+    printf("Kernels %s, filter %s", getSimdLevelName(kernels.level), settings.filterEnabled ? "on" : "off");
+
+    if (settings.filterEnabled)
+        printf(" (%.0f-%.0f Hz)", settings.filterLowCut, settings.filterHighCut);
+
+    printf(", warm start %s, %s\n", settings.warmStartEnabled ? "on" : "off",
+           settings.pipelinedMode ? "pipelined" : "inline");
+
+    // what the plugin did after the core, which is left out here
+    printf("Not replayed: health check %s, rate limit ", settings.healthCheckEnabled ? "on" : "off");
+
+    if (settings.maxSpikeRate > 0)
+        printf("%.0f/s (burst %.0f)", settings.maxSpikeRate, settings.spikeBurst);
+    else
+        printf("off");
+
+    printf(", coincidence rejection ");
+
+    if (settings.coincidenceElectrodes > 0)
+        printf("%d electrodes in %.2f ms", settings.coincidenceElectrodes, settings.coincidenceWindowMs);
+    else
+        printf("off");
+
+    if (settings.timeBudgetMs > 0)
+        printf(", time budget %.2f ms", settings.timeBudgetMs);
+
+    printf("\n");
+}
+
+static void printLatencies(const char* title, std::vector<double>& latenciesUs)
+{
+    std::sort(latenciesUs.begin(), latenciesUs.end());
+
+    double sum = 0;
+
+    for (size_t n = 0; n < latenciesUs.size(); n++)
+        sum += latenciesUs[n];
+
+    printf("%s: mean %.2f ms, 99th percentile %.2f ms, max %.2f ms\n", title,
+           sum / latenciesUs.size() * 1.0e-3,
+           latenciesUs[std::min(latenciesUs.size() - 1, latenciesUs.size() * 99 / 100)] * 1.0e-3,
+           latenciesUs.back() * 1.0e-3);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: capture_replay file [repetitions]\n");
+        return 1;
+    }
+
+    int repetitions = argc > 2 ? std::max(1, atoi(argv[2])) : 1;
+
+    Capture capture;
+
+    if (! loadCapture(argv[1], capture))
+        return 1;
+
+    if (capture.blocks.empty())
+    {
+        printf("The capture holds no blocks.\n");
+        return 0;
+    }
+
+    int numChannels = int(capture.header.numChannels);
+    int64_t numSamples = 0;
+    int64_t numMissingBlocks = 0;
+
+    for (size_t n = 0; n < capture.blocks.size(); n++)
+    {
+        numSamples += capture.blocks[n].numSamples[0];
+
+        if (n > 0)
+            numMissingBlocks += capture.blocks[n].blockIndex - capture.blocks[n - 1].blockIndex - 1;
+    }
+
+    printf("%zu blocks of %d channels, %.1f s at %.0f Hz, %zu electrode layouts, %lld blocks missing (dropped during capture)\n",
+           capture.blocks.size(), numChannels, numSamples / capture.header.sampleRate,
+           capture.header.sampleRate, capture.layouts.size(), (long long) numMissingBlocks);
+
+    std::vector<double> blockTimesUs;
+    blockTimesUs.reserve(capture.blocks.size() * repetitions);
+
+    std::vector<double> peakLatenciesUs;
+    std::vector<double> crossingLatenciesUs;
+
+    int64_t numPeaks = 0;
+    double totalSeconds = 0;
+
+    for (int repetition = 0; repetition < repetitions; repetition++)
+    {
+        Replay replay(capture);
+
+        if (repetition == 0)
+            printSettings(capture, *replay.kernels);
+
+        for (size_t n = 0; n < capture.blocks.size(); n++)
+        {
+            const ReplayBlock& block = capture.blocks[n];
+
+            if (block.layout != replay.layout)
+                replay.setLayout(block.layout);
+
+            replay.loadBlock(block);
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            replay.detect(block);
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            blockTimesUs.push_back(seconds * 1.0e6);
+            totalSeconds += seconds;
+
+            double handoverUs = seconds * 1.0e6;
+
+            if (capture.settings.pipelinedMode)
+                handoverUs += block.bufferLength * 1.0e6 / capture.header.sampleRate;
+
+            replay.addLatencies(handoverUs, peakLatenciesUs, crossingLatenciesUs);
+        }
+
+        numPeaks += replay.numPeaks;
+    }
+
+    std::sort(blockTimesUs.begin(), blockTimesUs.end());
+
+    double dataSeconds = double(numSamples) * repetitions / capture.header.sampleRate;
+
+    printf("%lld peaks per pass\n", (long long) (numPeaks / repetitions));
+    printf("%.3f s for %d passes, %.1fx real time; per block: mean %.1f us, 99th percentile %.1f us, max %.1f us\n",
+           totalSeconds, repetitions, totalSeconds > 0 ? dataSeconds / totalSeconds : 0.0,
+           totalSeconds * 1.0e6 / blockTimesUs.size(),
+           blockTimesUs[std::min(blockTimesUs.size() - 1, blockTimesUs.size() * 99 / 100)],
+           blockTimesUs.back());
+
+    if (! peakLatenciesUs.empty())
+    {
+        printLatencies("Latency from the peak sample to its spike event", peakLatenciesUs);
+        printLatencies("Latency from the threshold crossing to its spike and trigger events", crossingLatenciesUs);
+    }
+
+    return 0;
+}
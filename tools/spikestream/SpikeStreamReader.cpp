@@ -0,0 +1,147 @@
+
+#include "SpikeStreamReader.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+SpikeStreamReader::SpikeStreamReader()
+    : segment(nullptr), readIndex(0), numLost(0)
+{
+}
+
+SpikeStreamReader::~SpikeStreamReader()
+{
+    close();
+}
+
+bool SpikeStreamReader::open(const char* name, bool fromStart)
+{
+    close();
+
+    int fd = shm_open(name, O_RDONLY, 0);
+
+    if (fd < 0)
+        return false;
+
+    void* memory = mmap(nullptr, sizeof(SpikeStreamSegment), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (memory == MAP_FAILED)
+        return false;
+
+    segment = static_cast<const SpikeStreamSegment*>(memory);
+    const SpikeStreamHeader& header = segment->header;
+
+    if (memcmp(header.magic, SPIKE_STREAM_MAGIC, sizeof(SPIKE_STREAM_MAGIC)) != 0
+        || header.version != SPIKE_STREAM_VERSION
+        || header.numRecords != SPIKE_STREAM_NUM_RECORDS
+        || header.recordSize != sizeof(SpikeStreamRecord))
+    {
+        close();
+        return false;
+    }
+
+    uint64_t writeIndex = header.writeIndex.load(std::memory_order_acquire);
+
+    if (! fromStart)
+        readIndex = writeIndex;
+    else
+        readIndex = writeIndex > SPIKE_STREAM_NUM_RECORDS ? writeIndex - SPIKE_STREAM_NUM_RECORDS : 0;
+
+    numLost = 0;
+    return true;
+}
+
+void SpikeStreamReader::close()
+{
+    if (segment == nullptr)
+        return;
+
+    munmap(const_cast<SpikeStreamSegment*>(segment), sizeof(SpikeStreamSegment));
+    segment = nullptr;
+}
+
+bool SpikeStreamReader::readNext(SpikeStreamRecord& record)
+{
+    if (segment == nullptr)
+        return false;
+
+    while (true)
+    {
+        uint64_t writeIndex = segment->header.writeIndex.load(std::memory_order_acquire);
+
+        if (readIndex >= writeIndex)
+            return false;
+
+        // the writer has lapped this reader
+        if (writeIndex - readIndex > SPIKE_STREAM_NUM_RECORDS)
+        {
+            numLost += writeIndex - SPIKE_STREAM_NUM_RECORDS - readIndex;
+            readIndex = writeIndex - SPIKE_STREAM_NUM_RECORDS;
+        }
+
+        const SpikeStreamRecord& r = segment->records[readIndex & (SPIKE_STREAM_NUM_RECORDS - 1)];
+        uint64_t sequence = r.sequence.load(std::memory_order_acquire);
+
+        if (sequence == readIndex + 1)
+        {
+            record.timestamp = r.timestamp;
+            record.publishTimeNs = r.publishTimeNs;
+            record.electrodeID = r.electrodeID;
+            record.source = r.source;
+            record.nChannels = r.nChannels;
+            record.nSamples = r.nSamples;
+            record.samplingFrequencyHz = r.samplingFrequencyHz;
+            memcpy(record.threshold, r.threshold, sizeof(r.threshold));
+            memcpy(record.gain, r.gain, sizeof(r.gain));
+            memcpy(record.data, r.data, sizeof(r.data));
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (r.sequence.load(std::memory_order_relaxed) == sequence)
+            {
+                readIndex++;
+                return true;
+            }
+        }
+
+        // overwritten while (or before) it was copied: the writer is at least
+        // a full ring ahead, so the next pass skips forward
+        if (segment->header.writeIndex.load(std::memory_order_acquire) - readIndex <= SPIKE_STREAM_NUM_RECORDS)
+        {
+            numLost++;
+            readIndex++;
+        }
+    }
+}
+
+bool SpikeStreamReader::waitForNext(SpikeStreamRecord& record, int timeoutUs)
+{
+    uint64_t deadline = getTimeNs() + uint64_t(timeoutUs) * 1000;
+    int numSpins = 0;
+
+    while (! readNext(record))
+    {
+        if (getTimeNs() >= deadline)
+            return false;
+
+        // spin briefly for low latency, then stop hogging the core
+        if (++numSpins > 1000)
+            usleep(50);
+        else
+            sched_yield();
+    }
+
+    return true;
+}
+
+uint64_t SpikeStreamReader::getTimeNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000000000ull + uint64_t(now.tv_nsec);
+}
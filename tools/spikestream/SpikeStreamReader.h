@@ -0,0 +1,48 @@
+
+#ifndef __SPIKESTREAMREADER_H_7F02D6B9__
+#define __SPIKESTREAMREADER_H_7F02D6B9__
+
+#include "../../SpikeDetectorDynamic/SpikeStreamFormat.h"
+
+/**
+  Reads the spike stream published by the Dynamic Detector (spikeStream
+  option) from another process. Each reader keeps its own position, so any
+  number of readers can follow the same stream.
+
+  Only depends on POSIX and the standard library.
+*/
+
+class SpikeStreamReader
+{
+public:
+    SpikeStreamReader();
+    ~SpikeStreamReader();
+
+    /** Maps an existing segment read-only. With fromStart, the records still in
+        the ring are returned first; otherwise only new ones. */
+    bool open(const char* name, bool fromStart = false);
+
+    void close();
+
+    bool isOpen() const { return segment != nullptr; }
+
+    /** Copies the next spike into record (its sequence field is not copied).
+        Returns false if there is no new spike. */
+    bool readNext(SpikeStreamRecord& record);
+
+    /** Like readNext(), but polls until a spike arrives or timeoutUs elapses. */
+    bool waitForNext(SpikeStreamRecord& record, int timeoutUs);
+
+    /** Number of records overwritten before this reader got to them. */
+    uint64_t getNumLost() const { return numLost; }
+
+    /** Monotonic clock in nanoseconds, comparable to publishTimeNs. */
+    static uint64_t getTimeNs();
+
+private:
+    const SpikeStreamSegment* segment;
+    uint64_t readIndex;
+    uint64_t numLost;
+};
+
+#endif  // __SPIKESTREAMREADER_H_7F02D6B9__
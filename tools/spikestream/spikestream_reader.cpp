@@ -0,0 +1,65 @@
+
+// Test reader for the Dynamic Detector spike stream: prints the spikes as
+// they arrive and, on exit, the publish-to-read latency.
+//
+//     spikestream_reader [name] [seconds]
+//
+// name defaults to /dynamic_detector_spikes, seconds to 10.
+
+#include "SpikeStreamReader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+    const char* name = argc > 1 ? argv[1] : "/dynamic_detector_spikes";
+    double seconds = argc > 2 ? atof(argv[2]) : 10.0;
+
+    SpikeStreamReader reader;
+
+    if (! reader.open(name))
+    {
+        fprintf(stderr, "Could not open spike stream %s\n", name);
+        return 1;
+    }
+
+    SpikeStreamRecord record;
+    std::vector<double> latenciesUs;
+    latenciesUs.reserve(1 << 20);
+
+    uint64_t end = SpikeStreamReader::getTimeNs() + uint64_t(seconds * 1.0e9);
+
+    while (SpikeStreamReader::getTimeNs() < end)
+    {
+        if (! reader.waitForNext(record, 100000))
+            continue;
+
+        double latencyUs = double(SpikeStreamReader::getTimeNs() - record.publishTimeNs) / 1000.0;
+
+        if (latenciesUs.size() < latenciesUs.capacity())
+            latenciesUs.push_back(latencyUs);
+
+        printf("electrode %u  timestamp %lld  channels %u  samples %u  latency %.1f us\n",
+               record.electrodeID, (long long) record.timestamp, record.nChannels,
+               record.nSamples, latencyUs);
+    }
+
+    if (latenciesUs.empty())
+    {
+        printf("No spikes received.\n");
+        return 0;
+    }
+
+    std::sort(latenciesUs.begin(), latenciesUs.end());
+
+    printf("%zu spikes, %llu lost; latency median %.1f us, 99th percentile %.1f us, max %.1f us\n",
+           latenciesUs.size(), (unsigned long long) reader.getNumLost(),
+           latenciesUs[latenciesUs.size() / 2],
+           latenciesUs[latenciesUs.size() * 99 / 100],
+           latenciesUs.back());
+
+    return 0;
+}